@@ -0,0 +1,264 @@
+﻿/************************************************************************************ 
+ * Copyright (c) 2008-2011, Columbia University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Columbia University nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY COLUMBIA UNIVERSITY ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * ===================================================================================
+ * Author: Ohan Oda (ohan@cs.columbia.edu)
+ * 
+ *************************************************************************************/ 
+
+using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+using Microsoft.Xna.Framework;
+
+namespace GoblinXNA.Physics.Havok
+{
+    /// <summary>
+    /// Records world changes into a packed buffer that is handed to the wrapper in a single
+    /// call, so a batch of body creations, removals and force applications crosses the managed
+    /// boundary and locks the world only once. The layout matches the CommandBuffer class of
+    /// the native wrapper.
+    /// </summary>
+    public class HavokCommandBuffer
+    {
+        #region Enums
+
+        public enum Opcode
+        {
+            AddBody,
+            RemoveBody,
+            AddForce,
+            AddTorque,
+            SetLinearVelocity,
+            SetAngularVelocity,
+            ApplyHardKeyframe,
+            ApplySoftKeyframe,
+            SetGravity,
+            CreateBody,
+            SpawnBody,
+            SetScale,
+            ApplyExplosion
+        }
+
+        #endregion
+
+        #region Member Fields
+
+        protected int[] words;
+        protected int size;
+        protected List<IntPtr> shapes;
+
+        #endregion
+
+        #region Constructor
+
+        public HavokCommandBuffer()
+        {
+            words = new int[256];
+            size = 0;
+            shapes = new List<IntPtr>();
+        }
+
+        #endregion
+
+        #region Properties
+
+        /// <summary>
+        /// Gets the number of words recorded so far.
+        /// </summary>
+        public int Size
+        {
+            get { return size; }
+        }
+
+        /// <summary>
+        /// Gets the number of bodies that will be created when this buffer is submitted.
+        /// </summary>
+        public int CreatedBodyCount
+        {
+            get { return shapes.Count; }
+        }
+
+        public bool IsEmpty
+        {
+            get { return size == 0; }
+        }
+
+        #endregion
+
+        #region Public Methods
+
+        /// <summary>
+        /// Records the creation of a rigid body. The body takes over the reference to the shape,
+        /// and its handle is returned by Submit in the order the bodies were recorded.
+        /// </summary>
+        public void CreateBody(IntPtr shape, float mass, HavokPhysics.MotionType motionType,
+            HavokPhysics.CollidableQualityType qualityType, Vector3 pos, Quaternion rot,
+            Vector3 linearVelocity, float linearDamping, float maxLinearVelocity,
+            Vector3 angularVelocity, float angularDamping, float maxAngularVelocity, float friction,
+            float restitution, float allowedPenetrationDepth, bool neverDeactivate, float gravityFactor,
+            int collisionFilterInfo)
+        {
+            WriteHeader(Opcode.CreateBody, shapes.Count, 26);
+            shapes.Add(shape);
+
+            Write(mass);
+            Write((float)motionType);
+            Write((float)qualityType);
+            Write(pos);
+            Write(rot);
+            Write(linearVelocity);
+            Write(linearDamping);
+            Write(maxLinearVelocity);
+            Write(angularVelocity);
+            Write(angularDamping);
+            Write(maxAngularVelocity);
+            Write(friction);
+            Write(restitution);
+            Write(allowedPenetrationDepth);
+            Write(neverDeactivate ? 1f : 0f);
+            Write(gravityFactor);
+            Write(collisionFilterInfo);
+        }
+
+        public void RemoveBody(int body)
+        {
+            WriteHeader(Opcode.RemoveBody, body, 0);
+        }
+
+        public void AddForce(int body, float timeStep, Vector3 force)
+        {
+            WriteHeader(Opcode.AddForce, body, 4);
+            Write(timeStep);
+            Write(force);
+        }
+
+        public void AddTorque(int body, float timeStep, Vector3 torque)
+        {
+            WriteHeader(Opcode.AddTorque, body, 4);
+            Write(timeStep);
+            Write(torque);
+        }
+
+        public void SetLinearVelocity(int body, Vector3 velocity)
+        {
+            WriteHeader(Opcode.SetLinearVelocity, body, 3);
+            Write(velocity);
+        }
+
+        public void SetAngularVelocity(int body, Vector3 velocity)
+        {
+            WriteHeader(Opcode.SetAngularVelocity, body, 3);
+            Write(velocity);
+        }
+
+        public void ApplyHardKeyframe(int body, Vector3 pos, Quaternion rot, float timeStep)
+        {
+            WriteHeader(Opcode.ApplyHardKeyframe, body, 8);
+            Write(pos);
+            Write(rot);
+            Write(timeStep);
+        }
+
+        public void SetGravity(Vector3 gravity)
+        {
+            WriteHeader(Opcode.SetGravity, -1, 3);
+            Write(gravity);
+        }
+
+        /// <summary>
+        /// Hands the recorded commands to the wrapper and clears this buffer. If the world is
+        /// being stepped asynchronously, the commands are applied when the step ends.
+        /// </summary>
+        /// <returns>The handles of the created bodies in the order they were recorded. A
+        /// negative handle means the body could not be added.</returns>
+        public int[] Submit()
+        {
+            int[] createdHandles = new int[shapes.Count];
+            if (size > 0)
+            {
+                int numCreated = HavokDllBridge.submit_commands(words, size, shapes.ToArray(), 
+                    shapes.Count, createdHandles);
+                if (numCreated < 0)
+                    throw new GoblinException("Havok physics rejected a malformed command buffer or one referring to a missing shape");
+            }
+
+            Clear();
+
+            return createdHandles;
+        }
+
+        public void Clear()
+        {
+            size = 0;
+            shapes.Clear();
+        }
+
+        #endregion
+
+        #region Private Methods
+
+        private void WriteHeader(Opcode opcode, int handle, int payloadSize)
+        {
+            int required = size + 2 + payloadSize;
+            if (required > words.Length)
+                Array.Resize(ref words, Math.Max(words.Length * 2, required));
+
+            words[size++] = (int)opcode;
+            words[size++] = handle;
+        }
+
+        private void Write(int value)
+        {
+            words[size++] = value;
+        }
+
+        private unsafe void Write(float value)
+        {
+            words[size++] = *(int*)&value;
+        }
+
+        private void Write(Vector3 v)
+        {
+            Write(v.X);
+            Write(v.Y);
+            Write(v.Z);
+        }
+
+        private void Write(Quaternion q)
+        {
+            Write(q.X);
+            Write(q.Y);
+            Write(q.Z);
+            Write(q.W);
+        }
+
+        #endregion
+    }
+}
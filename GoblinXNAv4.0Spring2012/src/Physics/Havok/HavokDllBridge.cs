@@ -36,6 +36,8 @@ using System.Linq;
 using System.Text;
 using System.Runtime.InteropServices;
 
+using Microsoft.Xna.Framework;
+
 namespace GoblinXNA.Physics.Havok
 {
     /// <summary>
@@ -67,6 +69,76 @@ namespace GoblinXNA.Physics.Havok
 
         private const String HAVOK_DLL = "HavokWrapper.dll";
 
+        [DllImport(HAVOK_DLL, EntryPoint = "set_memory_options", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_memory_options(
+            int solverBufferSize,
+            int threadStackSize,
+            HavokPhysics.MemoryAllocatorType allocator);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_toi_options", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_toi_options(
+            int eventQueueSize,
+            float simplifiedToi,
+            float toi,
+            float toiHigher,
+            float toiForced);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_toi_budget", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_toi_budget(
+            int maxToisPerStep,
+            int recoverySteps);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_collision_quality", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_collision_quality(
+            HavokPhysics.CollidableQualityType quality1,
+            HavokPhysics.CollidableQualityType quality2,
+            HavokPhysics.CollisionQualityLevel level);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_toi_counts", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_toi_counts(
+            [Out] int[] counts,
+            int maxCounts);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "is_toi_fallback_active", CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool is_toi_fallback_active();
+
+        [DllImport(HAVOK_DLL, EntryPoint = "install_group_filter", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void install_group_filter(
+            bool standardLayers);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_layer_collision", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_layer_collision(
+            int layer1,
+            int layer2,
+            bool enabled);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_collision_layer_masks", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_collision_layer_masks(
+            int[] masks,
+            int numLayers);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_new_system_group", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_new_system_group();
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_lod_focus", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_lod_focus(
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] focus);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_lod_bands", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_lod_bands(
+            HavokPhysics.LodBand[] bands,
+            int count);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_lod_counts", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void get_lod_counts(
+            out int deactivated,
+            out int keyframed,
+            out int reduced);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_memory_stats", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void get_memory_stats(
+            out HavokPhysics.MemoryStats stats);
+
         [DllImport(HAVOK_DLL, EntryPoint = "init_world", CallingConvention = CallingConvention.Cdecl)]
         public static extern bool init_world(
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] gravity, 
@@ -75,7 +147,19 @@ namespace GoblinXNA.Physics.Havok
             HavokPhysics.SimulationType simulationType,
             HavokPhysics.SolverType solverType,
             bool fireCollisionCallbacks,
-            bool enableDeactivation);
+            bool enableDeactivation,
+            float contactRestingVelocity);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "init_world_mt", CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool init_world_mt(
+            int numWorkerThreads,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] gravity,
+            float worldSize,
+            float collisionTolerance,
+            HavokPhysics.SolverType solverType,
+            bool fireCollisionCallbacks,
+            bool enableDeactivation,
+            float contactRestingVelocity);
 
         [DllImport(HAVOK_DLL, EntryPoint = "set_gravity", CallingConvention = CallingConvention.Cdecl)]
         public static extern void set_gravity(
@@ -124,7 +208,8 @@ namespace GoblinXNA.Physics.Havok
         public static extern IntPtr create_phantom_shape(
             IntPtr boundingShape,
             PhantomEnterCallback enterCallback,
-            PhantomLeaveCallback leaveCallback);
+            PhantomLeaveCallback leaveCallback,
+            bool queueEvents);
 
         [DllImport(HAVOK_DLL, EntryPoint = "create_mesh_shape", CallingConvention = CallingConvention.Cdecl)]
         public static extern IntPtr create_mesh_shape(
@@ -135,8 +220,31 @@ namespace GoblinXNA.Physics.Havok
             [MarshalAs(UnmanagedType.LPArray)] int[] indices,
             float convexRadius);
 
+        [DllImport(HAVOK_DLL, EntryPoint = "release_shape", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void release_shape(
+            IntPtr shape);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_shape_stats", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void get_shape_stats(
+            out int hits,
+            out int misses,
+            out int liveShapes);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "release_unused_shapes", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void release_unused_shapes();
+
+        [DllImport(HAVOK_DLL, EntryPoint = "open_shape_cache", CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool open_shape_cache(
+            [MarshalAs(UnmanagedType.LPStr)] string path);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "save_shape_cache", CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool save_shape_cache();
+
+        [DllImport(HAVOK_DLL, EntryPoint = "close_shape_cache", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void close_shape_cache();
+
         [DllImport(HAVOK_DLL, EntryPoint = "add_rigid_body", CallingConvention = CallingConvention.Cdecl)]
-        public static extern IntPtr add_rigid_body(
+        public static extern int add_rigid_body(
             IntPtr shape,
             float mass,
             HavokPhysics.MotionType motionType,
@@ -153,61 +261,162 @@ namespace GoblinXNA.Physics.Havok
             float restitution,
             float allowedPenetrationDepth,
             bool neverDeactivate,
-            float gravityFactor);
+            float gravityFactor,
+            int collisionFilterInfo);
 
         [DllImport(HAVOK_DLL, EntryPoint = "remove_rigid_body", CallingConvention = CallingConvention.Cdecl)]
         public static extern void remove_rigid_body(
+            int body);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "create_body_pool", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int create_body_pool(
+            IntPtr shape,
+            int size,
+            float mass,
+            HavokPhysics.MotionType motionType,
+            HavokPhysics.CollidableQualityType qualityType,
+            float linearDamping,
+            float maxLinearVelocity,
+            float angularDamping,
+            float maxAngularVelocity,
+            float friction,
+            float restitution,
+            float allowedPenetrationDepth,
+            bool neverDeactivate,
+            float gravityFactor,
+            int collisionFilterInfo);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "spawn_pooled_body", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int spawn_pooled_body(
+            int pool,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] pos,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 4)] float[] rot,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] linearVelocity,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] angularVelocity);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_pool_free_count", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_pool_free_count(
+            int pool);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "destroy_body_pool", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void destroy_body_pool(
+            int pool);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "submit_commands", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int submit_commands(
+            int[] words,
+            int numWords,
+            IntPtr[] shapes,
+            int numShapes,
+            [Out] int[] createdHandles);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_body_handle", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_body_handle(
             IntPtr body);
 
         [DllImport(HAVOK_DLL, EntryPoint = "add_contact_listener", CallingConvention = CallingConvention.Cdecl)]
         public static extern void add_contact_listener(
-            IntPtr body,
+            int body,
             ContactCallback cc,
             CollisionStarted cs,
-            CollisionEnded ce);
+            CollisionEnded ce,
+            float minSpeed,
+            float cooldown,
+            bool oncePerStep);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "add_contact_event_listener", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void add_contact_event_listener(
+            int body,
+            float minSpeed,
+            float cooldown,
+            bool oncePerStep);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_contact_events", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_contact_events(
+            [Out] HavokPhysics.ContactEvent[] events,
+            int maxEvents);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_dropped_contact_events", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_dropped_contact_events();
+
+        [DllImport(HAVOK_DLL, EntryPoint = "enable_profiling", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void enable_profiling(
+            int historySize,
+            [MarshalAs(UnmanagedType.LPStr)] string csvPath);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "disable_profiling", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void disable_profiling();
+
+        [DllImport(HAVOK_DLL, EntryPoint = "start_recording", CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool start_recording(
+            [MarshalAs(UnmanagedType.LPStr)] string path);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "stop_recording", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void stop_recording();
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_step_stats", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_step_stats(
+            [Out] HavokPhysics.StepStats[] stats,
+            int maxStats);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_phantom_events", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_phantom_events(
+            [Out] HavokPhysics.PhantomEvent[] events,
+            int maxEvents);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_phantom_overlaps", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_phantom_overlaps(
+            int body,
+            [Out] int[] overlaps,
+            int maxBodies);
 
         [DllImport(HAVOK_DLL, EntryPoint = "add_force", CallingConvention = CallingConvention.Cdecl)]
         public static extern void add_force(
-            IntPtr body,
+            int body,
             float timeStep,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] force);
 
         [DllImport(HAVOK_DLL, EntryPoint = "add_torque", CallingConvention = CallingConvention.Cdecl)]
         public static extern void add_torque(
-            IntPtr body,
+            int body,
             float timeStep,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] torque);
 
+        [DllImport(HAVOK_DLL, EntryPoint = "set_body_scale", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_body_scale(
+            int body,
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] scale);
+
         [DllImport(HAVOK_DLL, EntryPoint = "set_linear_velocity", CallingConvention = CallingConvention.Cdecl)]
         public static extern void set_linear_velocity(
-            IntPtr body,
+            int body,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] vel);
 
         [DllImport(HAVOK_DLL, EntryPoint = "set_angular_velocity", CallingConvention = CallingConvention.Cdecl)]
         public static extern void set_angular_velocity(
-            IntPtr body,
+            int body,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] vel);
 
         [DllImport(HAVOK_DLL, EntryPoint = "get_linear_velocity", CallingConvention = CallingConvention.Cdecl)]
         public static extern void get_linear_velocity(
-            IntPtr body,
+            int body,
             [Out, MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] vel);
 
         [DllImport(HAVOK_DLL, EntryPoint = "get_angular_velocity", CallingConvention = CallingConvention.Cdecl)]
         public static extern void get_angular_velocity(
-            IntPtr body,
+            int body,
             [Out, MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] vel);
 
         [DllImport(HAVOK_DLL, EntryPoint = "apply_hard_keyframe", CallingConvention = CallingConvention.Cdecl)]
         public static extern void apply_hard_keyframe(
-            IntPtr body,
+            int body,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] pos,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 4)] float[] rot,
             float timeStep);
 
         [DllImport(HAVOK_DLL, EntryPoint = "apply_soft_keyframe", CallingConvention = CallingConvention.Cdecl)]
         public static extern void apply_soft_keyframe(
-            IntPtr body,
+            int body,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] pos,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 4)] float[] rot,
             [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] angularPosFac,
@@ -221,26 +430,120 @@ namespace GoblinXNA.Physics.Havok
 
         [DllImport(HAVOK_DLL, EntryPoint = "get_AABB", CallingConvention = CallingConvention.Cdecl)]
         public static extern void get_AABB(
-            IntPtr body,
+            int body,
             [Out, MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] min,
             [Out, MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] max);
 
+        [DllImport(HAVOK_DLL, EntryPoint = "get_body_states", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_body_states(
+            int count,
+            int[] bodies,
+            [Out] Vector3[] positions,
+            [Out] Quaternion[] rotations,
+            [Out] Vector3[] linearVelocities,
+            [Out] Vector3[] angularVelocities);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_body_aabbs", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int get_body_aabbs(
+            int count,
+            int[] bodies,
+            [Out] Vector3[] mins,
+            [Out] Vector3[] maxs);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_linear_velocities", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_linear_velocities(
+            int count,
+            int[] bodies,
+            Vector3[] vels);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_angular_velocities", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_angular_velocities(
+            int count,
+            int[] bodies,
+            Vector3[] vels);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "apply_hard_keyframes", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void apply_hard_keyframes(
+            int count,
+            int[] bodies,
+            Vector3[] positions,
+            Quaternion[] rotations,
+            float timeStep);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "cast_rays", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int cast_rays(
+            int count,
+            Vector3[] origins,
+            Vector3[] directions,
+            float maxDistance,
+            int filterInfo,
+            [Out] HavokPhysics.RayHit[] hits);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "cast_shape", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int cast_shape(
+            IntPtr shape,
+            int count,
+            Vector3[] origins,
+            Quaternion[] rotations,
+            Vector3[] directions,
+            float maxDistance,
+            int filterInfo,
+            [Out] HavokPhysics.RayHit[] hits);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "apply_explosion", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int apply_explosion(
+            [MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] center,
+            float radius,
+            float impulse,
+            float falloff,
+            int layerMask,
+            bool occlusion,
+            [Out] int[] affected,
+            int maxAffected);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "save_world_state", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int save_world_state(
+            byte[] buffer,
+            int capacity,
+            byte[] baseState,
+            int baseSize);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "load_world_state", CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool load_world_state(
+            byte[] buffer,
+            int size,
+            byte[] baseState,
+            int baseSize);
+
         [DllImport(HAVOK_DLL, EntryPoint = "update", CallingConvention = CallingConvention.Cdecl)]
         public static extern void update(float elapsedSeconds);
 
+        [DllImport(HAVOK_DLL, EntryPoint = "advance", CallingConvention = CallingConvention.Cdecl)]
+        public static extern int advance(
+            float elapsedSeconds,
+            float fixedTimeStep,
+            int maxSteps,
+            bool interpolate);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "begin_step", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void begin_step(float elapsedSeconds, int numSteps);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "end_step", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void end_step();
+
         [DllImport(HAVOK_DLL, EntryPoint = "get_body_transform", CallingConvention = CallingConvention.Cdecl)]
         public static extern void get_body_transform(
-            IntPtr body,
+            int body,
             [Out, MarshalAs(UnmanagedType.LPArray, SizeConst = 16)] float[] transform);
 
         [DllImport(HAVOK_DLL, EntryPoint = "get_body_position", CallingConvention = CallingConvention.Cdecl)]
         public static extern void get_body_position(
-            IntPtr body,
+            int body,
             [Out, MarshalAs(UnmanagedType.LPArray, SizeConst = 3)] float[] position);
 
         [DllImport(HAVOK_DLL, EntryPoint = "get_body_rotation", CallingConvention = CallingConvention.Cdecl)]
         public static extern void get_body_rotation(
-            IntPtr body,
+            int body,
             [Out, MarshalAs(UnmanagedType.LPArray, SizeConst = 4)] float[] rotation);
 
         [DllImport(HAVOK_DLL, EntryPoint = "get_updated_transforms", CallingConvention = CallingConvention.Cdecl)]
@@ -249,6 +552,22 @@ namespace GoblinXNA.Physics.Havok
             [Out] IntPtr transformPtr, 
             ref int totalSize);
 
+        [DllImport(HAVOK_DLL, EntryPoint = "get_transform_buffer", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void get_transform_buffer(
+            out IntPtr bodyPtr,
+            out IntPtr transformPtr,
+            out int totalSize);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "get_sleeping_bodies", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void get_sleeping_bodies(
+            out IntPtr bodyPtr,
+            out int totalSize);
+
+        [DllImport(HAVOK_DLL, EntryPoint = "set_transform_epsilon", CallingConvention = CallingConvention.Cdecl)]
+        public static extern void set_transform_epsilon(
+            float linearEpsilon,
+            float angularEpsilon);
+
         [DllImport(HAVOK_DLL, EntryPoint = "dispose")]
         public static extern void dispose();
     }
@@ -60,7 +60,13 @@ namespace GoblinXNA.Physics.Havok
         private float maxAngularVelocity;
         private float convexRadius;
         private float gravityFactor;
+        private int collisionFilterInfo;
         private bool isPhantom;
+        private bool queuePhantomEvents;
+        private bool queueContactEvents;
+        private float minContactSpeed;
+        private float contactCooldown;
+        private bool oneContactPerStep;
 
         private HavokDllBridge.ContactCallback contactCallback;
         private HavokDllBridge.CollisionStarted collisionStartCallback;
@@ -89,8 +95,14 @@ namespace GoblinXNA.Physics.Havok
             maxAngularVelocity = -1;
             convexRadius = 0.05f;
             gravityFactor = 1;
+            collisionFilterInfo = 0;
 
             isPhantom = false;
+            queuePhantomEvents = false;
+            queueContactEvents = false;
+            minContactSpeed = 0;
+            contactCooldown = 0;
+            oneContactPerStep = false;
         }
 
         public HavokObject() : this(null) { }
@@ -219,6 +231,22 @@ namespace GoblinXNA.Physics.Havok
             }
         }
 
+        /// <summary>
+        /// Gets or sets the collision filter info of this physics object, which decides what it
+        /// collides with once HavokPhysics.InstallGroupFilter was called. Use
+        /// HavokPhysics.CalcFilterInfo to build it. Default value is 0, which collides with
+        /// everything.
+        /// </summary>
+        public int CollisionFilterInfo
+        {
+            get { return collisionFilterInfo; }
+            set 
+            { 
+                collisionFilterInfo = value;
+                modified = true;
+            }
+        }
+
         /// <summary>
         /// Gets or sets whether this physics object will be treated as a phantom object.
         /// Default value is false.
@@ -229,6 +257,19 @@ namespace GoblinXNA.Physics.Havok
             set { isPhantom = value; }
         }
 
+        /// <summary>
+        /// Gets or sets whether the enter and leave events of this phantom object are recorded
+        /// into a queue that is drained with HavokPhysics.GetPhantomEvents after the step,
+        /// instead of being reported through the callbacks during collision detection.
+        /// Effective only IsPhantom is set to true. Default value is false.
+        /// </summary>
+        /// <see cref="IsPhantom"/>
+        public bool QueuePhantomEvents
+        {
+            get { return queuePhantomEvents; }
+            set { queuePhantomEvents = value; }
+        }
+
         /// <summary>
         /// Gets or sets the callback function when there is a contact with other physics objects.
         /// </summary>
@@ -256,6 +297,48 @@ namespace GoblinXNA.Physics.Havok
             set { collisionEndCallback = value; }
         }
 
+        /// <summary>
+        /// Gets or sets whether the contacts of this physics object are recorded into a queue
+        /// that is drained with HavokPhysics.GetContactEvents after the step, instead of being
+        /// reported through the callbacks while the world is stepped. The callbacks are ignored
+        /// if this is set. Default value is false.
+        /// </summary>
+        public bool QueueContactEvents
+        {
+            get { return queueContactEvents; }
+            set { queueContactEvents = value; }
+        }
+
+        /// <summary>
+        /// Gets or sets the minimum separating speed of a contact point for it to be reported,
+        /// which keeps resting contacts from reporting every step. Default value is 0.
+        /// </summary>
+        public float MinContactSpeed
+        {
+            get { return minContactSpeed; }
+            set { minContactSpeed = value; }
+        }
+
+        /// <summary>
+        /// Gets or sets the time in seconds during which no further contact points are reported
+        /// for a pair of physics objects after one was reported. Default value is 0.
+        /// </summary>
+        public float ContactCooldown
+        {
+            get { return contactCooldown; }
+            set { contactCooldown = value; }
+        }
+
+        /// <summary>
+        /// Gets or sets whether at most one contact point per step is reported for a pair of
+        /// physics objects. Default value is false.
+        /// </summary>
+        public bool OneContactPerStep
+        {
+            get { return oneContactPerStep; }
+            set { oneContactPerStep = value; }
+        }
+
         /// <summary>
         /// Gets or sets the callback function when a physics object enters this phantom object.
         /// Effective only IsPhantom is set to true.
@@ -327,6 +410,7 @@ namespace GoblinXNA.Physics.Havok
             xmlNode.SetAttribute("MaxAngularVelocity", maxAngularVelocity.ToString());
             xmlNode.SetAttribute("ConvexRadius", convexRadius.ToString());
             xmlNode.SetAttribute("GravityFactor", gravityFactor.ToString());
+            xmlNode.SetAttribute("CollisionFilterInfo", collisionFilterInfo.ToString());
             xmlNode.SetAttribute("IsPhantom", isPhantom.ToString());
 
             if (contactCallback != null)
@@ -367,6 +451,8 @@ namespace GoblinXNA.Physics.Havok
                 convexRadius = float.Parse(xmlNode.GetAttribute("ConvexRadius"));
             if (xmlNode.HasAttribute("GravityFactor"))
                 gravityFactor = float.Parse(xmlNode.GetAttribute("GravityFactor"));
+            if (xmlNode.HasAttribute("CollisionFilterInfo"))
+                collisionFilterInfo = int.Parse(xmlNode.GetAttribute("CollisionFilterInfo"));
             if (xmlNode.HasAttribute("IsPhantom"))
                 isPhantom = bool.Parse(xmlNode.GetAttribute("IsPhantom"));
         }
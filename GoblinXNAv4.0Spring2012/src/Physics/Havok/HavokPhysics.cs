@@ -228,8 +228,9 @@ namespace GoblinXNA.Physics.Havok
             COLLIDABLE_QUALITY_BULLET,
 
             /// <summary>
-            /// For user. If you want to use this, you have to modify 
-            /// hkpCollisionDispatcher::initCollisionQualityInfo()
+            /// Use this for fast objects that may fall back to discrete collisions while the
+            /// world is over its TOI budget, see HavokPhysics.SetToiBudget. Collides like
+            /// COLLIDABLE_QUALITY_BULLET otherwise.
             /// </summary>
             COLLIDABLE_QUALITY_USER,
 
@@ -253,6 +254,104 @@ namespace GoblinXNA.Physics.Havok
             COLLIDABLE_QUALITY_MAX
         }
 
+        /// <summary>
+        /// How the collisions between two collidable qualities are handled, see
+        /// HavokPhysics.SetCollisionQuality
+        /// </summary>
+        public enum CollisionQualityLevel
+        {
+            /// <summary>
+            /// Discrete collisions only
+            /// </summary>
+            PSI = 0,
+
+            /// <summary>
+            /// Continuous collisions that only move the faster body back to the time of impact
+            /// </summary>
+            SimplifiedToi,
+
+            /// <summary>
+            /// Continuous collisions
+            /// </summary>
+            Toi,
+
+            /// <summary>
+            /// Continuous collisions with a smaller allowed penetration
+            /// </summary>
+            ToiHigher,
+
+            /// <summary>
+            /// Continuous collisions for pairs that must never tunnel
+            /// </summary>
+            ToiForced
+        }
+
+        public enum MemoryAllocatorType
+        {
+            /// <summary>
+            /// Free lists that take their memory from the system allocator as they grow
+            /// </summary>
+            FreeList = 0,
+
+            /// <summary>
+            /// Free lists carved out of large blocks taken from the system allocator
+            /// </summary>
+            PooledArena
+        }
+
+        /// <summary>
+        /// What happens to the physics objects beyond the distance of a LodBand
+        /// </summary>
+        public enum LodMode
+        {
+            /// <summary>
+            /// Their islands are deactivated until they come closer or something wakes them
+            /// </summary>
+            Deactivate = 0,
+
+            /// <summary>
+            /// Their dynamic bodies are frozen as keyframed bodies, which other bodies still
+            /// collide with
+            /// </summary>
+            Keyframe,
+
+            /// <summary>
+            /// Their islands are only simulated every LodBand.Interval steps and sleep in between
+            /// </summary>
+            Reduced
+        }
+
+        public enum ContactEventKind
+        {
+            /// <summary>
+            /// A contact point was added or processed. Speed, Point and Normal are set.
+            /// </summary>
+            ContactPoint = 0,
+
+            /// <summary>
+            /// The two bodies started colliding
+            /// </summary>
+            CollisionStarted,
+
+            /// <summary>
+            /// The two bodies stopped colliding
+            /// </summary>
+            CollisionEnded
+        }
+
+        public enum PhantomEventKind
+        {
+            /// <summary>
+            /// A physics object entered the phantom
+            /// </summary>
+            Enter = 0,
+
+            /// <summary>
+            /// A physics object left the phantom
+            /// </summary>
+            Leave
+        }
+
         #endregion
 
         #region Structs
@@ -267,6 +366,36 @@ namespace GoblinXNA.Physics.Havok
             public SolverType HavokSolverType;
             public bool EnableDeactivation;
             public bool FireCollisionCallbacks;
+            public float ContactRestingVelocity;
+            /// <summary>
+            /// The number of worker threads used in addition to the calling thread when 
+            /// HavokSimulationType is SIMULATION_TYPE_MULTITHREADED. A negative value uses
+            /// one worker for every other hardware thread.
+            /// </summary>
+            public int NumWorkerThreads;
+            /// <summary>
+            /// The size in bytes of the buffer preallocated for the solver. When the solver needs
+            /// more than that, or the size is 0, it allocates from the heap as it goes.
+            /// </summary>
+            public int SolverBufferSize;
+            /// <summary>
+            /// The size in bytes of the Havok stack of each worker thread, or 0 for the default.
+            /// </summary>
+            public int ThreadStackSize;
+            public MemoryAllocatorType MemoryAllocator;
+            /// <summary>
+            /// The number of TOI events a step can hold. Further events are dropped. 0 keeps
+            /// the Havok default.
+            /// </summary>
+            public int ToiEventQueueSize;
+            /// <summary>
+            /// The number of TOIs a body pair may have in a step before it is allowed to
+            /// penetrate, for each continuous collision quality level. 0 keeps the Havok default.
+            /// </summary>
+            public float NumToisTillAllowedPenetrationSimplifiedToi;
+            public float NumToisTillAllowedPenetrationToi;
+            public float NumToisTillAllowedPenetrationToiHigher;
+            public float NumToisTillAllowedPenetrationToiForced;
 
             public WorldCinfo()
             {
@@ -278,18 +407,146 @@ namespace GoblinXNA.Physics.Havok
                 HavokSolverType = SolverType.SOLVER_TYPE_4ITERS_MEDIUM;
                 FireCollisionCallbacks = false;
                 EnableDeactivation = true;
+                ContactRestingVelocity = 1;
+                NumWorkerThreads = -1;
+                SolverBufferSize = 0;
+                ThreadStackSize = 0;
+                MemoryAllocator = MemoryAllocatorType.FreeList;
+                ToiEventQueueSize = 0;
+                NumToisTillAllowedPenetrationSimplifiedToi = 0;
+                NumToisTillAllowedPenetrationToi = 0;
+                NumToisTillAllowedPenetrationToiHigher = 0;
+                NumToisTillAllowedPenetrationToiForced = 0;
+            }
+        }
+
+        /// <summary>
+        /// The memory used by Havok. The System fields count what the memory system took from
+        /// the operating system, and the Heap fields the use of the heap built on top of it.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct MemoryStats
+        {
+            public long SystemInUse;
+            public long SystemPeakInUse;
+            public long HeapAllocated;
+            public long HeapInUse;
+            public long HeapPeakInUse;
+            public int SystemAllocations;
+            public int SystemFrees;
+            public int SolverBufferSize;
+            public MemoryAllocatorType Allocator;
+        }
+
+        /// <summary>
+        /// A distance band of the simulation LOD, see HavokPhysics.SetLodBands.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct LodBand
+        {
+            /// <summary>
+            /// The distance from the focus point where the band starts
+            /// </summary>
+            public float Distance;
+            public LodMode Mode;
+
+            /// <summary>
+            /// For LodMode.Reduced, simulate one step out of this many
+            /// </summary>
+            public int Interval;
+
+            public LodBand(float distance, LodMode mode, int interval)
+            {
+                Distance = distance;
+                Mode = mode;
+                Interval = interval;
             }
         }
 
+        /// <summary>
+        /// A contact event recorded during a step. Body1 and Body2 are body handles, which can be
+        /// passed to GetPhysicsObject.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct ContactEvent
+        {
+            public int Body1;
+            public int Body2;
+            public ContactEventKind Kind;
+            public float Speed;
+            public Vector3 Point;
+            public Vector3 Normal;
+        }
+
+        /// <summary>
+        /// A phantom enter or leave event recorded during a step. Phantom and Body are body
+        /// handles, which can be passed to GetPhysicsObject.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct PhantomEvent
+        {
+            public int Phantom;
+            public int Body;
+            public PhantomEventKind Kind;
+        }
+
+        /// <summary>
+        /// The timings in milliseconds and the counters of a single world step. The timings of
+        /// the worker threads of a multithreaded world are summed, so they can add up to more
+        /// than Total.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct StepStats
+        {
+            public float Total;
+            public float Broadphase;
+            public float Narrowphase;
+            public float Solver;
+            public float Integrate;
+            public float Toi;
+            public float Callbacks;
+            public float Other;
+            public int ActiveIslands;
+            public int ActiveBodies;
+            public int ContactPoints;
+            public int ToiEvents;
+        }
+
+        /// <summary>
+        /// The closest hit of a ray or shape cast. Body is the handle of the body that was hit,
+        /// which can be passed to GetPhysicsObject, or negative if nothing was hit.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct RayHit
+        {
+            public int Body;
+            public Vector3 Position;
+            public Vector3 Normal;
+            public float Distance;
+        }
+
         #endregion
 
         #region Member Fields
 
+        /// <summary>
+        /// The low bits of a body handle returned by the wrapper hold the slot index.
+        /// </summary>
+        protected const int BODY_INDEX_MASK = 0xFFFFF;
+
         protected WorldCinfo info;
 
-        protected Dictionary<IPhysicsObject, IntPtr> objectIDs;
-        protected Dictionary<IntPtr, IPhysicsObject> reverseIDs;
-        protected Dictionary<IntPtr, Vector3> scaleTable;
+        protected Dictionary<IPhysicsObject, int> objectIDs;
+
+        /// <summary>
+        /// Physics objects indexed by the slot index of their body handles.
+        /// </summary>
+        protected IPhysicsObject[] slotObjects;
+
+        /// <summary>
+        /// The physics objects that went to sleep in the steps published by the last update.
+        /// </summary>
+        protected List<IPhysicsObject> sleptObjects;
 
         protected bool pauseSimulation;
         protected int numSubSteps;
@@ -297,12 +554,39 @@ namespace GoblinXNA.Physics.Havok
 
         protected float simulationSpeed;
 
+        protected bool asynchronousUpdate;
+        protected bool interpolateTransforms;
+
+        /// <summary>
+        /// Commands recorded between BeginBatch and EndBatch, and the physics objects whose
+        /// bodies will be created when they are submitted.
+        /// </summary>
+        protected HavokCommandBuffer commandBuffer;
+        protected bool batching;
+        protected List<IPhysicsObject> pendingObjects;
+        protected List<Vector3> pendingScales;
+
+        /// <summary>
+        /// The scale of the template of each body pool, and the pool each spawned object
+        /// belongs to.
+        /// </summary>
+        protected Dictionary<int, Vector3> poolScales;
+        protected Dictionary<IPhysicsObject, int> pooledObjects;
+
+        /// <summary>
+        /// The shapes built for CastShape, and the scale each one was built with.
+        /// </summary>
+        protected Dictionary<IPhysicsObject, IntPtr> castShapes;
+        protected Dictionary<IPhysicsObject, Vector3> castShapeScales;
+
         #region Temporary Variables For Calculation
 
         protected Matrix tmpMat1 = Matrix.Identity;
         protected Matrix tmpMat2 = Matrix.Identity;
         protected Vector3 tmpVec1 = new Vector3();
         protected Vector3 tmpVec2 = new Vector3();
+        protected int[] overlapHandles = new int[16];
+        protected int[] explosionHandles = new int[16];
 
         #endregion
 
@@ -318,10 +602,23 @@ namespace GoblinXNA.Physics.Havok
             simulationTimeStep = 0.016f;
             pauseSimulation = false;
             simulationSpeed = 1;
+            asynchronousUpdate = false;
+            interpolateTransforms = false;
+
+            objectIDs = new Dictionary<IPhysicsObject, int>();
+            slotObjects = new IPhysicsObject[64];
+            sleptObjects = new List<IPhysicsObject>();
+
+            commandBuffer = new HavokCommandBuffer();
+            batching = false;
+            pendingObjects = new List<IPhysicsObject>();
+            pendingScales = new List<Vector3>();
 
-            objectIDs = new Dictionary<IPhysicsObject, IntPtr>();
-            reverseIDs = new Dictionary<IntPtr, IPhysicsObject>();
-            scaleTable = new Dictionary<IntPtr, Vector3>();
+            poolScales = new Dictionary<int, Vector3>();
+            pooledObjects = new Dictionary<IPhysicsObject, int>();
+
+            castShapes = new Dictionary<IPhysicsObject, IntPtr>();
+            castShapeScales = new Dictionary<IPhysicsObject, Vector3>();
         }
 
         #endregion
@@ -385,6 +682,53 @@ namespace GoblinXNA.Physics.Havok
             get { return info; }
         }
 
+        /// <summary>
+        /// Gets or sets whether the simulation is stepped on a background thread. If set to true,
+        /// Update(...) publishes the step started in the previous frame and starts the next one,
+        /// so the physics simulation runs in parallel with rendering at the cost of one frame of
+        /// latency. Modifications made while a step is running are queued and applied after it.
+        /// Note that the contact and phantom callbacks are then invoked from the step thread.
+        /// Default value is false.
+        /// </summary>
+        public bool AsynchronousUpdate
+        {
+            get { return asynchronousUpdate; }
+            set 
+            {
+                if (asynchronousUpdate && !value)
+                {
+                    HavokDllBridge.end_step();
+                    UpdateTransforms();
+                }
+                asynchronousUpdate = value; 
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets whether the physics objects are placed at poses interpolated between the
+        /// last two simulation steps. Only applies when MaxSimulationSubSteps is greater than 1
+        /// and AsynchronousUpdate is false, in which case the simulation runs in fixed steps of
+        /// SimulationTimeStep and the time left over in a frame is carried over to the next one.
+        /// Interpolating smooths the motion at frame rates that do not match the simulation rate,
+        /// at the cost of one step of latency. Default value is false.
+        /// </summary>
+        public bool InterpolateTransforms
+        {
+            get { return interpolateTransforms; }
+            set { interpolateTransforms = value; }
+        }
+
+        /// <summary>
+        /// Gets the physics objects that went to sleep in the steps published by the last call
+        /// to Update. Their PhysicsWorldTransform was set to their final pose, and they are not
+        /// updated again until they wake up, so this is the place to mark them as static for
+        /// rendering or culling. The list is reused by every update.
+        /// </summary>
+        public List<IPhysicsObject> SleptObjects
+        {
+            get { return sleptObjects; }
+        }
+
         #endregion
 
         #region Public Methods
@@ -392,9 +736,24 @@ namespace GoblinXNA.Physics.Havok
         public void InitializePhysics()
         {
             Vector3 g = info.Gravity * info.GravityDirection;
-            if (!HavokDllBridge.init_world(Vector3Helper.ToFloats(g), info.WorldSize, 
-                info.CollisionTolerance, info.HavokSimulationType, info.HavokSolverType,
-                info.FireCollisionCallbacks, info.EnableDeactivation))
+            bool initialized = false;
+
+            HavokDllBridge.set_memory_options(info.SolverBufferSize, info.ThreadStackSize,
+                info.MemoryAllocator);
+            HavokDllBridge.set_toi_options(info.ToiEventQueueSize, info.NumToisTillAllowedPenetrationSimplifiedToi,
+                info.NumToisTillAllowedPenetrationToi, info.NumToisTillAllowedPenetrationToiHigher,
+                info.NumToisTillAllowedPenetrationToiForced);
+
+            if (info.HavokSimulationType == SimulationType.SIMULATION_TYPE_MULTITHREADED)
+                initialized = HavokDllBridge.init_world_mt(info.NumWorkerThreads, Vector3Helper.ToFloats(g),
+                    info.WorldSize, info.CollisionTolerance, info.HavokSolverType, info.FireCollisionCallbacks,
+                    info.EnableDeactivation, info.ContactRestingVelocity);
+            else
+                initialized = HavokDllBridge.init_world(Vector3Helper.ToFloats(g), info.WorldSize,
+                    info.CollisionTolerance, info.HavokSimulationType, info.HavokSolverType,
+                    info.FireCollisionCallbacks, info.EnableDeactivation, info.ContactRestingVelocity);
+
+            if (!initialized)
                 throw new GoblinException("Failed to initialize Havok physics");
         }
 
@@ -406,52 +765,127 @@ namespace GoblinXNA.Physics.Havok
 
             List<IPhysicsObject> physObjs = new List<IPhysicsObject>(objectIDs.Keys);
 
+            // Body pools do not survive the restart, so spawned objects come back as regular ones
             objectIDs.Clear();
-            reverseIDs.Clear();
-            scaleTable.Clear();
+            Array.Clear(slotObjects, 0, slotObjects.Length);
+            sleptObjects.Clear();
+            poolScales.Clear();
+            pooledObjects.Clear();
 
             foreach (IPhysicsObject physObj in physObjs)
                 AddPhysicsObject(physObj);
         }
 
-        public void AddPhysicsObject(IPhysicsObject physObj)
+        /// <summary>
+        /// Gets the statistics of the shapes shared between physics objects. Box, sphere, capsule,
+        /// cylinder and convex hull shapes created with the same parameters are shared.
+        /// </summary>
+        /// <param name="hits">The number of shape creations that reused an existing shape</param>
+        /// <param name="misses">The number of shape creations that created a new shape</param>
+        /// <param name="liveShapes">The number of shared shapes used by at least one object</param>
+        public void GetShapeStats(out int hits, out int misses, out int liveShapes)
         {
-            if (objectIDs.ContainsKey(physObj))
-                return;
+            HavokDllBridge.get_shape_stats(out hits, out misses, out liveShapes);
+        }
 
-            physObj.PhysicsWorldTransform = physObj.CompoundInitialWorldTransform;
+        /// <summary>
+        /// Frees the shared shapes that are no longer used by any physics object.
+        /// </summary>
+        public void ReleaseUnusedShapes()
+        {
+            HavokDllBridge.release_unused_shapes();
+        }
 
-            HavokPhysics.MotionType motionType = MotionType.MOTION_INVALID;
-            HavokPhysics.CollidableQualityType qualityType = 
-                CollidableQualityType.COLLIDABLE_QUALITY_INVALID;
-            float friction = -1;
-            float restitution = -1;
-            float maxLinearVelocity = -1;
-            float maxAngularVelocity = -1;
-            float allowedPenetrationDepth = -1;
-            float gravityFactor = 1;
+        /// <summary>
+        /// Opens a file of baked convex hulls and triangle mesh MOPP codes. While it is open,
+        /// ConvexHull and TriangleMesh shapes whose vertices and indices match a baked entry are
+        /// created from it instead of being rebuilt. Call SaveShapeCache once the shapes are
+        /// created to bake the ones that were missing.
+        /// </summary>
+        /// <param name="path">The cache file, which does not need to exist yet</param>
+        public void OpenShapeCache(String path)
+        {
+            if (!HavokDllBridge.open_shape_cache(path))
+                throw new GoblinException("Failed to open the Havok shape cache " + path);
+        }
 
-            if ((physObj is HavokObject))
-            {
-                HavokObject havokObj = (HavokObject)physObj;
-                motionType = havokObj.MotionType;
-                qualityType = havokObj.QualityType;
-                friction = havokObj.Friction;
-                restitution = havokObj.Restitution;
-                maxLinearVelocity = havokObj.MaxLinearVelocity;
-                maxAngularVelocity = havokObj.MaxAngularVelocity;
-                allowedPenetrationDepth = havokObj.AllowedPenetrationDepth;
-                gravityFactor = havokObj.GravityFactor;
-            }
-            else
+        /// <summary>
+        /// Writes the shapes built since the shape cache was opened to the cache file.
+        /// </summary>
+        public void SaveShapeCache()
+        {
+            if (!HavokDllBridge.save_shape_cache())
+                throw new GoblinException("Failed to save the Havok shape cache");
+        }
+
+        /// <summary>
+        /// Closes the shape cache. Physics objects whose shapes were created from it must have
+        /// been removed first.
+        /// </summary>
+        public void CloseShapeCache()
+        {
+            HavokDllBridge.close_shape_cache();
+        }
+
+        /// <summary>
+        /// Starts recording physics object additions and removals, forces, velocities and hard
+        /// keyframes instead of passing them to the wrapper one by one. They are submitted in a
+        /// single call when EndBatch is called. An object added during a batch is not known to
+        /// the physics engine until then, so other changes to it are ignored.
+        /// </summary>
+        public void BeginBatch()
+        {
+            batching = true;
+        }
+
+        /// <summary>
+        /// Submits the changes recorded since BeginBatch.
+        /// </summary>
+        public void EndBatch()
+        {
+            if (!batching)
+                return;
+
+            batching = false;
+            int[] handles = commandBuffer.Submit();
+
+            bool failed = false;
+            for (int i = 0; i < handles.Length; i++)
             {
-                bool isDynamic = (physObj.Mass != 0.0f && physObj.Interactable);
-                if (isDynamic)
-                    motionType = MotionType.MOTION_DYNAMIC;
+                if (handles[i] < 0)
+                    failed = true;
+                else if (pendingObjects[i] == null)
+                    HavokDllBridge.remove_rigid_body(handles[i]);
                 else
-                    motionType = MotionType.MOTION_FIXED;
+                {
+                    RegisterBody(pendingObjects[i], handles[i], pendingScales[i]);
+                    AddContactListener(pendingObjects[i], handles[i]);
+                }
             }
 
+            pendingObjects.Clear();
+            pendingScales.Clear();
+
+            if (failed)
+                throw new GoblinException("Failed to add a rigid body to Havok physics");
+        }
+
+        public void AddPhysicsObject(IPhysicsObject physObj)
+        {
+            if (objectIDs.ContainsKey(physObj) || (batching && pendingObjects.Contains(physObj)))
+                return;
+
+            physObj.PhysicsWorldTransform = physObj.CompoundInitialWorldTransform;
+
+            HavokPhysics.MotionType motionType;
+            HavokPhysics.CollidableQualityType qualityType;
+            float friction, restitution, maxLinearVelocity, maxAngularVelocity;
+            float allowedPenetrationDepth, gravityFactor;
+            int collisionFilterInfo;
+            GetBodyProperties(physObj, out motionType, out qualityType, out friction, out restitution,
+                out maxLinearVelocity, out maxAngularVelocity, out allowedPenetrationDepth, out gravityFactor,
+                out collisionFilterInfo);
+
             Quaternion rotation;
             Vector3 trans;
             Vector3 scale;
@@ -459,276 +893,1199 @@ namespace GoblinXNA.Physics.Havok
 
             IntPtr shape = GetCollisionShape(physObj, scale);
 
+            if (batching)
+            {
+                commandBuffer.CreateBody(shape, physObj.Mass, motionType, qualityType, trans, rotation,
+                    physObj.InitialLinearVelocity, physObj.LinearDamping, maxLinearVelocity,
+                    physObj.InitialAngularVelocity, physObj.AngularDamping.X, maxAngularVelocity, friction,
+                    restitution, allowedPenetrationDepth, physObj.NeverDeactivate, gravityFactor,
+                    collisionFilterInfo);
+
+                pendingObjects.Add(physObj);
+                pendingScales.Add(scale);
+                return;
+            }
+
             float[] pos = Vector3Helper.ToFloats(ref trans);
             float[] rot = { rotation.X, rotation.Y, rotation.Z, rotation.W };
 
-            IntPtr body = HavokDllBridge.add_rigid_body(shape, physObj.Mass, motionType, qualityType,
+            int body = HavokDllBridge.add_rigid_body(shape, physObj.Mass, motionType, qualityType,
                 pos, rot, Vector3Helper.ToFloats(physObj.InitialLinearVelocity), physObj.LinearDamping,
                 maxLinearVelocity, Vector3Helper.ToFloats(physObj.InitialAngularVelocity), 
                 physObj.AngularDamping.X, maxAngularVelocity, friction, restitution, 
-                allowedPenetrationDepth, physObj.NeverDeactivate, gravityFactor);
+                allowedPenetrationDepth, physObj.NeverDeactivate, gravityFactor, collisionFilterInfo);
 
-            objectIDs.Add(physObj, body);
-            reverseIDs.Add(body, physObj);
-            scaleTable.Add(body, scale);
+            if (body < 0)
+                throw new GoblinException("Failed to add a rigid body to Havok physics");
 
-            if ((physObj is HavokObject))
-            {
-                if (((HavokObject)physObj).ContactCallback != null ||
-                    ((HavokObject)physObj).CollisionStartCallback != null ||
-                    ((HavokObject)physObj).CollisionEndCallback != null)
-                    HavokDllBridge.add_contact_listener(body, ((HavokObject)physObj).ContactCallback,
-                        ((HavokObject)physObj).CollisionStartCallback,
-                        ((HavokObject)physObj).CollisionEndCallback);
-            }
+            RegisterBody(physObj, body, scale);
+            AddContactListener(physObj, body);
         }
 
-        public BoundingBox GetAxisAlignedBoundingBox(IPhysicsObject physObj)
+        /// <summary>
+        /// Creates a pool of bodies with the shape and properties of a template physics object.
+        /// The bodies are created up front and parked outside the simulation, so spawning one
+        /// with SpawnFromPool does not allocate anything.
+        /// </summary>
+        /// <param name="template">The physics object whose shape, scale and properties are used</param>
+        /// <param name="size">The number of bodies in the pool</param>
+        /// <returns>The id of the pool</returns>
+        public int CreateBodyPool(IPhysicsObject template, int size)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return new BoundingBox();
+            HavokPhysics.MotionType motionType;
+            HavokPhysics.CollidableQualityType qualityType;
+            float friction, restitution, maxLinearVelocity, maxAngularVelocity;
+            float allowedPenetrationDepth, gravityFactor;
+            int collisionFilterInfo;
+            GetBodyProperties(template, out motionType, out qualityType, out friction, out restitution,
+                out maxLinearVelocity, out maxAngularVelocity, out allowedPenetrationDepth, out gravityFactor,
+                out collisionFilterInfo);
 
-            float[] min = new float[3];
-            float[] max = new float[3];
-            HavokDllBridge.get_AABB(objectIDs[physObj], min, max);
-            Vector3Helper.FromFloats(min, out tmpVec1);
-            Vector3Helper.FromFloats(max, out tmpVec2);
+            Quaternion rotation;
+            Vector3 trans;
+            Vector3 scale;
+            template.CompoundInitialWorldTransform.Decompose(out scale, out rotation, out trans);
+
+            IntPtr shape = GetCollisionShape(template, scale);
+
+            int pool = HavokDllBridge.create_body_pool(shape, size, template.Mass, motionType, qualityType,
+                template.LinearDamping, maxLinearVelocity, template.AngularDamping.X, maxAngularVelocity,
+                friction, restitution, allowedPenetrationDepth, template.NeverDeactivate, gravityFactor,
+                collisionFilterInfo);
+
+            if (pool < 0)
+                throw new GoblinException("Failed to create a body pool in Havok physics");
+
+            poolScales[pool] = scale;
+            return pool;
+        }
+
+        /// <summary>
+        /// Puts a parked body of a pool into the simulation for a physics object, at the object's
+        /// initial transform and velocities. Removing the object with RemovePhysicsObject parks
+        /// the body again. Contact callbacks of the object are not registered.
+        /// </summary>
+        /// <param name="pool">The id returned by CreateBodyPool</param>
+        /// <param name="physObj"></param>
+        /// <returns>False if every body of the pool is in use</returns>
+        public bool SpawnFromPool(int pool, IPhysicsObject physObj)
+        {
+            if (objectIDs.ContainsKey(physObj) || !poolScales.ContainsKey(pool))
+                return false;
+
+            physObj.PhysicsWorldTransform = physObj.CompoundInitialWorldTransform;
+
+            Quaternion rotation;
+            Vector3 trans;
+            Vector3 scale;
+            physObj.CompoundInitialWorldTransform.Decompose(out scale, out rotation, out trans);
+
+            float[] pos = Vector3Helper.ToFloats(ref trans);
+            float[] rot = { rotation.X, rotation.Y, rotation.Z, rotation.W };
+
+            int body = HavokDllBridge.spawn_pooled_body(pool, pos, rot, 
+                Vector3Helper.ToFloats(physObj.InitialLinearVelocity),
+                Vector3Helper.ToFloats(physObj.InitialAngularVelocity));
+            if (body < 0)
+                return false;
+
+            RegisterBody(physObj, body, poolScales[pool]);
+            pooledObjects.Add(physObj, pool);
+
+            return true;
+        }
+
+        /// <summary>
+        /// Gets the number of parked bodies of a pool that can still be spawned.
+        /// </summary>
+        /// <param name="pool"></param>
+        /// <returns></returns>
+        public int GetPoolFreeCount(int pool)
+        {
+            return HavokDllBridge.get_pool_free_count(pool);
+        }
+
+        /// <summary>
+        /// Removes the objects spawned from a pool and frees all of its bodies.
+        /// </summary>
+        /// <param name="pool"></param>
+        public void DestroyBodyPool(int pool)
+        {
+            if (!poolScales.ContainsKey(pool))
+                return;
+
+            List<IPhysicsObject> spawned = new List<IPhysicsObject>();
+            foreach (KeyValuePair<IPhysicsObject, int> pair in pooledObjects)
+                if (pair.Value == pool)
+                    spawned.Add(pair.Key);
+
+            foreach (IPhysicsObject physObj in spawned)
+            {
+                slotObjects[objectIDs[physObj] & BODY_INDEX_MASK] = null;
+                objectIDs.Remove(physObj);
+                pooledObjects.Remove(physObj);
+            }
+
+            HavokDllBridge.destroy_body_pool(pool);
+            poolScales.Remove(pool);
+        }
+
+        public BoundingBox GetAxisAlignedBoundingBox(IPhysicsObject physObj)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return new BoundingBox();
+
+            float[] min = new float[3];
+            float[] max = new float[3];
+            HavokDllBridge.get_AABB(objectIDs[physObj], min, max);
+            Vector3Helper.FromFloats(min, out tmpVec1);
+            Vector3Helper.FromFloats(max, out tmpVec2);
+
+            return new BoundingBox(tmpVec1, tmpVec2);
+        }
+
+        public List<List<Vector3>> GetCollisionMesh(IPhysicsObject physObj)
+        {
+            throw new GoblinException("Havok physics does not return collision mesh information");
+        }
+
+        /// <summary>
+        /// Not implemented yet.
+        /// </summary>
+        /// <param name="physObj"></param>
+        /// <param name="newTransform"></param>
+        public void ModifyPhysicsObject(IPhysicsObject physObj, Matrix newTransform)
+        {
+            
+        }
+
+        public void RemovePhysicsObject(IPhysicsObject physObj)
+        {
+            if (batching)
+            {
+                // The body of an object added in this batch is removed once it is created
+                int pending = pendingObjects.IndexOf(physObj);
+                if (pending >= 0)
+                    pendingObjects[pending] = null;
+            }
+
+            if (objectIDs.ContainsKey(physObj))
+            {
+                int body = objectIDs[physObj];
+                if (batching)
+                    commandBuffer.RemoveBody(body);
+                else
+                    HavokDllBridge.remove_rigid_body(body);
+
+                slotObjects[body & BODY_INDEX_MASK] = null;
+                objectIDs.Remove(physObj);
+                pooledObjects.Remove(physObj);
+            }
+
+            ReleaseCastShape(physObj);
+        }
+
+        public virtual void Update(float elapsedTime)
+        {
+            if (pauseSimulation)
+                return;
+
+            elapsedTime *= simulationSpeed;
+
+            float timeStep = elapsedTime;
+            int updateTime = 1;
+            if (numSubSteps > 1)
+            {
+                updateTime = Math.Max((int)(Math.Round(elapsedTime / simulationTimeStep)), 1);
+                updateTime = Math.Min(numSubSteps, updateTime);
+                timeStep = simulationTimeStep;
+            }
+
+            if (asynchronousUpdate)
+            {
+                // Publish the step started in the previous frame, and let the next one run in the
+                // background while the scene is drawn
+                HavokDllBridge.end_step();
+                UpdateTransforms();
+                HavokDllBridge.begin_step(timeStep, updateTime);
+            }
+            else if (numSubSteps > 1)
+            {
+                // The native side keeps the time that does not make up a whole step for the
+                // next frame
+                HavokDllBridge.advance(elapsedTime, simulationTimeStep, numSubSteps, 
+                    interpolateTransforms);
+                UpdateTransforms();
+            }
+            else
+            {
+                HavokDllBridge.update(timeStep);
+                UpdateTransforms();
+            }
+        }
+
+        public void Dispose()
+        {
+            foreach (IntPtr shape in castShapes.Values)
+                HavokDllBridge.release_shape(shape);
+            castShapes.Clear();
+            castShapeScales.Clear();
+
+            HavokDllBridge.dispose();
+            HavokDllBridge.close_shape_cache();
+            commandBuffer.Clear();
+            batching = false;
+            pendingObjects.Clear();
+            pendingScales.Clear();
+            poolScales.Clear();
+            pooledObjects.Clear();
+            objectIDs.Clear();
+            Array.Clear(slotObjects, 0, slotObjects.Length);
+            sleptObjects.Clear();
+        }
+
+        #endregion
+
+        #region Protected Methods
+
+        /// <summary>
+        /// Associates a physics object with the handle of the body created for it. The scale is
+        /// kept natively and applied to the transforms of the body.
+        /// </summary>
+        /// <param name="physObj"></param>
+        /// <param name="body"></param>
+        /// <param name="scale"></param>
+        protected void RegisterBody(IPhysicsObject physObj, int body, Vector3 scale)
+        {
+            int index = body & BODY_INDEX_MASK;
+            if (index >= slotObjects.Length)
+            {
+                int size = Math.Max(slotObjects.Length * 2, index + 1);
+                Array.Resize(ref slotObjects, size);
+            }
+
+            objectIDs.Add(physObj, body);
+            slotObjects[index] = physObj;
+
+            if (scale != Vector3.One)
+                HavokDllBridge.set_body_scale(body, Vector3Helper.ToFloats(ref scale));
+        }
+
+        /// <summary>
+        /// Gets the Havok specific body properties of a physics object, or the defaults if it is
+        /// not a HavokObject.
+        /// </summary>
+        protected void GetBodyProperties(IPhysicsObject physObj, out MotionType motionType, 
+            out CollidableQualityType qualityType, out float friction, out float restitution,
+            out float maxLinearVelocity, out float maxAngularVelocity, out float allowedPenetrationDepth,
+            out float gravityFactor, out int collisionFilterInfo)
+        {
+            motionType = MotionType.MOTION_INVALID;
+            qualityType = CollidableQualityType.COLLIDABLE_QUALITY_INVALID;
+            friction = -1;
+            restitution = -1;
+            maxLinearVelocity = -1;
+            maxAngularVelocity = -1;
+            allowedPenetrationDepth = -1;
+            gravityFactor = 1;
+            collisionFilterInfo = 0;
+
+            if ((physObj is HavokObject))
+            {
+                HavokObject havokObj = (HavokObject)physObj;
+                motionType = havokObj.MotionType;
+                qualityType = havokObj.QualityType;
+                friction = havokObj.Friction;
+                restitution = havokObj.Restitution;
+                maxLinearVelocity = havokObj.MaxLinearVelocity;
+                maxAngularVelocity = havokObj.MaxAngularVelocity;
+                allowedPenetrationDepth = havokObj.AllowedPenetrationDepth;
+                gravityFactor = havokObj.GravityFactor;
+                collisionFilterInfo = havokObj.CollisionFilterInfo;
+            }
+            else
+            {
+                bool isDynamic = (physObj.Mass != 0.0f && physObj.Interactable);
+                if (isDynamic)
+                    motionType = MotionType.MOTION_DYNAMIC;
+                else
+                    motionType = MotionType.MOTION_FIXED;
+            }
+        }
+
+        /// <summary>
+        /// Registers the contact callbacks of a physics object with the body created for it.
+        /// </summary>
+        /// <param name="physObj"></param>
+        /// <param name="body"></param>
+        protected void AddContactListener(IPhysicsObject physObj, int body)
+        {
+            if ((physObj is HavokObject))
+            {
+                HavokObject havokObj = (HavokObject)physObj;
+                if (havokObj.QueueContactEvents)
+                    HavokDllBridge.add_contact_event_listener(body, havokObj.MinContactSpeed,
+                        havokObj.ContactCooldown, havokObj.OneContactPerStep);
+                else if (havokObj.ContactCallback != null ||
+                    havokObj.CollisionStartCallback != null ||
+                    havokObj.CollisionEndCallback != null)
+                    HavokDllBridge.add_contact_listener(body, havokObj.ContactCallback,
+                        havokObj.CollisionStartCallback, havokObj.CollisionEndCallback,
+                        havokObj.MinContactSpeed, havokObj.ContactCooldown, havokObj.OneContactPerStep);
+            }
+        }
+
+        /// <summary>
+        /// Throws if the handles or any of the non-null arrays of a batched call has fewer than
+        /// count elements, which the native side would otherwise read or write past.
+        /// </summary>
+        protected void CheckBatch(int[] handles, int count, Vector3[] vectors1, Quaternion[] rotations,
+            Vector3[] vectors2, Vector3[] vectors3)
+        {
+            if (handles == null || count < 0 || handles.Length < count ||
+                (vectors1 != null && vectors1.Length < count) || (rotations != null && rotations.Length < count) ||
+                (vectors2 != null && vectors2.Length < count) || (vectors3 != null && vectors3.Length < count))
+                throw new GoblinException("The batch arrays must have at least count elements");
+        }
+
+        /// <summary>
+        /// Copies the transforms of the bodies updated in the last published step to their
+        /// physics objects, and collects the ones that went to sleep. The native side has
+        /// already applied the scales of the objects.
+        /// </summary>
+        protected void UpdateTransforms()
+        {
+            // The transform buffer is owned by the native wrapper and stays valid until the
+            // next step, so we read the poses directly without allocating or copying
+            IntPtr bodyPtr, transformPtr;
+            int totalSize = 0;
+            HavokDllBridge.get_transform_buffer(out bodyPtr, out transformPtr, out totalSize);
+
+            unsafe
+            {
+                int* bodyAddr = (int*)bodyPtr;
+                float* matAddr = (float*)transformPtr;
+                IPhysicsObject physObj = null;
+                for (int i = 0; i < totalSize; i++, matAddr += 16)
+                {
+                    physObj = slotObjects[bodyAddr[i]];
+                    if (physObj != null)
+                    {
+                        FloatsToMatrix(matAddr, out tmpMat1);
+                        physObj.PhysicsWorldTransform = tmpMat1;
+                    }
+                }
+            }
+
+            // The bodies that went to sleep are also in the transform buffer
+            HavokDllBridge.get_sleeping_bodies(out bodyPtr, out totalSize);
+
+            sleptObjects.Clear();
+            unsafe
+            {
+                int* bodyAddr = (int*)bodyPtr;
+                for (int i = 0; i < totalSize; i++)
+                {
+                    IPhysicsObject physObj = slotObjects[bodyAddr[i]];
+                    if (physObj != null)
+                        sleptObjects.Add(physObj);
+                }
+            }
+        }
+
+        #endregion
+
+        #region Additional Supported Features
+
+        public void ApplyKeyframe(IPhysicsObject physObj, Vector3 newPos, Quaternion newRot, float timeStep)
+        {
+            ApplyHardKeyFrame(physObj, newPos, newRot, timeStep);
+        }
+
+        public void ApplyHardKeyFrame(IPhysicsObject physObj, Vector3 newPos, Quaternion newRot, float timeStep)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return;
+
+            float[] pos = Vector3Helper.ToFloats(ref newPos);
+            float[] rot = { newRot.X, newRot.Y, newRot.Z, newRot.W };
+
+            if (batching)
+                commandBuffer.ApplyHardKeyframe(objectIDs[physObj], newPos, newRot, timeStep);
+            else
+                HavokDllBridge.apply_hard_keyframe(objectIDs[physObj], pos, rot, timeStep);
+        }
+
+        public void ApplySoftKeyFrame(IPhysicsObject physObj, Vector3 newPos, Quaternion newRot, 
+            Vector3 angularPositionFactor, Vector3 angularVelocityFactor, Vector3 linearPositionFactor,
+		    Vector3 linearVelocityFactor, float maxAngularAcceleration, float maxLinearAcceleration, 
+            float maxAllowedDistance, float timeStep)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return;
+
+            float[] pos = Vector3Helper.ToFloats(ref newPos);
+            float[] rot = { newRot.X, newRot.Y, newRot.Z, newRot.W };
+            float[] angularPosFac = Vector3Helper.ToFloats(ref angularPositionFactor);
+            float[] angularVelFac = Vector3Helper.ToFloats(ref angularVelocityFactor);
+            float[] linearPosFac = Vector3Helper.ToFloats(ref linearPositionFactor);
+            float[] linearVelFac = Vector3Helper.ToFloats(ref linearVelocityFactor);
+
+            HavokDllBridge.apply_soft_keyframe(objectIDs[physObj], pos, rot, angularPosFac,
+                angularVelFac, linearPosFac, linearVelFac, maxAngularAcceleration,
+                maxLinearAcceleration, maxAllowedDistance, timeStep);
+        }
+
+        public void StopKeyframe(IPhysicsObject physObj)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return;
+
+            Vector3 scale, trans;
+            Quaternion quat;
+            physObj.PhysicsWorldTransform.Decompose(out scale, out quat, out trans);
+
+            float[] pos = Vector3Helper.ToFloats(ref trans);
+            float[] rot = { quat.X, quat.Y, quat.Z, quat.W };
+
+            HavokDllBridge.apply_hard_keyframe(objectIDs[physObj], pos, rot, 0.016f);
+        }
+
+        public void AddForce(IPhysicsObject physObj, float timeStep, Vector3 force)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return;
+
+            if (batching)
+                commandBuffer.AddForce(objectIDs[physObj], timeStep, force);
+            else
+                HavokDllBridge.add_force(objectIDs[physObj], timeStep, Vector3Helper.ToFloats(force));
+        }
+
+        public void AddTorque(IPhysicsObject physObj, float timeStep, Vector3 torque)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return;
+
+            if (batching)
+                commandBuffer.AddTorque(objectIDs[physObj], timeStep, torque);
+            else
+                HavokDllBridge.add_torque(objectIDs[physObj], timeStep, Vector3Helper.ToFloats(torque));
+        }
+
+        public void SetLinearVelocity(IPhysicsObject physObj, Vector3 velocity)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return;
+
+            if (batching)
+                commandBuffer.SetLinearVelocity(objectIDs[physObj], velocity);
+            else
+                HavokDllBridge.set_linear_velocity(objectIDs[physObj], Vector3Helper.ToFloats(ref velocity));
+        }
+
+        public Vector3 GetLinearVelocity(IPhysicsObject physObj)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return Vector3.Zero;
+
+            float[] velocity = new float[3];
+            HavokDllBridge.get_linear_velocity(objectIDs[physObj], velocity);
+            return new Vector3(velocity[0], velocity[1], velocity[2]);
+        }
+
+        public void SetAngularVelocity(IPhysicsObject physObj, Vector3 velocity)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return;
+
+            if (batching)
+                commandBuffer.SetAngularVelocity(objectIDs[physObj], velocity);
+            else
+                HavokDllBridge.set_angular_velocity(objectIDs[physObj], Vector3Helper.ToFloats(velocity));
+        }
+
+        public Vector3 GetAngularVelocity(IPhysicsObject physObj)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return Vector3.Zero;
+
+            float[] velocity = new float[3];
+            HavokDllBridge.get_angular_velocity(objectIDs[physObj], velocity);
+            return new Vector3(velocity[0], velocity[1], velocity[2]);
+        }
+
+        public Matrix GetTransform(IPhysicsObject physObj)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return Matrix.Identity;
+
+            float[] transform = new float[16];
+            HavokDllBridge.get_body_transform(objectIDs[physObj], transform);
+            return MatrixHelper.FloatsToMatrix(transform);
+        }
+
+        public Vector3 GetPosition(IPhysicsObject physObj)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return Vector3.Zero;
+
+            float[] position = new float[3];
+            HavokDllBridge.get_body_position(objectIDs[physObj], position);
+            return Vector3Helper.FromFloats(position);
+        }
+
+        public Quaternion GetRotation(IPhysicsObject physObj)
+        {
+            if (!objectIDs.ContainsKey(physObj))
+                return Quaternion.Identity;
+
+            float[] rotation = new float[4];
+            HavokDllBridge.get_body_rotation(objectIDs[physObj], rotation);
+            return new Quaternion(rotation[0], rotation[1], rotation[2], rotation[3]);
+        }
+
+        /// <summary>
+        /// Gets the physics object associated with the body pointer passed to a native callback.
+        /// </summary>
+        /// <param name="body"></param>
+        /// <returns></returns>
+        public IPhysicsObject GetPhysicsObject(IntPtr body)
+        {
+            return GetPhysicsObject(HavokDllBridge.get_body_handle(body));
+        }
+
+        /// <summary>
+        /// Gets the physics object associated with a body handle returned by the wrapper.
+        /// </summary>
+        /// <param name="handle"></param>
+        /// <returns></returns>
+        public IPhysicsObject GetPhysicsObject(int handle)
+        {
+            if (handle < 0)
+                return null;
+
+            int index = handle & BODY_INDEX_MASK;
+            if (index >= slotObjects.Length || slotObjects[index] == null ||
+                objectIDs[slotObjects[index]] != handle)
+                return null;
+
+            return slotObjects[index];
+        }
+
+        /// <summary>
+        /// Gets the body handle of a physics object, for the batched calls that take handles.
+        /// </summary>
+        /// <param name="physObj"></param>
+        /// <returns>The handle, or -1 if the object was not added</returns>
+        public int GetBodyHandle(IPhysicsObject physObj)
+        {
+            int handle;
+            if (!objectIDs.TryGetValue(physObj, out handle))
+                return -1;
+
+            return handle;
+        }
+
+        /// <summary>
+        /// Gets the body handles of a list of physics objects. Handles stay valid until their
+        /// objects are removed, so they can be looked up once and reused every frame.
+        /// </summary>
+        /// <param name="physObjs"></param>
+        /// <param name="handles">Receives the handle of each object, or -1 for objects that
+        /// were not added</param>
+        public void GetBodyHandles(IList<IPhysicsObject> physObjs, int[] handles)
+        {
+            if (handles.Length < physObjs.Count)
+                throw new GoblinException("handles must have an element for each physics object");
+
+            for (int i = 0; i < physObjs.Count; i++)
+                handles[i] = GetBodyHandle(physObjs[i]);
+        }
+
+        /// <summary>
+        /// Reads the state of a batch of bodies in a single call, which is much cheaper than
+        /// reading them one by one. Any of the output arrays may be null to skip it.
+        /// </summary>
+        /// <param name="handles">The body handles (see GetBodyHandles)</param>
+        /// <param name="count">The number of handles to read</param>
+        /// <param name="positions">Receives the position of each body, or null</param>
+        /// <param name="rotations">Receives the rotation of each body, or null</param>
+        /// <param name="linearVelocities">Receives the linear velocity of each body, or null</param>
+        /// <param name="angularVelocities">Receives the angular velocity of each body, or null</param>
+        /// <returns>The number of handles that refer to a body. The entries of the others are
+        /// set to zero.</returns>
+        public int GetBodyStates(int[] handles, int count, Vector3[] positions, Quaternion[] rotations,
+            Vector3[] linearVelocities, Vector3[] angularVelocities)
+        {
+            CheckBatch(handles, count, positions, rotations, linearVelocities, angularVelocities);
+
+            return HavokDllBridge.get_body_states(count, handles, positions, rotations, linearVelocities,
+                angularVelocities);
+        }
+
+        /// <summary>
+        /// Gets the axis aligned bounding boxes of a batch of bodies in a single call.
+        /// </summary>
+        /// <param name="handles">The body handles (see GetBodyHandles)</param>
+        /// <param name="count">The number of handles to read</param>
+        /// <param name="mins">Receives the minimum corner of each box</param>
+        /// <param name="maxs">Receives the maximum corner of each box</param>
+        /// <returns>The number of handles that refer to a body. The boxes of the others are
+        /// set to zero.</returns>
+        public int GetAxisAlignedBoundingBoxes(int[] handles, int count, Vector3[] mins, Vector3[] maxs)
+        {
+            if (mins == null || maxs == null)
+                throw new GoblinException("mins and maxs must not be null");
+
+            CheckBatch(handles, count, mins, null, maxs, null);
+
+            return HavokDllBridge.get_body_aabbs(count, handles, mins, maxs);
+        }
+
+        /// <summary>
+        /// Sets the linear velocities of a batch of bodies in a single call.
+        /// </summary>
+        /// <param name="handles">The body handles (see GetBodyHandles)</param>
+        /// <param name="count">The number of handles to set</param>
+        /// <param name="velocities">The velocity of each body</param>
+        public void SetLinearVelocities(int[] handles, int count, Vector3[] velocities)
+        {
+            if (velocities == null)
+                throw new GoblinException("velocities must not be null");
+
+            CheckBatch(handles, count, velocities, null, null, null);
+
+            HavokDllBridge.set_linear_velocities(count, handles, velocities);
+        }
+
+        /// <summary>
+        /// Sets the angular velocities of a batch of bodies in a single call.
+        /// </summary>
+        /// <param name="handles">The body handles (see GetBodyHandles)</param>
+        /// <param name="count">The number of handles to set</param>
+        /// <param name="velocities">The velocity of each body</param>
+        public void SetAngularVelocities(int[] handles, int count, Vector3[] velocities)
+        {
+            if (velocities == null)
+                throw new GoblinException("velocities must not be null");
+
+            CheckBatch(handles, count, velocities, null, null, null);
+
+            HavokDllBridge.set_angular_velocities(count, handles, velocities);
+        }
+
+        /// <summary>
+        /// Moves a batch of keyframed bodies to new poses within a time step in a single call,
+        /// like ApplyHardKeyFrame does for one.
+        /// </summary>
+        /// <param name="handles">The body handles (see GetBodyHandles)</param>
+        /// <param name="count">The number of handles to move</param>
+        /// <param name="positions">The new position of each body</param>
+        /// <param name="rotations">The new rotation of each body</param>
+        /// <param name="timeStep"></param>
+        public void ApplyHardKeyFrames(int[] handles, int count, Vector3[] positions, Quaternion[] rotations,
+            float timeStep)
+        {
+            if (positions == null || rotations == null)
+                throw new GoblinException("positions and rotations must not be null");
 
-            return new BoundingBox(tmpVec1, tmpVec2);
+            CheckBatch(handles, count, positions, rotations, null, null);
+
+            HavokDllBridge.apply_hard_keyframes(count, handles, positions, rotations, timeStep);
         }
 
-        public List<List<Vector3>> GetCollisionMesh(IPhysicsObject physObj)
+        /// <summary>
+        /// Copies the contact events recorded since the last call for the physics objects that
+        /// have HavokObject.QueueContactEvents set. Events that do not fit into the array stay
+        /// queued for the next call.
+        /// </summary>
+        /// <param name="events">Receives the contact events</param>
+        /// <returns>The number of events copied</returns>
+        public int GetContactEvents(ContactEvent[] events)
         {
-            throw new GoblinException("Havok physics does not return collision mesh information");
+            return HavokDllBridge.get_contact_events(events, events.Length);
         }
 
         /// <summary>
-        /// Not implemented yet.
+        /// Gets the number of contact events dropped since the last call because the queue of a
+        /// stepping thread was full. Drain the events every frame to avoid this.
         /// </summary>
-        /// <param name="physObj"></param>
-        /// <param name="newTransform"></param>
-        public void ModifyPhysicsObject(IPhysicsObject physObj, Matrix newTransform)
+        /// <returns></returns>
+        public int GetDroppedContactEvents()
         {
-            
+            return HavokDllBridge.get_dropped_contact_events();
         }
 
-        public void RemovePhysicsObject(IPhysicsObject physObj)
+        /// <summary>
+        /// Captures the transforms, velocities and activation state of all non-fixed bodies.
+        /// </summary>
+        /// <param name="buffer">Receives the snapshot if it is large enough</param>
+        /// <returns>The size of the snapshot. If it is larger than the buffer, nothing was written
+        /// and the call needs to be repeated with a larger buffer.</returns>
+        public int SaveWorldState(byte[] buffer)
         {
-            if (objectIDs.ContainsKey(physObj))
-            {
-                HavokDllBridge.remove_rigid_body(objectIDs[physObj]);
-
-                reverseIDs.Remove(objectIDs[physObj]);
-                scaleTable.Remove(objectIDs[physObj]);
-                objectIDs.Remove(physObj);
-            }
+            return HavokDllBridge.save_world_state(buffer, buffer.Length, null, 0);
         }
 
-        public virtual void Update(float elapsedTime)
+        /// <summary>
+        /// Captures the state of the bodies that changed since a full snapshot taken with
+        /// SaveWorldState(byte[]).
+        /// </summary>
+        /// <param name="buffer">Receives the delta snapshot if it is large enough</param>
+        /// <param name="baseState">The full snapshot the delta is taken against</param>
+        /// <param name="baseSize">The size of the full snapshot</param>
+        /// <returns>The size of the delta snapshot. If it is larger than the buffer, nothing was
+        /// written and the call needs to be repeated with a larger buffer.</returns>
+        public int SaveWorldState(byte[] buffer, byte[] baseState, int baseSize)
         {
-            if (pauseSimulation)
-                return;
-
-            elapsedTime *= simulationSpeed;
-
-            if (numSubSteps > 1)
-            {
-                int updateTime = Math.Max((int)(Math.Round(elapsedTime / simulationTimeStep)), 1);
-                updateTime = Math.Min(numSubSteps, updateTime);
-                for (int i = 0; i < updateTime; i++)
-                    HavokDllBridge.update(simulationTimeStep);
-            }
-            else
-                HavokDllBridge.update(elapsedTime);
-
-            IntPtr bodyPtr = Marshal.AllocHGlobal(objectIDs.Count * sizeof(int));
-            IntPtr transformPtr = Marshal.AllocHGlobal(objectIDs.Count * sizeof(float) * 16);
-
-            int totalSize = 0;
-            HavokDllBridge.get_updated_transforms(bodyPtr, transformPtr, ref totalSize);
+            int size = HavokDllBridge.save_world_state(buffer, buffer.Length, baseState, baseSize);
+            if (size < 0)
+                throw new GoblinException("The base state is not a full Havok world snapshot");
 
-            unsafe
-            {
-                int* bodyAddr = (int*)bodyPtr;
-                IntPtr tmpPtr = transformPtr;
-                float[] mat = new float[16];
-                IntPtr body = IntPtr.Zero;
-                for (int i = 0; i < totalSize; i++)
-                {
-                    body = new IntPtr(*bodyAddr);
-                    if (reverseIDs.ContainsKey(body))
-                    {
-                        tmpVec1 = scaleTable[body];
+            return size;
+        }
 
-                        Matrix.CreateScale(ref tmpVec1, out tmpMat1);
+        /// <summary>
+        /// Restores a full snapshot taken with SaveWorldState and updates the transforms of the
+        /// restored physics objects. Bodies created after the snapshot are left as they are.
+        /// </summary>
+        /// <param name="state">The snapshot</param>
+        /// <param name="size">The size of the snapshot</param>
+        public void LoadWorldState(byte[] state, int size)
+        {
+            LoadWorldState(state, size, null, 0);
+        }
 
-                        Marshal.Copy(tmpPtr, mat, 0, mat.Length);
-                        MatrixHelper.FloatsToMatrix(mat, out tmpMat2);
+        /// <summary>
+        /// Restores a snapshot taken with SaveWorldState and updates the transforms of the
+        /// restored physics objects.
+        /// </summary>
+        /// <param name="state">The snapshot</param>
+        /// <param name="size">The size of the snapshot</param>
+        /// <param name="baseState">The full snapshot a delta snapshot was taken against, or null</param>
+        /// <param name="baseSize">The size of the full snapshot</param>
+        public void LoadWorldState(byte[] state, int size, byte[] baseState, int baseSize)
+        {
+            if (!HavokDllBridge.load_world_state(state, size, baseState, baseSize))
+                throw new GoblinException("Invalid Havok world snapshot");
 
-                        Matrix.Multiply(ref tmpMat1, ref tmpMat2, out tmpMat1);
-                        reverseIDs[body].PhysicsWorldTransform = tmpMat1;
-                    }
+            UpdateTransforms();
+        }
 
-                    tmpPtr = new IntPtr(tmpPtr.ToInt32() + sizeof(float) * 16);
-                    bodyAddr++;
-                }
-            }
+        /// <summary>
+        /// Lets the physics objects of quality COLLIDABLE_QUALITY_USER fall back to discrete
+        /// collisions once a step has more TOI events than the budget, until the given number
+        /// of steps in a row stayed within it. Until then they collide like bullets.
+        /// </summary>
+        /// <param name="maxToisPerStep">The TOI budget of a step, or 0 to turn the fallback off</param>
+        /// <param name="recoverySteps">The number of steps within the budget before the
+        /// continuous collisions are restored</param>
+        public void SetToiBudget(int maxToisPerStep, int recoverySteps)
+        {
+            HavokDllBridge.set_toi_budget(maxToisPerStep, recoverySteps);
+        }
 
-            Marshal.FreeHGlobal(bodyPtr);
-            Marshal.FreeHGlobal(transformPtr);
+        /// <summary>
+        /// Sets how the collisions between physics objects of two collidable qualities are
+        /// handled. Pairs that are already colliding keep their level until they separate.
+        /// </summary>
+        /// <param name="quality1"></param>
+        /// <param name="quality2"></param>
+        /// <param name="level"></param>
+        public void SetCollisionQuality(CollidableQualityType quality1, CollidableQualityType quality2,
+            CollisionQualityLevel level)
+        {
+            HavokDllBridge.set_collision_quality(quality1, quality2, level);
         }
 
-        public void Dispose()
+        /// <summary>
+        /// Copies the number of TOI events of each step since the last call, oldest first.
+        /// </summary>
+        /// <param name="counts">Receives the TOI counts</param>
+        /// <returns>The number of steps copied</returns>
+        public int GetToiCounts(int[] counts)
         {
-            HavokDllBridge.dispose();
-            objectIDs.Clear();
-            reverseIDs.Clear();
-            scaleTable.Clear();
+            return HavokDllBridge.get_toi_counts(counts, counts.Length);
         }
 
-        #endregion
+        /// <summary>
+        /// Gets whether the physics objects of quality COLLIDABLE_QUALITY_USER currently collide
+        /// discretely because the world went over its TOI budget.
+        /// </summary>
+        public bool IsToiFallbackActive
+        {
+            get { return HavokDllBridge.is_toi_fallback_active(); }
+        }
 
-        #region Additional Supported Features
+        /// <summary>
+        /// Replaces the collision filter of the world with a group filter. Whether two physics
+        /// objects collide then depends on the layer, system group and subsystem packed into
+        /// their HavokObject.CollisionFilterInfo. Every layer collides with every other one until
+        /// changed with SetLayerCollision or SetCollisionLayerMasks.
+        /// </summary>
+        /// <param name="standardLayers">Whether to set up the standard layers of Havok's
+        /// hkpGroupFilterSetup instead</param>
+        public void InstallGroupFilter(bool standardLayers)
+        {
+            HavokDllBridge.install_group_filter(standardLayers);
+        }
 
-        public void ApplyKeyframe(IPhysicsObject physObj, Vector3 newPos, Quaternion newRot, float timeStep)
+        /// <summary>
+        /// Enables or disables the collisions between two layers of the group filter. Every call
+        /// rechecks all the physics objects in the world, so use SetCollisionLayerMasks to change
+        /// several layers at once.
+        /// </summary>
+        /// <param name="layer1">A layer from 0 to 31</param>
+        /// <param name="layer2">A layer from 0 to 31</param>
+        /// <param name="enabled"></param>
+        public void SetLayerCollision(int layer1, int layer2, bool enabled)
         {
-            ApplyHardKeyFrame(physObj, newPos, newRot, timeStep);
+            HavokDllBridge.set_layer_collision(layer1, layer2, enabled);
         }
 
-        public void ApplyHardKeyFrame(IPhysicsObject physObj, Vector3 newPos, Quaternion newRot, float timeStep)
+        /// <summary>
+        /// Sets the whole layer collision matrix of the group filter. Bit j of masks[i] tells
+        /// whether layer i collides with layer j. Where masks[i] and masks[j] disagree, the
+        /// higher layer wins.
+        /// </summary>
+        /// <param name="masks">A mask of the layers each layer collides with, for up to 32 layers</param>
+        public void SetCollisionLayerMasks(int[] masks)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return;
+            HavokDllBridge.set_collision_layer_masks(masks, masks.Length);
+        }
 
-            float[] pos = Vector3Helper.ToFloats(ref newPos);
-            float[] rot = { newRot.X, newRot.Y, newRot.Z, newRot.W };
+        /// <summary>
+        /// Gets a new system group of the group filter. Physics objects in the same system group
+        /// do not collide with each other unless their subsystems allow it, which suits the parts
+        /// of a ragdoll or a vehicle.
+        /// </summary>
+        /// <returns>The system group, or 0 if no group filter is installed</returns>
+        public int GetNewSystemGroup()
+        {
+            return HavokDllBridge.get_new_system_group();
+        }
 
-            HavokDllBridge.apply_hard_keyframe(objectIDs[physObj], pos, rot, timeStep);
+        /// <summary>
+        /// Packs a layer, system group and subsystem into a collision filter info for the group
+        /// filter, the same way as hkpGroupFilter::calcFilterInfo.
+        /// </summary>
+        /// <param name="layer">The layer from 0 to 31</param>
+        /// <param name="systemGroup">The system group from GetNewSystemGroup, or 0 for none</param>
+        /// <param name="subSystemId">The id of the object within its system group, from 0 to 31</param>
+        /// <param name="subSystemDontCollideWith">The id of a subsystem not to collide with, or 0</param>
+        /// <returns>The collision filter info</returns>
+        public static int CalcFilterInfo(int layer, int systemGroup, int subSystemId,
+            int subSystemDontCollideWith)
+        {
+            return (systemGroup << 16) | (subSystemDontCollideWith << 10) | (subSystemId << 5) | layer;
         }
 
-        public void ApplySoftKeyFrame(IPhysicsObject physObj, Vector3 newPos, Quaternion newRot, 
-            Vector3 angularPositionFactor, Vector3 angularVelocityFactor, Vector3 linearPositionFactor,
-		    Vector3 linearVelocityFactor, float maxAngularAcceleration, float maxLinearAcceleration, 
-            float maxAllowedDistance, float timeStep)
+        /// <summary>
+        /// Moves the point the simulation LOD measures distances from, usually the camera or
+        /// the player. Call it every frame before Update.
+        /// </summary>
+        /// <param name="focus"></param>
+        public void SetLodFocus(Vector3 focus)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return;
+            HavokDllBridge.set_lod_focus(Vector3Helper.ToFloats(ref focus));
+        }
 
-            float[] pos = Vector3Helper.ToFloats(ref newPos);
-            float[] rot = { newRot.X, newRot.Y, newRot.Z, newRot.W };
-            float[] angularPosFac = Vector3Helper.ToFloats(ref angularPositionFactor);
-            float[] angularVelFac = Vector3Helper.ToFloats(ref angularVelocityFactor);
-            float[] linearPosFac = Vector3Helper.ToFloats(ref linearPositionFactor);
-            float[] linearVelFac = Vector3Helper.ToFloats(ref linearVelocityFactor);
+        /// <summary>
+        /// Sets the distance bands of the simulation LOD, which coarsens the simulation of the
+        /// physics objects far from the focus point. An island of touching objects is judged by
+        /// its object nearest to the focus, and goes by the farthest band it lies beyond. Objects
+        /// are restored once they come back into a nearer band.
+        /// </summary>
+        /// <param name="bands">The bands sorted by increasing distance, at most 8, or an empty
+        /// array to turn the LOD off</param>
+        public void SetLodBands(LodBand[] bands)
+        {
+            HavokDllBridge.set_lod_bands(bands, bands.Length);
+        }
 
-            HavokDllBridge.apply_soft_keyframe(objectIDs[physObj], pos, rot, angularPosFac,
-                angularVelFac, linearPosFac, linearVelFac, maxAngularAcceleration,
-                maxLinearAcceleration, maxAllowedDistance, timeStep);
+        /// <summary>
+        /// Counts the physics objects currently affected by the simulation LOD.
+        /// </summary>
+        /// <param name="deactivated"></param>
+        /// <param name="keyframed"></param>
+        /// <param name="reduced"></param>
+        public void GetLodCounts(out int deactivated, out int keyframed, out int reduced)
+        {
+            HavokDllBridge.get_lod_counts(out deactivated, out keyframed, out reduced);
         }
 
-        public void StopKeyframe(IPhysicsObject physObj)
+        /// <summary>
+        /// Makes the update skip the physics objects that barely moved since their pose was
+        /// last set, which saves the cost of setting and re-rendering transforms that did not
+        /// visibly change. An object is updated once it moved by more than linearEpsilon or
+        /// turned by more than about angularEpsilon radians. Objects that go to sleep are
+        /// always updated to their final pose.
+        /// </summary>
+        /// <param name="linearEpsilon">The distance an object has to move, or a negative value
+        /// to update every active object every frame, which is the default</param>
+        /// <param name="angularEpsilon">The angle in radians an object has to turn</param>
+        public void SetTransformEpsilon(float linearEpsilon, float angularEpsilon)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return;
+            HavokDllBridge.set_transform_epsilon(linearEpsilon, angularEpsilon);
+        }
 
-            Vector3 scale, trans;
-            Quaternion quat;
-            physObj.PhysicsWorldTransform.Decompose(out scale, out quat, out trans);
+        /// <summary>
+        /// Gets the current and peak memory use of Havok.
+        /// </summary>
+        /// <returns></returns>
+        public MemoryStats GetMemoryStats()
+        {
+            MemoryStats stats;
+            HavokDllBridge.get_memory_stats(out stats);
+            return stats;
+        }
 
-            float[] pos = Vector3Helper.ToFloats(ref trans);
-            float[] rot = { quat.X, quat.Y, quat.Z, quat.W };
+        /// <summary>
+        /// Starts recording the timings and counters of every world step. Call this before
+        /// InitializePhysics to also time the worker threads of a multithreaded world.
+        /// </summary>
+        /// <param name="historySize">The number of steps kept until GetStepStats is called</param>
+        /// <param name="csvPath">A file every step is written to as it is recorded, or null</param>
+        public void EnableProfiling(int historySize, String csvPath)
+        {
+            HavokDllBridge.enable_profiling(historySize, csvPath);
+        }
 
-            HavokDllBridge.apply_hard_keyframe(objectIDs[physObj], pos, rot, 0.016f);
+        /// <summary>
+        /// Stops recording step statistics and closes the CSV file, if any.
+        /// </summary>
+        public void DisableProfiling()
+        {
+            HavokDllBridge.disable_profiling();
         }
 
-        public void AddForce(IPhysicsObject physObj, float timeStep, Vector3 force)
+        /// <summary>
+        /// Starts writing every call that changes the simulation to a trace file, which the
+        /// HavokReplay tool can run again without the application. Call this before
+        /// InitializePhysics so that the trace holds the whole session.
+        /// </summary>
+        /// <param name="path">The trace file to write</param>
+        public void StartRecording(String path)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return;
+            if (!HavokDllBridge.start_recording(path))
+                throw new GoblinException("Cannot record a Havok trace to " + path + 
+                    ". Recording must start before the physics is initialized.");
+        }
 
-            HavokDllBridge.add_force(objectIDs[physObj], timeStep, Vector3Helper.ToFloats(force));
+        /// <summary>
+        /// Stops recording and closes the trace file.
+        /// </summary>
+        public void StopRecording()
+        {
+            HavokDllBridge.stop_recording();
         }
 
-        public void AddTorque(IPhysicsObject physObj, float timeStep, Vector3 torque)
+        /// <summary>
+        /// Copies the statistics of the steps recorded since the last call, oldest first.
+        /// </summary>
+        /// <param name="stats">Receives the step statistics</param>
+        /// <returns>The number of steps copied</returns>
+        public int GetStepStats(StepStats[] stats)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return;
+            return HavokDllBridge.get_step_stats(stats, stats.Length);
+        }
 
-            HavokDllBridge.add_torque(objectIDs[physObj], timeStep, Vector3Helper.ToFloats(torque));
+        /// <summary>
+        /// Copies the phantom events recorded since the last call for the phantom objects that
+        /// have HavokObject.QueuePhantomEvents set. Events that do not fit into the array stay
+        /// queued for the next call.
+        /// </summary>
+        /// <param name="events">Receives the phantom events</param>
+        /// <returns>The number of events copied</returns>
+        public int GetPhantomEvents(PhantomEvent[] events)
+        {
+            return HavokDllBridge.get_phantom_events(events, events.Length);
         }
 
-        public void SetLinearVelocity(IPhysicsObject physObj, Vector3 velocity)
+        /// <summary>
+        /// Gets the physics objects that are currently inside a phantom object.
+        /// </summary>
+        /// <param name="phantom">A physics object with HavokObject.IsPhantom set</param>
+        /// <param name="overlaps">Receives the physics objects inside the phantom</param>
+        public void GetPhantomOverlaps(IPhysicsObject phantom, List<IPhysicsObject> overlaps)
         {
-            if (!objectIDs.ContainsKey(physObj))
+            overlaps.Clear();
+            if (!objectIDs.ContainsKey(phantom))
                 return;
 
-            HavokDllBridge.set_linear_velocity(objectIDs[physObj], Vector3Helper.ToFloats(ref velocity));
+            int body = objectIDs[phantom];
+            int count = HavokDllBridge.get_phantom_overlaps(body, overlapHandles, overlapHandles.Length);
+            if (count > overlapHandles.Length)
+            {
+                overlapHandles = new int[count];
+                count = HavokDllBridge.get_phantom_overlaps(body, overlapHandles, overlapHandles.Length);
+            }
+
+            for (int i = 0; i < count && i < overlapHandles.Length; i++)
+            {
+                IPhysicsObject physObj = GetPhysicsObject(overlapHandles[i]);
+                if (physObj != null)
+                    overlaps.Add(physObj);
+            }
         }
 
-        public Vector3 GetLinearVelocity(IPhysicsObject physObj)
+        /// <summary>
+        /// Casts a batch of rays in a single call. Large batches are spread across the worker
+        /// threads of a multithreaded world.
+        /// </summary>
+        /// <param name="origins">The start points of the rays</param>
+        /// <param name="directions">The directions of the rays, which do not need to be normalized</param>
+        /// <param name="maxDistance">The length of every ray</param>
+        /// <param name="hits">Receives the closest hit of each ray</param>
+        /// <returns>The number of rays that hit something</returns>
+        public int CastRays(Vector3[] origins, Vector3[] directions, float maxDistance, RayHit[] hits)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return Vector3.Zero;
-
-            float[] velocity = new float[3];
-            HavokDllBridge.get_linear_velocity(objectIDs[physObj], velocity);
-            return new Vector3(velocity[0], velocity[1], velocity[2]);
+            return CastRays(origins, directions, maxDistance, 0, hits);
         }
 
-        public void SetAngularVelocity(IPhysicsObject physObj, Vector3 velocity)
+        /// <summary>
+        /// Casts a batch of rays that only hit the physics objects that a physics object with the
+        /// given collision filter info would collide with.
+        /// </summary>
+        /// <param name="origins">The start points of the rays</param>
+        /// <param name="directions">The directions of the rays, which do not need to be normalized</param>
+        /// <param name="maxDistance">The length of every ray</param>
+        /// <param name="filterInfo">The collision filter info of the rays (see CalcFilterInfo)</param>
+        /// <param name="hits">Receives the closest hit of each ray</param>
+        /// <returns>The number of rays that hit something</returns>
+        public int CastRays(Vector3[] origins, Vector3[] directions, float maxDistance, int filterInfo,
+            RayHit[] hits)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return;
+            int count = Math.Min(origins.Length, directions.Length);
+            if (hits.Length < count)
+                throw new GoblinException("hits must have an element for each ray");
 
-            HavokDllBridge.set_angular_velocity(objectIDs[physObj], Vector3Helper.ToFloats(velocity));
+            return HavokDllBridge.cast_rays(count, origins, directions, maxDistance, filterInfo, hits);
         }
 
-        public Vector3 GetAngularVelocity(IPhysicsObject physObj)
+        /// <summary>
+        /// Sweeps the collision shape of a physics object along a batch of straight paths in a
+        /// single call.
+        /// </summary>
+        /// <param name="shapeSource">The physics object whose shape and scale are cast</param>
+        /// <param name="origins">The start positions of the shape</param>
+        /// <param name="rotations">The orientation of the shape for each cast, or null</param>
+        /// <param name="directions">The directions of the casts, which do not need to be normalized</param>
+        /// <param name="maxDistance">The length of every cast</param>
+        /// <param name="hits">Receives the closest hit of each cast</param>
+        /// <returns>The number of casts that hit something</returns>
+        public int CastShape(IPhysicsObject shapeSource, Vector3[] origins, Quaternion[] rotations,
+            Vector3[] directions, float maxDistance, RayHit[] hits)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return Vector3.Zero;
-
-            float[] velocity = new float[3];
-            HavokDllBridge.get_angular_velocity(objectIDs[physObj], velocity);
-            return new Vector3(velocity[0], velocity[1], velocity[2]);
+            return CastShape(shapeSource, origins, rotations, directions, maxDistance, 0, hits);
         }
 
-        public Matrix GetTransform(IPhysicsObject physObj)
+        /// <summary>
+        /// Sweeps the collision shape of a physics object along a batch of straight paths, hitting
+        /// only the physics objects that a physics object with the given collision filter info
+        /// would collide with.
+        /// </summary>
+        /// <param name="shapeSource">The physics object whose shape and scale are cast. The shape
+        /// is built on the first cast and kept until the object is removed or ReleaseCastShape is
+        /// called. Compound shapes are not supported, and phantoms cast their bounding shape.</param>
+        /// <param name="origins">The start positions of the shape</param>
+        /// <param name="rotations">The orientation of the shape for each cast, or null</param>
+        /// <param name="directions">The directions of the casts, which do not need to be normalized</param>
+        /// <param name="maxDistance">The length of every cast</param>
+        /// <param name="filterInfo">The collision filter info of the shape (see CalcFilterInfo)</param>
+        /// <param name="hits">Receives the closest hit of each cast</param>
+        /// <returns>The number of casts that hit something</returns>
+        public int CastShape(IPhysicsObject shapeSource, Vector3[] origins, Quaternion[] rotations,
+            Vector3[] directions, float maxDistance, int filterInfo, RayHit[] hits)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return Matrix.Identity;
+            int count = Math.Min(origins.Length, directions.Length);
+            if (hits.Length < count || (rotations != null && rotations.Length < count))
+                throw new GoblinException("hits and rotations must have an element for each cast");
 
-            float[] transform = new float[16];
-            HavokDllBridge.get_body_transform(objectIDs[physObj], transform);
-            return MatrixHelper.FloatsToMatrix(transform);
+            IntPtr shape = GetCastShape(shapeSource);
+            return HavokDllBridge.cast_shape(shape, count, origins, rotations, directions,
+                maxDistance, filterInfo, hits);
         }
 
-        public Vector3 GetPosition(IPhysicsObject physObj)
+        /// <summary>
+        /// Releases the shape kept for casting the shape of a physics object, if any. This happens
+        /// on its own when the object is removed.
+        /// </summary>
+        /// <param name="shapeSource"></param>
+        public void ReleaseCastShape(IPhysicsObject shapeSource)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return Vector3.Zero;
+            IntPtr shape;
+            if (!castShapes.TryGetValue(shapeSource, out shape))
+                return;
 
-            float[] position = new float[3];
-            HavokDllBridge.get_body_position(objectIDs[physObj], position);
-            return Vector3Helper.FromFloats(position);
+            HavokDllBridge.release_shape(shape);
+            castShapes.Remove(shapeSource);
+            castShapeScales.Remove(shapeSource);
         }
 
-        public Quaternion GetRotation(IPhysicsObject physObj)
+        /// <summary>
+        /// Pushes every dynamic physics object within radius of an explosion away from its center
+        /// in a single call. The cost grows with the objects near the explosion, not with the
+        /// number of objects in the world.
+        /// </summary>
+        /// <param name="center">The center of the explosion</param>
+        /// <param name="radius">The distance the explosion reaches, measured to the closest point
+        /// of the bounding box of an object</param>
+        /// <param name="impulse">The impulse an object at the center receives</param>
+        /// <param name="falloff">How fast the impulse drops with the distance: an object at distance
+        /// d receives impulse * (1 - d / radius) ^ falloff, so 0 is constant and 1 is linear</param>
+        /// <param name="affected">Receives the pushed physics objects, or null</param>
+        /// <returns>The number of pushed physics objects, or -1 if the explosion was called during
+        /// a step, e.g., from a collision callback. It is then applied once the step is over, and
+        /// affected is left empty.</returns>
+        public int ApplyExplosion(Vector3 center, float radius, float impulse, float falloff,
+            List<IPhysicsObject> affected)
         {
-            if (!objectIDs.ContainsKey(physObj))
-                return Quaternion.Identity;
-
-            float[] rotation = new float[4];
-            HavokDllBridge.get_body_rotation(objectIDs[physObj], rotation);
-            return new Quaternion(rotation[0], rotation[1], rotation[2], rotation[3]);
+            return ApplyExplosion(center, radius, impulse, falloff, -1, false, affected);
         }
 
-        public IPhysicsObject GetPhysicsObject(IntPtr body)
+        /// <summary>
+        /// Pushes the dynamic physics objects within radius of an explosion away from its center,
+        /// only affecting the given collision layers and optionally sparing the objects that are
+        /// hidden from the center behind another object.
+        /// </summary>
+        /// <param name="center">The center of the explosion</param>
+        /// <param name="radius">The distance the explosion reaches, measured to the closest point
+        /// of the bounding box of an object</param>
+        /// <param name="impulse">The impulse an object at the center receives</param>
+        /// <param name="falloff">How fast the impulse drops with the distance: an object at distance
+        /// d receives impulse * (1 - d / radius) ^ falloff, so 0 is constant and 1 is linear</param>
+        /// <param name="layerMask">A bit for each collision layer to push (see CalcFilterInfo),
+        /// or -1 for all of them</param>
+        /// <param name="occlusion">Whether to cast a ray from the center to each object and spare
+        /// the objects whose ray first hits another object</param>
+        /// <param name="affected">Receives the pushed physics objects, or null</param>
+        /// <returns>The number of pushed physics objects, or -1 if the explosion was called during
+        /// a step, e.g., from a collision callback. It is then applied once the step is over, and
+        /// affected is left empty.</returns>
+        public int ApplyExplosion(Vector3 center, float radius, float impulse, float falloff, int layerMask,
+            bool occlusion, List<IPhysicsObject> affected)
         {
-            if (reverseIDs.ContainsKey(body))
-                return reverseIDs[body];
-            else
-                return null;
+            // No explosion can push more bodies than there are
+            if (explosionHandles.Length < objectIDs.Count)
+                explosionHandles = new int[Math.Max(explosionHandles.Length * 2, objectIDs.Count)];
+
+            int count = HavokDllBridge.apply_explosion(Vector3Helper.ToFloats(ref center), radius, impulse,
+                falloff, layerMask, occlusion, explosionHandles, explosionHandles.Length);
+
+            if (affected != null)
+            {
+                affected.Clear();
+                for (int i = 0; i < count && i < explosionHandles.Length; i++)
+                {
+                    IPhysicsObject physObj = GetPhysicsObject(explosionHandles[i]);
+                    if (physObj != null)
+                        affected.Add(physObj);
+                }
+            }
+
+            return count;
         }
 
         public void SetBodyWorldLeaveCallback(HavokDllBridge.BodyLeaveWorldCallback callback)
@@ -740,7 +2097,60 @@ namespace GoblinXNA.Physics.Havok
 
         #region Helper Functions
 
+        private static unsafe void FloatsToMatrix(float* mat, out Matrix m)
+        {
+            m.M11 = mat[0]; m.M12 = mat[1]; m.M13 = mat[2]; m.M14 = mat[3];
+            m.M21 = mat[4]; m.M22 = mat[5]; m.M23 = mat[6]; m.M24 = mat[7];
+            m.M31 = mat[8]; m.M32 = mat[9]; m.M33 = mat[10]; m.M34 = mat[11];
+            m.M41 = mat[12]; m.M42 = mat[13]; m.M43 = mat[14]; m.M44 = mat[15];
+        }
+
+        /// <summary>
+        /// Gets the shape kept for casting the shape of a physics object, building it again if
+        /// the scale of the object changed since.
+        /// </summary>
+        /// <param name="shapeSource"></param>
+        /// <returns></returns>
+        private IntPtr GetCastShape(IPhysicsObject shapeSource)
+        {
+            Quaternion rotation;
+            Vector3 trans;
+            Vector3 scale;
+            shapeSource.CompoundInitialWorldTransform.Decompose(out scale, out rotation, out trans);
+
+            IntPtr shape;
+            if (castShapes.TryGetValue(shapeSource, out shape) && castShapeScales[shapeSource] == scale)
+                return shape;
+
+            if (shapeSource.Shape == ShapeType.Compound)
+                throw new GoblinException("Havok physics does not cast Compound shapes");
+
+            ReleaseCastShape(shapeSource);
+
+            shape = GetCollisionShape(shapeSource, scale, false);
+            if (shape == IntPtr.Zero)
+                throw new GoblinException("Failed to create the shape to cast for " + shapeSource.Shape);
+
+            castShapes[shapeSource] = shape;
+            castShapeScales[shapeSource] = scale;
+
+            return shape;
+        }
+
         private IntPtr GetCollisionShape(IPhysicsObject physObj, Vector3 scale)
+        {
+            return GetCollisionShape(physObj, scale, true);
+        }
+
+        /// <summary>
+        /// Creates the collision shape of a physics object, wrapped in a phantom shape if the object
+        /// is a phantom and wrapPhantom is true.
+        /// </summary>
+        /// <param name="physObj"></param>
+        /// <param name="scale"></param>
+        /// <param name="wrapPhantom"></param>
+        /// <returns></returns>
+        private IntPtr GetCollisionShape(IPhysicsObject physObj, Vector3 scale, bool wrapPhantom)
         {
             IntPtr collisionShape = IntPtr.Zero;
 
@@ -852,13 +2262,14 @@ namespace GoblinXNA.Physics.Havok
                     break;
             }
 
-            if (physObj is HavokObject)
+            if (wrapPhantom && physObj is HavokObject)
             {
                 if (((HavokObject)physObj).IsPhantom)
                 {
                     collisionShape = HavokDllBridge.create_phantom_shape(collisionShape,
                         ((HavokObject)physObj).PhantomEnterCallback,
-                        ((HavokObject)physObj).PhantomLeaveCallback);
+                        ((HavokObject)physObj).PhantomLeaveCallback,
+                        ((HavokObject)physObj).QueuePhantomEvents);
                 }
             }
 
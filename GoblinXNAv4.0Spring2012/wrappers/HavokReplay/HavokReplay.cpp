@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+// Runs a trace recorded by HavokWrapper again without the application, and reports how long the
+// steps took and whether the bodies ended up where they did while recording.
+//
+// Usage: HavokReplay <trace file> [max steps]
+
+extern "C" __declspec(dllimport) int replay_trace(const char* path, float stepTimes[], int maxSteps, 
+	int& firstMismatch);
+
+static int compareTimes(const void* a, const void* b)
+{
+	float x = *static_cast<const float*>(a);
+	float y = *static_cast<const float*>(b);
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+// Nearest rank percentile of sorted times
+static float percentile(const float* times, int count, int p)
+{
+	int rank = (p * count + 99) / 100;
+	if(rank < 1)
+		rank = 1;
+
+	return times[rank - 1];
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		printf("Usage: HavokReplay <trace file> [max steps]\n");
+		return 2;
+	}
+
+	int maxSteps = (argc > 2) ? atoi(argv[2]) : 1000000;
+	if(maxSteps <= 0)
+		maxSteps = 1000000;
+
+	float* times = new float[maxSteps];
+
+	int firstMismatch;
+	int numSteps = replay_trace(argv[1], times, maxSteps, firstMismatch);
+	if(numSteps < 0)
+	{
+		printf("Cannot read the trace %s\n", argv[1]);
+		delete[] times;
+		return 2;
+	}
+
+	int count = (numSteps < maxSteps) ? numSteps : maxSteps;
+	printf("Replayed %d steps\n", numSteps);
+
+	if(count > 0)
+	{
+		float total = 0;
+		for(int i = 0; i < count; i++)
+			total += times[i];
+
+		qsort(times, count, sizeof(float), compareTimes);
+
+		printf("Step time (ms): mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", total / count,
+			percentile(times, count, 50), percentile(times, count, 90), percentile(times, count, 99),
+			times[count - 1]);
+	}
+
+	delete[] times;
+
+	if(firstMismatch >= 0)
+	{
+		printf("The transforms differ from the recording after step %d\n", firstMismatch);
+		return 1;
+	}
+
+	printf("The transforms match the recording\n");
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Common/Base/hkBase.h>
+
+#include "BodySlotMap.cpp"
+
+// Tracks pools of bodies created up front from a template and parked outside the world while
+// they are not in use. A pooled body keeps its handle for the lifetime of its pool, so
+// spawning one only pops a free handle. A released body goes back to the free list once it
+// has actually been removed from the world, which keeps a body from being spawned again
+// while a removal for it is still queued.
+class BodyPool
+{
+public:
+
+	enum
+	{
+		NOT_POOLED = -1
+	};
+
+	~BodyPool()
+	{
+		clear();
+	}
+
+	// Forgets every pool without touching their bodies, for when the world goes
+	void clear()
+	{
+		for(int i = 0; i < pools.getSize(); i++)
+			delete pools[i];
+
+		pools.clearAndDeallocate();
+		slotPools.clearAndDeallocate();
+		slotHandles.clearAndDeallocate();
+		slotActive.clearAndDeallocate();
+	}
+
+	// Returns the id of a new, empty pool
+	int addPool()
+	{
+		int id = pools.indexOf(HK_NULL);
+		if(id < 0)
+		{
+			id = pools.getSize();
+			pools.pushBack(HK_NULL);
+		}
+
+		pools[id] = new Pool();
+		return id;
+	}
+
+	void removePool(int id)
+	{
+		Pool* pool = getPool(id);
+		if(pool == HK_NULL)
+			return;
+
+		for(int i = 0; i < pool->handles.getSize(); i++)
+			slotPools[BodySlotMap::getIndex(pool->handles[i])] = NOT_POOLED;
+
+		delete pool;
+		pools[id] = HK_NULL;
+	}
+
+	// Adds a parked body to a pool
+	void addBody(int id, int handle)
+	{
+		Pool* pool = getPool(id);
+		int index = BodySlotMap::getIndex(handle);
+		if(slotPools.getSize() <= index)
+		{
+			int oldSize = slotPools.getSize();
+			slotPools.setSize(index + 1);
+			slotHandles.setSize(index + 1);
+			slotActive.setSize(index + 1);
+			for(int i = oldSize; i < index + 1; i++)
+				slotPools[i] = NOT_POOLED;
+		}
+
+		slotPools[index] = id;
+		slotHandles[index] = handle;
+		slotActive[index] = false;
+		pool->handles.pushBack(handle);
+		pool->freeHandles.pushBack(handle);
+	}
+
+	// Takes a parked body out of a pool and returns its handle, or INVALID_HANDLE if the pool
+	// has no parked body left
+	int spawn(int id)
+	{
+		Pool* pool = getPool(id);
+		if(pool == HK_NULL || pool->freeHandles.getSize() == 0)
+			return BodySlotMap::INVALID_HANDLE;
+
+		int handle = pool->freeHandles.back();
+		pool->freeHandles.popBack();
+		slotActive[BodySlotMap::getIndex(handle)] = true;
+
+		return handle;
+	}
+
+	// Returns an active body to the free list of its pool. Returns false if the body is not
+	// pooled or already parked.
+	bool park(int handle)
+	{
+		int id = getPoolId(handle);
+		int index = BodySlotMap::getIndex(handle);
+		if(id == NOT_POOLED || !slotActive[index])
+			return false;
+
+		slotActive[index] = false;
+		pools[id]->freeHandles.pushBack(handle);
+
+		return true;
+	}
+
+	// Returns the id of the pool a body belongs to, or NOT_POOLED. A stale handle whose slot
+	// has been reused since is not pooled, even if the body now in the slot is.
+	int getPoolId(int handle) const
+	{
+		int index = BodySlotMap::getIndex(handle);
+		if(handle < 0 || index >= slotPools.getSize() || slotHandles[index] != handle)
+			return NOT_POOLED;
+
+		return slotPools[index];
+	}
+
+	bool isValid(int id) const
+	{
+		return getPool(id) != HK_NULL;
+	}
+
+	int getNumPools() const
+	{
+		return pools.getSize();
+	}
+
+	int getFreeCount(int id) const
+	{
+		const Pool* pool = getPool(id);
+		return (pool != HK_NULL) ? pool->freeHandles.getSize() : 0;
+	}
+
+	const hkArray<int>& getHandles(int id) const
+	{
+		return getPool(id)->handles;
+	}
+
+private:
+
+	struct Pool
+	{
+		hkArray<int> handles;
+		hkArray<int> freeHandles;
+	};
+
+	Pool* getPool(int id) const
+	{
+		if(id < 0 || id >= pools.getSize())
+			return HK_NULL;
+
+		return pools[id];
+	}
+
+	hkArray<Pool*> pools;
+
+	// Pool id, full handle and whether the body is in the world, by slot index
+	hkArray<int> slotPools;
+	hkArray<int> slotHandles;
+	hkArray<bool> slotActive;
+};
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Physics/Dynamics/Entity/hkpRigidBody.h>
+
+// Hands out dense integer handles for rigid bodies. The low bits of a handle hold the slot
+// index and the high bits a generation counter that is bumped whenever the slot is freed,
+// so a stale handle is rejected instead of resolving to whichever body reuses the slot.
+// The handle is also stored in the body's user data for the reverse lookup.
+class BodySlotMap
+{
+public:
+
+	enum
+	{
+		INDEX_BITS = 20,
+		INDEX_MASK = (1 << INDEX_BITS) - 1,
+		GENERATION_MASK = 0x7ff,
+		INVALID_HANDLE = -1
+	};
+
+	static int getIndex(int handle)
+	{
+		return handle & INDEX_MASK;
+	}
+
+	static int getHandle(const hkpEntity* entity)
+	{
+		return (int)entity->getUserData();
+	}
+
+	static int getIndex(const hkpEntity* entity)
+	{
+		return getIndex(getHandle(entity));
+	}
+
+	int add(hkpRigidBody* body)
+	{
+		int index;
+		if(freeSlots.getSize() > 0)
+		{
+			index = freeSlots.back();
+			freeSlots.popBack();
+		}
+		else
+		{
+			if(bodies.getSize() > INDEX_MASK)
+				return INVALID_HANDLE;
+
+			index = bodies.getSize();
+			bodies.pushBack(HK_NULL);
+			generations.pushBack(0);
+		}
+
+		bodies[index] = body;
+
+		int handle = (generations[index] << INDEX_BITS) | index;
+		body->setUserData(handle);
+
+		return handle;
+	}
+
+	hkpRigidBody* get(int handle) const
+	{
+		if(handle < 0)
+			return HK_NULL;
+
+		int index = getIndex(handle);
+		if(index >= bodies.getSize() || generations[index] != (handle >> INDEX_BITS))
+			return HK_NULL;
+
+		return bodies[index];
+	}
+
+	hkpRigidBody* remove(int handle)
+	{
+		hkpRigidBody* body = get(handle);
+		if(body == HK_NULL)
+			return HK_NULL;
+
+		int index = getIndex(handle);
+		bodies[index] = HK_NULL;
+		generations[index] = (generations[index] + 1) & GENERATION_MASK;
+		freeSlots.pushBack(index);
+
+		return body;
+	}
+
+	// Returns the body in a slot, or null if the slot is free
+	hkpRigidBody* getAt(int index) const
+	{
+		return bodies[index];
+	}
+
+	// Number of slots ever handed out; every slot index is smaller than this
+	int getCapacity() const
+	{
+		return bodies.getSize();
+	}
+
+	void clear()
+	{
+		bodies.clearAndDeallocate();
+		generations.clearAndDeallocate();
+		freeSlots.clearAndDeallocate();
+	}
+
+private:
+
+	hkArray<hkpRigidBody*> bodies;
+	hkArray<int> generations;
+	hkArray<int> freeSlots;
+};
\ No newline at end of file
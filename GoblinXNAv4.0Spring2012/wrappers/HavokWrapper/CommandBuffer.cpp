@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Common/Base/hkBase.h>
+
+// A packed stream of world mutations. Each record is an opcode word and a body handle word
+// followed by the fixed number of payload words that opcode takes, so records can be
+// appended without allocation once the buffer has grown and replayed later under a single
+// world lock. The same layout is used for the batches submitted from the managed side.
+class CommandBuffer
+{
+public:
+
+	enum Opcode
+	{
+		CMD_ADD_BODY,
+		CMD_REMOVE_BODY,
+		CMD_ADD_FORCE,				// timeStep, force[3]
+		CMD_ADD_TORQUE,				// timeStep, torque[3]
+		CMD_SET_LINEAR_VELOCITY,	// velocity[3]
+		CMD_SET_ANGULAR_VELOCITY,	// velocity[3]
+		CMD_APPLY_HARD_KEYFRAME,	// position[3], rotation[4], timeStep
+		CMD_APPLY_SOFT_KEYFRAME,	// position[3], rotation[4], angularPositionFactor[3], angularVelocityFactor[3],
+									// linearPositionFactor[3], linearVelocityFactor[3], maxAngularAcceleration,
+									// maxLinearAcceleration, maxAllowedDistance, timeStep
+		CMD_SET_GRAVITY,			// gravity[3], handle is ignored
+		CMD_CREATE_BODY,			// handle is an index into the shape array passed with the batch, followed by
+									// mass, motionType, qualityType, position[3], rotation[4], linearVelocity[3],
+									// linearDamping, maxLinearVelocity, angularVelocity[3], angularDamping,
+									// maxAngularVelocity, friction, restitution, allowedPenetrationDepth,
+									// neverDeactivate, gravityFactor, collisionFilterInfo (an int word)
+		CMD_SPAWN_BODY,				// position[3], rotation[4], linearVelocity[3], angularVelocity[3], adds a
+									// parked pooled body back to the world
+		CMD_SET_SCALE,				// scale[3] of the rendered object, applied to the published transforms
+		CMD_APPLY_EXPLOSION,		// center[3], radius, impulse, falloff, layerMask (an int word), occlusion (an
+									// int word), handle is ignored. Queued by apply_explosion during a step
+		CMD_MAX
+	};
+
+	enum
+	{
+		HEADER_SIZE = 2
+	};
+
+	union Word
+	{
+		int i;
+		float f;
+	};
+
+	// Number of payload words following the header of a record, or -1 for an unknown opcode
+	static int getPayloadSize(int opcode)
+	{
+		static const int payloadSizes[CMD_MAX] = { 0, 0, 4, 4, 3, 3, 8, 23, 3, 26, 13, 3, 8 };
+
+		if(opcode < 0 || opcode >= CMD_MAX)
+			return -1;
+
+		return payloadSizes[opcode];
+	}
+
+	void write(int opcode, int handle, const float* payload)
+	{
+		int payloadSize = getPayloadSize(opcode);
+		Word* record = words.expandBy(HEADER_SIZE + payloadSize);
+
+		record[0].i = opcode;
+		record[1].i = handle;
+		for(int i = 0; i < payloadSize; i++)
+			record[HEADER_SIZE + i].f = payload[i];
+	}
+
+	// Appends a record that is already packed, e.g., one taken from a submitted batch
+	void write(const Word* record)
+	{
+		int size = HEADER_SIZE + getPayloadSize(record[0].i);
+		Word* dest = words.expandBy(size);
+
+		for(int i = 0; i < size; i++)
+			dest[i] = record[i];
+	}
+
+	const Word* begin() const
+	{
+		return words.begin();
+	}
+
+	int getSize() const
+	{
+		return words.getSize();
+	}
+
+	bool isEmpty() const
+	{
+		return words.getSize() == 0;
+	}
+
+	void clear()
+	{
+		words.clear();
+	}
+
+	void clearAndDeallocate()
+	{
+		words.clearAndDeallocate();
+	}
+
+	void swap(CommandBuffer& other)
+	{
+		words.swap(other.words);
+	}
+
+private:
+
+	hkArray<Word> words;
+};
\ No newline at end of file
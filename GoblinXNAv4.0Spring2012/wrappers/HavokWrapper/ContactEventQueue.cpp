@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdlib.h>
+#include <windows.h>
+
+#include <Physics/Dynamics/Entity/hkpRigidBody.h>
+
+#include "BodySlotMap.cpp"
+
+// Collects contact events raised during a step so that they can be handed to the managed side
+// in one call afterwards. Every thread that raises events gets its own ring buffer, which it
+// fills without locking; the thread that drains the queue is the only reader. Events that do
+// not fit are dropped and counted.
+class ContactEventQueue
+{
+public:
+
+	enum Kind
+	{
+		CONTACT_POINT = 0,
+		COLLISION_STARTED = 1,
+		COLLISION_ENDED = 2
+	};
+
+	struct Event
+	{
+		int body1;
+		int body2;
+		int kind;
+		float speed;
+		float point[3];
+		float normal[3];
+	};
+
+	enum
+	{
+		MAX_THREADS = 32,
+		CAPACITY = 4096,
+		CAPACITY_MASK = CAPACITY - 1
+	};
+
+	ContactEventQueue()
+	{
+		tlsIndex = TlsAlloc();
+		generation = 1;
+		numThreads = 0;
+		dropped = 0;
+
+		for(int i = 0; i < MAX_THREADS; i++)
+		{
+			rings[i].events = HK_NULL;
+			rings[i].head = 0;
+			rings[i].tail = 0;
+		}
+	}
+
+	~ContactEventQueue()
+	{
+		clear();
+		TlsFree(tlsIndex);
+	}
+
+	// Called from the thread that raised the event
+	void push(const Event& evt)
+	{
+		Ring* ring = getRing();
+		if(ring == HK_NULL)
+		{
+			InterlockedIncrement(&dropped);
+			return;
+		}
+
+		LONG head = ring->head;
+		if(head - ring->tail >= CAPACITY)
+		{
+			InterlockedIncrement(&dropped);
+			return;
+		}
+
+		ring->events[head & CAPACITY_MASK] = evt;
+		MemoryBarrier();
+		ring->head = head + 1;
+	}
+
+	void push(int kind, const hkpRigidBody* body1, const hkpRigidBody* body2, float speed,
+		const hkVector4* point, const hkVector4* normal)
+	{
+		Event evt;
+		evt.body1 = BodySlotMap::getHandle(body1);
+		evt.body2 = BodySlotMap::getHandle(body2);
+		evt.kind = kind;
+		evt.speed = speed;
+
+		for(int i = 0; i < 3; i++)
+		{
+			evt.point[i] = (point != HK_NULL) ? (*point)(i) : 0;
+			evt.normal[i] = (normal != HK_NULL) ? (*normal)(i) : 0;
+		}
+
+		push(evt);
+	}
+
+	// Copies up to maxEvents queued events, oldest first per thread, and returns how many were
+	// copied. Whatever does not fit stays queued for the next call.
+	int drain(Event* events, int maxEvents)
+	{
+		int count = 0;
+		int threads = numThreads;
+		if(threads > MAX_THREADS)
+			threads = MAX_THREADS;
+
+		for(int i = 0; i < threads && count < maxEvents; i++)
+		{
+			Ring& ring = rings[i];
+
+			LONG tail = ring.tail;
+			LONG head = ring.head;
+			MemoryBarrier();
+
+			for(; tail != head && count < maxEvents; tail++, count++)
+				events[count] = ring.events[tail & CAPACITY_MASK];
+
+			MemoryBarrier();
+			ring.tail = tail;
+		}
+
+		return count;
+	}
+
+	// Returns the number of events dropped since the last call
+	int takeDropped()
+	{
+		return (int)InterlockedExchange(&dropped, 0);
+	}
+
+	// Must only be called while no thread is raising events
+	void clear()
+	{
+		for(int i = 0; i < MAX_THREADS; i++)
+		{
+			delete[] rings[i].events;
+			rings[i].events = HK_NULL;
+			rings[i].head = 0;
+			rings[i].tail = 0;
+		}
+
+		// Threads that registered before keep a stale slot in their thread local storage;
+		// bumping the generation makes them register again.
+		generation++;
+		numThreads = 0;
+		dropped = 0;
+	}
+
+private:
+
+	struct Ring
+	{
+		Event* events;
+		volatile LONG head;
+		volatile LONG tail;
+	};
+
+	// The thread local value holds the generation in the high bits and the slot plus one
+	// in the low byte. Threads beyond MAX_THREADS are marked with NO_SLOT and drop their events.
+	enum { NO_SLOT = 0xff };
+
+	Ring* getRing()
+	{
+		LONG value = (LONG)(INT_PTR)TlsGetValue(tlsIndex);
+		if(value == 0 || (value >> 8) != generation)
+		{
+			LONG slot = InterlockedIncrement(&numThreads) - 1;
+			if(slot < MAX_THREADS)
+			{
+				rings[slot].events = new Event[CAPACITY];
+				value = (generation << 8) | (slot + 1);
+			}
+			else
+				value = (generation << 8) | NO_SLOT;
+
+			TlsSetValue(tlsIndex, (LPVOID)(INT_PTR)value);
+		}
+
+		if((value & 0xff) == NO_SLOT)
+			return HK_NULL;
+
+		return &rings[(value & 0xff) - 1];
+	}
+
+	DWORD tlsIndex;
+	LONG generation;
+	volatile LONG numThreads;
+	volatile LONG dropped;
+	Ring rings[MAX_THREADS];
+};
\ No newline at end of file
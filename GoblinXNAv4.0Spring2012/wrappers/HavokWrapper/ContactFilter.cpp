@@ -0,0 +1,199 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/Thread/CriticalSection/hkCriticalSection.h>
+
+// Counts the world steps and the simulated time so that contact filters can tell steps apart
+class ContactClock
+{
+public:
+
+	ContactClock()
+	{
+		reset();
+	}
+
+	// Called before every world step
+	void advance(hkReal elapsedSeconds)
+	{
+		step++;
+		time += elapsedSeconds;
+	}
+
+	void reset()
+	{
+		step = 0;
+		time = 0;
+	}
+
+	int getStep() const
+	{
+		return step;
+	}
+
+	hkReal getTime() const
+	{
+		return time;
+	}
+
+private:
+
+	int step;
+	hkReal time;
+};
+
+// Thins out the contact point events of a listener. Events slower than the minimum speed are
+// dropped, and a body pair that already reported is held back for the rest of the step and
+// the cooldown that follows. Pairs are tracked in an open-addressed table keyed by the two
+// body handles. Listeners may be called from several stepping threads at once, hence the lock.
+class ContactFilter
+{
+public:
+
+	enum
+	{
+		MIN_CAPACITY = 16
+	};
+
+	ContactFilter(const ContactClock* _clock, float _minSpeed, float _cooldown, bool _oncePerStep)
+		: lock(1000)
+	{
+		clock = _clock;
+		minSpeed = _minSpeed;
+		cooldown = _cooldown;
+		oncePerStep = _oncePerStep;
+		count = 0;
+	}
+
+	// Returns true if none of the filter options are set, in which case no filter is needed
+	static bool isPassThrough(float minSpeed, float cooldown, bool oncePerStep)
+	{
+		return minSpeed <= 0 && cooldown <= 0 && !oncePerStep;
+	}
+
+	bool accept(int body1, int body2, float separatingVelocity)
+	{
+		if(hkMath::fabs(separatingVelocity) < minSpeed)
+			return false;
+
+		if(!oncePerStep && cooldown <= 0)
+			return true;
+
+		hkUint64 key = getKey(body1, body2);
+		int step = clock->getStep();
+		hkReal time = clock->getTime();
+
+		lock.enter();
+
+		int slot = findSlot(key);
+		bool accepted = (slot < 0 || entries[slot].key != key || !isBlocking(entries[slot], step, time));
+		if(accepted)
+		{
+			if(slot < 0 || entries[slot].key != key)
+			{
+				if((count + 1) * 2 > entries.getSize())
+				{
+					rehash(entries.getSize(), step, time);
+					if((count + 1) * 2 > entries.getSize())
+						rehash(hkMath::max2(entries.getSize() * 2, (int)MIN_CAPACITY), step, time);
+				}
+
+				slot = findSlot(key);
+				entries[slot].key = key;
+				count++;
+			}
+
+			entries[slot].step = step;
+			entries[slot].time = time;
+		}
+
+		lock.leave();
+
+		return accepted;
+	}
+
+private:
+
+	struct Entry
+	{
+		hkUint64 key;
+		int step;
+		hkReal time;
+	};
+
+	static const hkUint64 EMPTY_KEY = ~(hkUint64)0;
+
+	// The key does not depend on the order of the bodies
+	static hkUint64 getKey(int body1, int body2)
+	{
+		hkUint32 a = (hkUint32)body1;
+		hkUint32 b = (hkUint32)body2;
+		if(a > b)
+		{
+			hkUint32 t = a;
+			a = b;
+			b = t;
+		}
+
+		return ((hkUint64)a << 32) | b;
+	}
+
+	bool isBlocking(const Entry& entry, int step, hkReal time) const
+	{
+		if(oncePerStep && entry.step == step)
+			return true;
+
+		return cooldown > 0 && time - entry.time < cooldown;
+	}
+
+	// Returns the slot holding the key or the empty slot where it would go, or -1 if the
+	// table has not been allocated yet
+	int findSlot(hkUint64 key) const
+	{
+		if(entries.getSize() == 0)
+			return -1;
+
+		int mask = entries.getSize() - 1;
+		int slot = (int)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+		while(entries[slot].key != EMPTY_KEY && entries[slot].key != key)
+			slot = (slot + 1) & mask;
+
+		return slot;
+	}
+
+	// Rebuilds the table with the given capacity, dropping the pairs that no longer hold
+	// anything back
+	void rehash(int capacity, int step, hkReal time)
+	{
+		hkArray<Entry> old;
+		old.swap(entries);
+
+		Entry empty;
+		empty.key = EMPTY_KEY;
+		empty.step = 0;
+		empty.time = 0;
+		entries.setSize(capacity, empty);
+		count = 0;
+
+		for(int i = 0; i < old.getSize(); i++)
+		{
+			if(old[i].key == EMPTY_KEY || !isBlocking(old[i], step, time))
+				continue;
+
+			int slot = findSlot(old[i].key);
+			entries[slot] = old[i];
+			count++;
+		}
+	}
+
+	const ContactClock* clock;
+	float minSpeed;
+	float cooldown;
+	bool oncePerStep;
+
+	hkCriticalSection lock;
+	hkArray<Entry> entries;
+	int count;
+};
\ No newline at end of file
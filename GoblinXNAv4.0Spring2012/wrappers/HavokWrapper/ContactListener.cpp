@@ -5,35 +5,62 @@
 #include <Physics/Dynamics/Collide/ContactListener/hkpContactListener.h>
 #include <Physics/Dynamics/Entity/hkpEntityListener.h>
 
+#include "ContactEventQueue.cpp"
+#include "ContactFilter.cpp"
+
 typedef void (*contactCallback)(hkpRigidBody* body1, hkpRigidBody* body2, float contactSpeed);
 typedef void (*collisionStarted)(hkpRigidBody* body1, hkpRigidBody* body2);
 typedef void (*collisionEnded)(hkpRigidBody* body1, hkpRigidBody* body2);
 
+// Reports the contacts of a body either through the callbacks or, when a queue is given, by
+// recording them into the queue to be drained after the step. Contact point events are passed
+// through the filter first, if there is one.
 class ContactListener : public hkpContactListener, public hkpEntityListener
 {
 public:
 
-	ContactListener(hkpRigidBody* body)
+	ContactListener(hkpRigidBody* body, ContactEventQueue* _queue = HK_NULL,
+		ContactFilter* _filter = HK_NULL)
 	{
+		callback = NULL;
+		startCallback = NULL;
+		endCallback = NULL;
+		queue = _queue;
+		filter = _filter;
+
 		body->addContactListener(this);
 		body->addEntityListener(this);
 	}
 
 	void contactPointCallback( const hkpContactPointEvent& evt )
 	{
-		if(callback != NULL)
+		if(filter != HK_NULL && !filter->accept(BodySlotMap::getHandle(evt.getBody(0)),
+			BodySlotMap::getHandle(evt.getBody(1)), evt.getSeparatingVelocity()))
+			return;
+
+		if(queue != HK_NULL)
+			queue->push(ContactEventQueue::CONTACT_POINT, evt.getBody(0), evt.getBody(1),
+				evt.getSeparatingVelocity(), &evt.m_contactPoint->getPosition(),
+				&evt.m_contactPoint->getNormal());
+		else if(callback != NULL)
 			callback(evt.getBody(0), evt.getBody(1), evt.getSeparatingVelocity());
 	}
 
 	void collisionAddedCallback( const hkpCollisionEvent& evt )
 	{
-		if(startCallback != NULL)
+		if(queue != HK_NULL)
+			queue->push(ContactEventQueue::COLLISION_STARTED, evt.getBody(0), evt.getBody(1), 0,
+				HK_NULL, HK_NULL);
+		else if(startCallback != NULL)
 			startCallback(evt.getBody(0), evt.getBody(1));
 	}
 
 	void collisionRemovedCallback( const hkpCollisionEvent& evt )
 	{
-		if(endCallback != NULL)
+		if(queue != HK_NULL)
+			queue->push(ContactEventQueue::COLLISION_ENDED, evt.getBody(0), evt.getBody(1), 0,
+				HK_NULL, HK_NULL);
+		else if(endCallback != NULL)
 			endCallback(evt.getBody(0), evt.getBody(1));
 	}
 
@@ -41,6 +68,9 @@ public:
 	{
 		entity->removeContactListener(this);
 		entity->removeEntityListener(this);
+
+		delete filter;
+		delete this;
 	}
 
 	void entityRemovedCallback(hkpEntity* entity)
@@ -52,4 +82,6 @@ public:
 	contactCallback callback;
 	collisionStarted startCallback;
 	collisionEnded endCallback;
+	ContactEventQueue* queue;
+	ContactFilter* filter;
 };
\ No newline at end of file
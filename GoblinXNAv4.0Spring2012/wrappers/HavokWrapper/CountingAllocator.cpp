@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdlib.h>
+#include <windows.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/Memory/Allocator/hkMemoryAllocator.h>
+
+// Passes the requests of the Havok memory system on to another allocator, counting the bytes
+// in use, their peak and the number of allocations and frees. Everything the memory system
+// gets from the operating system goes through here, and the memory system may call it from
+// any thread.
+class CountingAllocator : public hkMemoryAllocator
+{
+public:
+
+	CountingAllocator()
+	{
+		base = HK_NULL;
+		inUse = 0;
+		peakInUse = 0;
+		numAllocations = 0;
+		numFrees = 0;
+	}
+
+	// The counters are kept across calls, since a memory system that was not shut down may
+	// still free what it allocated earlier
+	void init(hkMemoryAllocator* _base)
+	{
+		base = _base;
+	}
+
+	virtual void* blockAlloc( int numBytes )
+	{
+		void* p = base->blockAlloc(numBytes);
+		if(p != HK_NULL)
+		{
+			LONG used = InterlockedExchangeAdd(&inUse, numBytes) + numBytes;
+			LONG peak = peakInUse;
+			while(used > peak && InterlockedCompareExchange(&peakInUse, used, peak) != peak)
+				peak = peakInUse;
+
+			InterlockedIncrement(&numAllocations);
+		}
+
+		return p;
+	}
+
+	virtual void blockFree( void* p, int numBytes )
+	{
+		if(p == HK_NULL)
+			return;
+
+		base->blockFree(p, numBytes);
+
+		InterlockedExchangeAdd(&inUse, -numBytes);
+		InterlockedIncrement(&numFrees);
+	}
+
+	virtual void getMemoryStatistics( MemoryStatistics& u )
+	{
+		base->getMemoryStatistics(u);
+	}
+
+	virtual int getAllocatedSize( const void* obj, int numBytes )
+	{
+		return base->getAllocatedSize(obj, numBytes);
+	}
+
+	int getInUse() const
+	{
+		return inUse;
+	}
+
+	int getPeakInUse() const
+	{
+		return peakInUse;
+	}
+
+	int getNumAllocations() const
+	{
+		return numAllocations;
+	}
+
+	int getNumFrees() const
+	{
+		return numFrees;
+	}
+
+private:
+
+	hkMemoryAllocator* base;
+
+	volatile LONG inUse;
+	volatile LONG peakInUse;
+	volatile LONG numAllocations;
+	volatile LONG numFrees;
+};
\ No newline at end of file
@@ -9,6 +9,10 @@
 #include <Common/Base/Memory/System/hkMemorySystem.h>
 #include <Common/Base/Memory/Allocator/hkMemoryAllocator.h>
 #include <Common/Base/Memory/Allocator/Malloc/hkMallocAllocator.h>
+#include <Common/Base/System/Hardware/hkHardwareInfo.h>
+#include <Common/Base/Thread/Job/ThreadPool/Cpu/hkCpuJobThreadPool.h>
+#include <Common/Base/Thread/JobQueue/hkJobQueue.h>
+#include <Common/Base/Thread/CriticalSection/hkCriticalSection.h>
 
 #include <Common/Internal/ConvexHull/hkGeometryUtility.h>
 #include <Common/Internal/ConvexHull/hkPlaneEquationUtil.h>
@@ -23,13 +27,16 @@
 #include <Physics/Collide/Shape/Convex/Capsule/hkpCapsuleShape.h>
 #include <Physics/Collide/Shape/Convex/ConvexVertices/hkpConvexVerticesShape.h>
 #include <Physics/Collide/Shape/Compound/Tree/Mopp/hkpMoppBvTreeShape.h>
+#include <Physics/Collide/Shape/Compound/Tree/Mopp/hkpMoppUtility.h>
 #include <Physics/Collide/Shape/Convex/ConvexVertices/hkpConvexVerticesConnectivity.h>
 #include <Physics/Collide/Shape/Convex/ConvexVertices/hkpConvexVerticesConnectivityUtil.h>
 #include <Physics/Collide/Shape/Compound/Collection/ExtendedMeshShape/hkpExtendedMeshShape.h>
+#include <Physics/Collide/Shape/Compound/Collection/StorageExtendedMesh/hkpStorageExtendedMeshShape.h>
 #include <Physics/Collide/Shape/Compound/Collection/List/hkpListShape.h>
 #include <Physics/Collide/Shape/Misc/Bv/hkpBvShape.h>
 
 #include <Physics/Collide/Dispatch/hkpAgentRegisterUtil.h>
+#include <Physics/Collide/Query/Multithreaded/RayCastQuery/hkpRayCastQueryJobQueueUtils.h>
 #include <Physics/Utilities/Dynamics/Inertia/hkpInertiaTensorComputer.h>
 #include <Physics/Utilities/Actions/MouseSpring/hkpMouseSpringAction.h>
 #include <Physics/Utilities/Constraint/Keyframe/hkpKeyFrameUtility.h>
@@ -43,8 +50,111 @@
 #include "ContactListener.cpp"
 #include "BroadphaseBorder.cpp"
 #include "PhantomCallback.cpp"
+#include "BodySlotMap.cpp"
+#include "BodyPool.cpp"
+#include "TransformBuffer.cpp"
+#include "CommandBuffer.cpp"
+#include "StepThread.cpp"
+#include "ShapeCache.cpp"
+#include "ShapeRegistry.cpp"
+#include "WorldQuery.cpp"
+#include "StepProfiler.cpp"
+#include "CountingAllocator.cpp"
+#include "WorldState.cpp"
+#include "TraceRecorder.cpp"
+#include "ToiBudget.cpp"
+#include "SimulationLod.cpp"
+
+enum AllocatorType
+{
+	ALLOCATOR_FREE_LIST = 0,
+	ALLOCATOR_POOLED = 1
+};
+
+// Memory system options applied by the next initWorld, see set_memory_options
+int solverBufferSize = 0;
+int threadStackSize = 0;
+AllocatorType allocatorType = ALLOCATOR_FREE_LIST;
+
+// Continuous collision options applied by the next initWorld, see set_toi_options. Values of
+// 0 keep the Havok defaults.
+int toiEventQueueSize = 0;
+float toisTillAllowedPenetration[] = { 0, 0, 0, 0 };
+
+// The memory system keeps allocating from its base allocator until it quits, so both live here
+// rather than on the stack of initWorld
+hkMallocAllocator mallocBase;
+CountingAllocator systemAllocator;
+
+struct MemoryStats
+{
+	hkInt64 systemInUse;
+	hkInt64 systemPeakInUse;
+	hkInt64 heapAllocated;
+	hkInt64 heapInUse;
+	hkInt64 heapPeakInUse;
+	int systemAllocations;
+	int systemFrees;
+	int solverBufferSize;
+	int allocator;
+};
 
 hkpWorld* world;
+hkJobThreadPool* threadPool;
+hkJobQueue* jobQueue;
+BodySlotMap bodies;
+BodyPool bodyPools;
+TransformBuffer transformBuffer;
+
+// Mutations requested while the world is being stepped are queued here and applied once the
+// step is over. Collision callbacks may record from the stepping threads, hence the lock. A
+// flush swaps the queue into runningCommands first, so that commands recorded by the callbacks
+// it fires are queued for the next pass instead of changing the buffer being applied.
+CommandBuffer pendingCommands;
+CommandBuffer runningCommands;
+hkCriticalSection commandLock;
+volatile bool stepInProgress;
+bool flushing;
+
+StepThread stepThread;
+
+// Baked convex hulls and MOPP codes, kept across worlds
+ShapeCache shapeCache;
+
+// Shapes shared between bodies created with the same parameters
+ShapeRegistry shapeRegistry;
+
+WorldQuery worldQuery;
+
+// Bodies touched by the last load_world_state, kept to avoid allocating on every load
+hkArray<hkpRigidBody*> restoredBodies;
+
+// Contact events recorded by the listeners during a step, drained by get_contact_events
+ContactEventQueue contactEvents;
+
+// Phantom enter and leave events recorded during a step, drained by get_phantom_events
+PhantomEventQueue phantomEvents;
+
+// Step count and simulated time used by the contact filters
+ContactClock contactClock;
+
+// Per step timings and counters, recorded while profiling is enabled
+StepProfiler stepProfiler;
+
+// Writes the calls that change the simulation to a trace while recording, see start_recording
+TraceRecorder recorder;
+
+// TOI counts per step and the discrete fallback of the budgeted bodies
+ToiBudget toiBudget;
+
+// The group filter installed by install_group_filter, owned by the world
+hkpGroupFilter* groupFilter;
+
+// Deactivates, freezes or slows down the bodies far from the focus point, see set_lod_bands
+SimulationLod simulationLod;
+
+// The time passed to advance that did not make up a whole step yet
+float stepAccumulator;
 
 static void HK_CALL errorReportFunction(const char* str, void*)
 {
@@ -60,380 +170,2074 @@ static bool allZero(float vals[], int count)
 	return true;
 }
 
+// Creates the job queue and the worker threads used by hkpWorld::stepMultithreaded. A negative
+// worker count uses one worker for every hardware thread besides the calling one.
+static void initThreads(int numWorkerThreads)
+{
+	if(numWorkerThreads < 0)
+	{
+		hkHardwareInfo hwInfo;
+		hkGetHardwareInfo(hwInfo);
+		numWorkerThreads = hwInfo.m_numThreads - 1;
+	}
+
+	hkCpuJobThreadPoolCinfo threadPoolCinfo;
+	threadPoolCinfo.m_numThreads = numWorkerThreads;
+	if(threadStackSize > 0)
+		threadPoolCinfo.m_havokStackSize = threadStackSize;
+	threadPoolCinfo.m_timerBufferPerThreadAllocation =
+		stepProfiler.isEnabled() ? StepProfiler::MONITOR_BUFFER_SIZE : 0;
+	threadPool = new hkCpuJobThreadPool(threadPoolCinfo);
+
+	hkJobQueueCinfo queueInfo;
+	queueInfo.m_jobQueueHwSetup.m_numCpuThreads = numWorkerThreads + 1;
+	jobQueue = new hkJobQueue(queueInfo);
+}
+
+static void quitThreads()
+{
+	if(threadPool != HK_NULL)
+	{
+		threadPool->removeReference();
+		threadPool = HK_NULL;
+	}
+
+	if(jobQueue != HK_NULL)
+	{
+		delete jobQueue;
+		jobQueue = HK_NULL;
+	}
+}
+
+static bool initWorld(float gravity[], float worldSize, float collisionTolerance,
+	hkpWorldCinfo::SimulationType simType, hkpWorldCinfo::SolverType solverType, bool fireCollisionCallbacks,
+	bool enableDeactivation, float contactRestingVelocity, int numWorkerThreads)
+{
+	systemAllocator.init(&mallocBase);
+	hkMemorySystem::FrameInfo frameInfo(solverBufferSize);
+
+	hkMemoryRouter* memoryRouter;
+
+	// The pooled arena takes large blocks from the system and carves the free lists out of them
+	if(allocatorType == ALLOCATOR_POOLED)
+		memoryRouter = hkMemoryInitUtil::initFreeListLargeBlock(&systemAllocator, frameInfo);
+	else
+		memoryRouter = hkMemoryInitUtil::initFreeList(&systemAllocator, frameInfo);
+	extAllocator::initDefault();
+
+	if (memoryRouter == HK_NULL)
+	{
+		return false;
+	}
+
+	if ( hkBaseSystem::init( memoryRouter, errorReportFunction ) != HK_SUCCESS)
+	{
+		return false;
+	}
+
+	hkpWorldCinfo info;
+	info.m_simulationType = simType;
+	info.m_collisionTolerance = collisionTolerance;
+	info.m_gravity = hkVector4(gravity[0], gravity[1], gravity[2]);
+	info.setBroadPhaseWorldSize(worldSize);
+	info.setupSolverInfo(solverType);
+	info.m_fireCollisionCallbacks = fireCollisionCallbacks;
+	info.m_enableDeactivation = enableDeactivation;
+	info.m_contactRestingVelocity = contactRestingVelocity;
+
+	if(toiEventQueueSize > 0)
+		info.m_sizeOfToiEventQueue = toiEventQueueSize;
+	if(toisTillAllowedPenetration[0] > 0)
+		info.m_numToisTillAllowedPenetrationSimplifiedToi = toisTillAllowedPenetration[0];
+	if(toisTillAllowedPenetration[1] > 0)
+		info.m_numToisTillAllowedPenetrationToi = toisTillAllowedPenetration[1];
+	if(toisTillAllowedPenetration[2] > 0)
+		info.m_numToisTillAllowedPenetrationToiHigher = toisTillAllowedPenetration[2];
+	if(toisTillAllowedPenetration[3] > 0)
+		info.m_numToisTillAllowedPenetrationToiForced = toisTillAllowedPenetration[3];
+
+	world = new hkpWorld(info);
+
+	world->lock();
+
+	hkpAgentRegisterUtil::registerAllAgents(world->getCollisionDispatcher());
+	toiBudget.attach(world);
+	transformBuffer.attach(world, &bodies);
+
+	if(simType == hkpWorldCinfo::SIMULATION_TYPE_MULTITHREADED)
+	{
+		initThreads(numWorkerThreads);
+		world->registerWithJobQueue(jobQueue);
+		hkpRayCastQueryJobQueueUtils::registerWithJobQueue(jobQueue);
+	}
+
+	world->unlock();
+
+	return true;
+}
+
+static hkpRigidBody* createRigidBody(hkpShape* shape, float mass, hkpMotion::MotionType motionType, 
+	hkpCollidableQualityType collideQuality, float pos[], float rot[], float linearVelocity[], float linearDamping, 
+	float maxLinearVelocity, float angularVelocity[], float angularDamping, float maxAngularVelocity, float friction, 
+	float restitution, float allowedPenetrationDepth, bool neverDeactivate, float gravityFactor, 
+	int collisionFilterInfo)
+{
+	hkpRigidBodyCinfo bodyInfo;
+	
+	bodyInfo.m_shape = shape;
+	bodyInfo.m_motionType = motionType;
+	bodyInfo.m_position.set(pos[0], pos[1], pos[2]);
+	bodyInfo.m_rotation.set(rot[0], rot[1], rot[2], rot[3]);
+
+	if(friction >= 0)
+		bodyInfo.m_friction = friction;
+	if(restitution >= 0)
+		bodyInfo.m_restitution = restitution;
+	if(allowedPenetrationDepth >= 0)
+		bodyInfo.m_allowedPenetrationDepth = allowedPenetrationDepth;
+	if(collideQuality >= 0)
+		bodyInfo.m_qualityType = collideQuality;
+	bodyInfo.m_gravityFactor = gravityFactor;
+	bodyInfo.m_collisionFilterInfo = collisionFilterInfo;
+
+	if(!(motionType == hkpMotion::MOTION_FIXED || motionType == hkpMotion::MOTION_KEYFRAMED))
+	{
+		hkpMassProperties massProperties;
+		hkpInertiaTensorComputer::computeShapeVolumeMassProperties(shape, mass, massProperties);
+
+		bodyInfo.m_mass = massProperties.m_mass;
+		bodyInfo.m_centerOfMass = massProperties.m_centerOfMass;
+		bodyInfo.m_inertiaTensor = massProperties.m_inertiaTensor;
+
+		if(!allZero(linearVelocity, 3))
+			bodyInfo.m_linearVelocity.set(linearVelocity[0], linearVelocity[1], linearVelocity[2]);
+		if(linearDamping >= 0)
+			bodyInfo.m_linearDamping = linearDamping;
+		if(!allZero(angularVelocity, 3))
+			bodyInfo.m_angularVelocity.set(angularVelocity[0], angularVelocity[1], angularVelocity[2]);
+		if(angularDamping >= 0)
+			bodyInfo.m_angularDamping = angularDamping;
+		if(maxLinearVelocity >= 0)
+			bodyInfo.m_maxLinearVelocity = maxLinearVelocity;
+		if(maxAngularVelocity >= 0)
+			bodyInfo.m_maxAngularVelocity = maxAngularVelocity;
+
+		bodyInfo.m_enableDeactivation = !neverDeactivate;
+	}
+
+	hkpRigidBody* body = new hkpRigidBody(bodyInfo);
+	shape->removeReference();
+
+	return body;
+}
+
+static void stepWorld(float elapsedSeconds)
+{
+	stepInProgress = true;
+
+	contactClock.advance(elapsedSeconds);
+
+	if(stepProfiler.isEnabled())
+		stepProfiler.beginStep(world, threadPool);
+
+	if(simulationLod.isActive())
+	{
+		world->lock();
+		simulationLod.update(world, bodies, contactClock.getStep());
+		world->unlock();
+	}
+
+	hkCheckDeterminismUtil::workerThreadStartFrame(true);
+
+	if(jobQueue != HK_NULL)
+		world->stepMultithreaded(jobQueue, threadPool, elapsedSeconds);
+	else
+		world->stepDeltaTime(elapsedSeconds);
+
+	hkCheckDeterminismUtil::workerThreadFinishFrame();
+
+	toiBudget.endStep();
+
+	if(stepProfiler.isEnabled())
+		stepProfiler.endStep(threadPool);
+
+	stepInProgress = false;
+
+	transformBuffer.invalidate();
+}
+
+// Returns a filter for a contact listener, or null if the options let every event through
+static ContactFilter* createContactFilter(float minSpeed, float cooldown, bool oncePerStep)
+{
+	if(ContactFilter::isPassThrough(minSpeed, cooldown, oncePerStep))
+		return HK_NULL;
+
+	return new ContactFilter(&contactClock, minSpeed, cooldown, oncePerStep);
+}
+
+// Runs on the step thread between begin_step and end_step
+static void asyncStep(float elapsedSeconds, int numSteps)
+{
+	for(int i = 0; i < numSteps; i++)
+		stepWorld(elapsedSeconds);
+
+	transformBuffer.fill(world);
+}
+
+// Applies a single command record other than adding or removing a body. The caller must
+// hold the world lock.
+static void executeCommand(const CommandBuffer::Word* record)
+{
+	int opcode = record[0].i;
+	int handle = record[1].i;
+	const float* data = &record[CommandBuffer::HEADER_SIZE].f;
+
+	if(opcode == CommandBuffer::CMD_SET_GRAVITY)
+	{
+		world->setGravity(hkVector4(data[0], data[1], data[2]));
+		return;
+	}
+
+	hkpRigidBody* body = bodies.get(handle);
+	if(body == HK_NULL)
+		return;
+
+	switch(opcode)
+	{
+	case CommandBuffer::CMD_ADD_FORCE:
+		body->applyForce(data[0], hkVector4(data[1], data[2], data[3]));
+		break;
+	case CommandBuffer::CMD_ADD_TORQUE:
+		body->applyTorque(data[0], hkVector4(data[1], data[2], data[3]));
+		break;
+	case CommandBuffer::CMD_SET_LINEAR_VELOCITY:
+		body->setLinearVelocity(hkVector4(data[0], data[1], data[2]));
+		break;
+	case CommandBuffer::CMD_SET_ANGULAR_VELOCITY:
+		body->setAngularVelocity(hkVector4(data[0], data[1], data[2]));
+		break;
+	case CommandBuffer::CMD_SET_SCALE:
+		transformBuffer.setScale(handle, data[0], data[1], data[2]);
+		break;
+	case CommandBuffer::CMD_APPLY_HARD_KEYFRAME:
+		{
+			hkVector4 pos(data[0], data[1], data[2]);
+			hkQuaternion rot(data[3], data[4], data[5], data[6]);
+			hkpKeyFrameUtility::applyHardKeyFrame(pos, rot, 1.0f / data[7], body);
+		}
+		break;
+	case CommandBuffer::CMD_APPLY_SOFT_KEYFRAME:
+		{
+			hkpKeyFrameUtility::KeyFrameInfo keyInfo;
+			hkpKeyFrameUtility::AccelerationInfo accelInfo;
+
+			keyInfo.m_position = hkVector4(data[0], data[1], data[2]);
+			keyInfo.m_orientation = hkQuaternion(data[3], data[4], data[5], data[6]);
+			keyInfo.m_linearVelocity = hkVector4();
+			keyInfo.m_angularVelocity = hkVector4();
+
+			accelInfo.m_angularPositionFactor = hkVector4(data[7], data[8], data[9]);
+			accelInfo.m_angularVelocityFactor = hkVector4(data[10], data[11], data[12]);
+			accelInfo.m_linearPositionFactor = hkVector4(data[13], data[14], data[15]);
+			accelInfo.m_linearVelocityFactor = hkVector4(data[16], data[17], data[18]);
+			accelInfo.m_maxAngularAcceleration = data[19];
+			accelInfo.m_maxLinearAcceleration = data[20];
+			accelInfo.m_maxAllowedDistance = data[21];
+
+			float timeStep = data[22];
+			hkpKeyFrameUtility::applySoftKeyFrame(keyInfo, accelInfo, timeStep, 1 / timeStep, body);
+		}
+		break;
+	}
+}
+
+// Applies a packed stream of command records. All added and spawned bodies go into the world
+// with one addEntityBatch before the other records are applied in order, and all removed and
+// parked bodies leave it with one removeEntityBatch afterwards. The caller must hold the world
+// lock.
+static void executeCommands(const CommandBuffer::Word* words, int numWords)
+{
+	const CommandBuffer::Word* end = words + numWords;
+	const CommandBuffer::Word* record;
+	hkInplaceArray<hkpEntity*,64> batchedEntities;
+
+	for(record = words; record < end; record += CommandBuffer::HEADER_SIZE + CommandBuffer::getPayloadSize(record[0].i))
+	{
+		if(record[0].i != CommandBuffer::CMD_ADD_BODY && record[0].i != CommandBuffer::CMD_SPAWN_BODY)
+			continue;
+
+		hkpRigidBody* body = bodies.get(record[1].i);
+		if(body == HK_NULL)
+			continue;
+
+		if(record[0].i == CommandBuffer::CMD_SPAWN_BODY)
+		{
+			const float* data = &record[CommandBuffer::HEADER_SIZE].f;
+			body->setPositionAndRotation(hkVector4(data[0], data[1], data[2]), 
+				hkQuaternion(data[3], data[4], data[5], data[6]));
+			body->setLinearVelocity(hkVector4(data[7], data[8], data[9]));
+			body->setAngularVelocity(hkVector4(data[10], data[11], data[12]));
+
+			// The pool keeps its own reference, so balance the one released below
+			body->addReference();
+		}
+
+		batchedEntities.pushBack(body);
+	}
+
+	if(batchedEntities.getSize() > 0)
+	{
+		world->addEntityBatch(batchedEntities.begin(), batchedEntities.getSize());
+		for(int i = 0; i < batchedEntities.getSize(); i++)
+			batchedEntities[i]->removeReference();
+		batchedEntities.clear();
+	}
+
+	for(record = words; record < end; record += CommandBuffer::HEADER_SIZE + CommandBuffer::getPayloadSize(record[0].i))
+	{
+		if(record[0].i == CommandBuffer::CMD_REMOVE_BODY)
+		{
+			// Stale handles are ignored, even if their slot now holds a pooled body
+			hkpRigidBody* body = bodies.get(record[1].i);
+			if(body == HK_NULL)
+				continue;
+
+			simulationLod.release(body);
+
+			// A pooled body is parked instead, and stays alive with its handle
+			if(bodyPools.getPoolId(record[1].i) != BodyPool::NOT_POOLED)
+				body = bodyPools.park(record[1].i) ? body : HK_NULL;
+			else
+				body = bodies.remove(record[1].i);
+
+			if(body != HK_NULL)
+				batchedEntities.pushBack(body);
+		}
+		else if(record[0].i != CommandBuffer::CMD_ADD_BODY && record[0].i != CommandBuffer::CMD_SPAWN_BODY && 
+			record[0].i != CommandBuffer::CMD_APPLY_EXPLOSION)
+			executeCommand(record);
+	}
+
+	if(batchedEntities.getSize() > 0)
+	{
+		world->removeEntityBatch(batchedEntities.begin(), batchedEntities.getSize());
+		batchedEntities.clear();
+	}
+}
+
+// Returns the number of leading words of a submitted batch that form complete, valid records
+static int validateCommands(const CommandBuffer::Word* words, int numWords)
+{
+	int i = 0;
+	while(i < numWords)
+	{
+		int payloadSize = CommandBuffer::getPayloadSize(words[i].i);
+		if(payloadSize < 0 || i + CommandBuffer::HEADER_SIZE + payloadSize > numWords)
+			break;
+
+		i += CommandBuffer::HEADER_SIZE + payloadSize;
+	}
+
+	return i;
+}
+
+// Removes the spawned bodies of a pool from the world and drops the pool's references to all
+// of its bodies. The caller must hold the world lock.
+static void destroyBodyPool(int pool)
+{
+	const hkArray<int>& handles = bodyPools.getHandles(pool);
+	for(int i = 0; i < handles.getSize(); i++)
+	{
+		simulationLod.release(bodies.get(handles[i]));
+
+		hkpRigidBody* body = bodies.remove(handles[i]);
+		if(body->getWorld() != HK_NULL)
+			world->removeEntity(body);
+		body->removeReference();
+	}
+
+	bodyPools.removePool(pool);
+}
+
+// Applies the explosions among a stream of command records. The caller must not hold the world
+// lock, since explode takes it itself and may hand occlusion rays to the worker threads.
+static void executeExplosions(const CommandBuffer::Word* words, int numWords)
+{
+	const CommandBuffer::Word* end = words + numWords;
+	for(const CommandBuffer::Word* record = words; record < end; 
+		record += CommandBuffer::HEADER_SIZE + CommandBuffer::getPayloadSize(record[0].i))
+	{
+		if(record[0].i != CommandBuffer::CMD_APPLY_EXPLOSION)
+			continue;
+
+		const CommandBuffer::Word* data = &record[CommandBuffer::HEADER_SIZE];
+		float center[] = { data[0].f, data[1].f, data[2].f };
+		worldQuery.explode(world, jobQueue, threadPool, center, data[3].f, data[4].f, data[5].f, 
+			(hkUint32)data[6].i, data[7].i != 0, HK_NULL, 0);
+	}
+}
+
+// Whether the caller runs inside a step, e.g., in a collision callback, where the world must
+// not be changed structurally and the job queue is busy with the step
+static bool isInsideStep()
+{
+	return stepInProgress || (stepThread.isStepping() && !stepThread.isOwnerThread());
+}
+
+// Applies the queued commands until the queue stays empty. Adding and removing bodies fires
+// collision callbacks, which may queue more commands; a flush reached from such a callback
+// returns at once and leaves them to the running one. Nothing is applied inside a step.
+static void flushCommands()
+{
+	commandLock.enter();
+
+	if(!flushing && !stepInProgress)
+	{
+		flushing = true;
+
+		while(!pendingCommands.isEmpty())
+		{
+			pendingCommands.swap(runningCommands);
+
+			world->lock();
+			executeCommands(runningCommands.begin(), runningCommands.getSize());
+			world->unlock();
+
+			executeExplosions(runningCommands.begin(), runningCommands.getSize());
+
+			runningCommands.clear();
+		}
+
+		flushing = false;
+	}
+
+	commandLock.leave();
+}
+
+// Applies a mutation right away, or queues it if the world is being stepped or the commands
+// queued before it are being applied
+static void submitCommand(int opcode, int handle, const float* payload)
+{
+	commandLock.enter();
+	pendingCommands.write(opcode, handle, payload);
+	commandLock.leave();
+
+	if(!stepInProgress && !stepThread.isStepping())
+		flushCommands();
+}
+
+// Waits for an asynchronous step, publishes its transforms and applies the queued commands
+static void finishStep()
+{
+	if(!stepThread.isStepping())
+		return;
+
+	stepThread.endStep();
+	transformBuffer.swap();
+	flushCommands();
+}
+
+// Called before anything that reads or structurally changes the world. Only the thread that
+// started an asynchronous step waits for it; callbacks on the stepping threads read directly.
+static void ensureStepFinished()
+{
+	if(stepThread.isStepping() && stepThread.isOwnerThread())
+		finishStep();
+}
+
+// Builds the convex hull of the vertices, or takes it from the shape cache if it is open
+static hkpConvexVerticesShape* createConvexShape(int numVertices, float vertices[], int stride, float convexRadius)
+{
+	hkStridedVertices stridedVerts;
+
+	hkUint64 key = 0;
+	if(shapeCache.isOpen())
+	{
+		key = ShapeCache::hashConvex(numVertices, vertices, stride);
+
+		int numHullVertices, numPlanes;
+		const hkVector4* hullVertices;
+		const hkVector4* planes;
+		if(shapeCache.findConvex(key, numHullVertices, hullVertices, numPlanes, planes))
+		{
+			stridedVerts.m_numVertices = numHullVertices;
+			stridedVerts.m_striding = sizeof(hkVector4);
+			stridedVerts.m_vertices = reinterpret_cast<const hkReal*>(hullVertices);
+
+			// Uses the mapped plane equations in place
+			hkArray<hkVector4> planeEquations(const_cast<hkVector4*>(planes), numPlanes, numPlanes);
+
+			return new hkpConvexVerticesShape(stridedVerts, planeEquations, convexRadius);
+		}
+	}
+
+	stridedVerts.m_numVertices = numVertices;
+	stridedVerts.m_striding = stride;
+	stridedVerts.m_vertices = vertices;
+
+	hkGeometry geometry;
+	hkInplaceArrayAligned16<hkVector4,32> transformedPlanes;
+
+	hkGeometryUtility::createConvexGeometry(stridedVerts, geometry, transformedPlanes);
+
+	if(shapeCache.isOpen())
+		shapeCache.addConvex(key, geometry.m_vertices, transformedPlanes);
+
+	stridedVerts.m_numVertices = geometry.m_vertices.getSize();
+	stridedVerts.m_striding = sizeof(hkVector4);
+	stridedVerts.m_vertices = &(geometry.m_vertices[0](0));
+
+	return new hkpConvexVerticesShape(stridedVerts, transformedPlanes, convexRadius);
+}
+
+// Records the creation of a shape whose arguments are all floats
+static void recordShape(TraceRecorder::Call call, const float* params, int count, const hkpShape* shape)
+{
+	if(!recorder.begin(call))
+		return;
+
+	recorder.writeFloats(params, count);
+	recorder.writePointer(shape);
+	recorder.end();
+}
+
+// Records a call that takes a body handle followed by floats
+static void recordBodyCall(TraceRecorder::Call call, int handle, const float* params, int count)
+{
+	if(!recorder.begin(call))
+		return;
+
+	recorder.writeInt(handle);
+	recorder.writeFloats(params, count);
+	recorder.end();
+}
+
+// Queues the same command for count bodies under a single lock, taking the payload of the i-th
+// body from payloads[i * payloadSize], and records each of them as call
+static void submitCommands(int opcode, TraceRecorder::Call call, int count, const int handles[], 
+	const float* payloads, int payloadSize)
+{
+	for(int i = 0; i < count; i++)
+		recordBodyCall(call, handles[i], payloads + i * payloadSize, payloadSize);
+
+	commandLock.enter();
+	for(int i = 0; i < count; i++)
+		pendingCommands.write(opcode, handles[i], payloads + i * payloadSize);
+	commandLock.leave();
+
+	if(!stepInProgress && !stepThread.isStepping())
+		flushCommands();
+}
+
+// Hashes the positions and rotations of the bodies in the world in slot order, so that a
+// replay can tell whether it ended up where the recording did
+static hkUint64 hashTransforms(int& count)
+{
+	hkUint64 h = ShapeCache::HASH_SEED;
+	count = 0;
+
+	world->lock();
+	for(int i = 0; i < bodies.getCapacity(); i++)
+	{
+		hkpRigidBody* body = bodies.getAt(i);
+		if(body == HK_NULL || body->getWorld() == HK_NULL)
+			continue;
+
+		const hkVector4& position = body->getPosition();
+		const hkVector4& rotation = body->getRotation().m_vec;
+		float transform[] = { position(0), position(1), position(2), 
+			rotation(0), rotation(1), rotation(2), rotation(3) };
+		h = ShapeCache::hash(h, transform, sizeof(transform));
+		count++;
+	}
+	world->unlock();
+
+	return h;
+}
+
+// Records the outcome of a step for the replay to compare against
+static void recordCheck()
+{
+	if(!recorder.isRecording())
+		return;
+
+	int count;
+	hkUint64 h = hashTransforms(count);
+	if(recorder.begin(TraceRecorder::CALL_CHECK))
+	{
+		recorder.writeInt(count);
+		recorder.writeUint64(h);
+		recorder.end();
+	}
+}
+
+// Rewrites the body handles of a recorded command batch to those of the replay. The shape
+// word of a CMD_CREATE_BODY record becomes the index of the record, as the replay passes one
+// shape per created body.
+static void remapCommands(CommandBuffer::Word* words, int numWords, const TraceMap& map)
+{
+	int numCreated = 0;
+	int i = 0;
+	while(i < numWords)
+	{
+		CommandBuffer::Word* record = &words[i];
+		i += CommandBuffer::HEADER_SIZE + CommandBuffer::getPayloadSize(record[0].i);
+
+		if(record[0].i == CommandBuffer::CMD_CREATE_BODY)
+			record[1].i = numCreated++;
+		else if(record[0].i != CommandBuffer::CMD_SET_GRAVITY)
+			record[1].i = map.getHandle(record[1].i);
+	}
+}
+
+// Copies a recorded snapshot, rewriting its body handles to those of the replay
+static const char* remapSnapshot(const char* data, int size, const TraceMap& map, hkArray<char>& copy)
+{
+	if(data == HK_NULL || size < (int)sizeof(WorldState::Header))
+		return data;
+
+	copy.setSize(size);
+	memcpy(copy.begin(), data, size);
+
+	WorldState::Header* header = reinterpret_cast<WorldState::Header*>(copy.begin());
+	WorldState::Record* records = reinterpret_cast<WorldState::Record*>(header + 1);
+	int numRecords = (size - (int)sizeof(WorldState::Header)) / (int)sizeof(WorldState::Record);
+	for(int i = 0; i < hkMath::min2(header->numRecords, numRecords); i++)
+		records[i].handle = map.getHandle(records[i].handle);
+
+	return copy.begin();
+}
+
+static void HK_CALL ignoreWorldLeave(hkpRigidBody*)
+{
+}
+
 extern "C"
 {
+	// Starts writing the calls that change the simulation to a trace file that replay_trace can
+	// run again. Callbacks are not recorded, but the calls they make are. Must be called before
+	// init_world so that the trace holds the whole session.
+	__declspec(dllexport) bool start_recording(const char* path)
+	{
+		if(world != HK_NULL)
+			return false;
+
+		return recorder.start(path);
+	}
+
+	__declspec(dllexport) void stop_recording()
+	{
+		recorder.stop();
+	}
+
+	// Sets up the continuous collision handling of the world created by the next init_world or
+	// init_world_mt. The TOI event queue holds the TOI events of a step, and further events
+	// are dropped. The other values are the number of TOIs a body pair of the given collision
+	// quality level may have in a step before it is allowed to penetrate. Values of 0 or less
+	// keep the Havok defaults.
+	__declspec(dllexport) void set_toi_options(int eventQueueSize, float simplifiedToi, float toi, 
+		float toiHigher, float toiForced)
+	{
+		if(recorder.begin(TraceRecorder::CALL_SET_TOI_OPTIONS))
+		{
+			recorder.writeInt(eventQueueSize);
+			recorder.writeFloat(simplifiedToi);
+			recorder.writeFloat(toi);
+			recorder.writeFloat(toiHigher);
+			recorder.writeFloat(toiForced);
+			recorder.end();
+		}
+
+		toiEventQueueSize = eventQueueSize;
+		toisTillAllowedPenetration[0] = simplifiedToi;
+		toisTillAllowedPenetration[1] = toi;
+		toisTillAllowedPenetration[2] = toiHigher;
+		toisTillAllowedPenetration[3] = toiForced;
+	}
+
+	// Sets up the memory system created by the next init_world or init_world_mt. A solver
+	// buffer of 0 makes the solver allocate from the heap as it goes, and a stack size of 0 keeps
+	// the default Havok stack of the worker threads.
+	__declspec(dllexport) void set_memory_options(int solverBuffer, int threadStack, AllocatorType allocator)
+	{
+		if(recorder.begin(TraceRecorder::CALL_SET_MEMORY_OPTIONS))
+		{
+			recorder.writeInt(solverBuffer);
+			recorder.writeInt(threadStack);
+			recorder.writeInt(allocator);
+			recorder.end();
+		}
+
+		solverBufferSize = hkMath::max2(solverBuffer, 0);
+		threadStackSize = hkMath::max2(threadStack, 0);
+		allocatorType = allocator;
+	}
+
+	// Reports the memory the memory system got from the system and the use of the heap built
+	// on top of it
+	__declspec(dllexport) void get_memory_stats(MemoryStats& stats)
+	{
+		stats.systemInUse = systemAllocator.getInUse();
+		stats.systemPeakInUse = systemAllocator.getPeakInUse();
+		stats.systemAllocations = systemAllocator.getNumAllocations();
+		stats.systemFrees = systemAllocator.getNumFrees();
+
+		hkMemoryAllocator::MemoryStatistics heapStats;
+		hkMemorySystem::getInstance().getHeapStatistics(heapStats);
+		stats.heapAllocated = heapStats.m_allocated;
+		stats.heapInUse = heapStats.m_inUse;
+		stats.heapPeakInUse = heapStats.m_peakInUse;
+
+		stats.solverBufferSize = solverBufferSize;
+		stats.allocator = allocatorType;
+	}
+
 	__declspec(dllexport) bool init_world(float gravity[], float worldSize, float collisionTolerance,
 		hkpWorldCinfo::SimulationType simType, hkpWorldCinfo::SolverType solverType, bool fireCollisionCallbacks,
 		bool enableDeactivation, float contactRestingVelocity)
 	{
-		hkMallocAllocator mallocBase;
-		hkMemorySystem::FrameInfo frameInfo(0);
+		if(recorder.begin(TraceRecorder::CALL_INIT_WORLD))
+		{
+			recorder.writeFloats(gravity, 3);
+			recorder.writeFloat(worldSize);
+			recorder.writeFloat(collisionTolerance);
+			recorder.writeInt(simType);
+			recorder.writeInt(solverType);
+			recorder.writeInt(fireCollisionCallbacks);
+			recorder.writeInt(enableDeactivation);
+			recorder.writeFloat(contactRestingVelocity);
+			recorder.end();
+		}
+
+		return initWorld(gravity, worldSize, collisionTolerance, simType, solverType, fireCollisionCallbacks,
+			enableDeactivation, contactRestingVelocity, -1);
+	}
+
+	// Initializes a world that is always stepped with hkpWorld::stepMultithreaded using the given
+	// number of worker threads in addition to the calling thread (negative to use all hardware threads)
+	__declspec(dllexport) bool init_world_mt(int numWorkerThreads, float gravity[], float worldSize, 
+		float collisionTolerance, hkpWorldCinfo::SolverType solverType, bool fireCollisionCallbacks,
+		bool enableDeactivation, float contactRestingVelocity)
+	{
+		if(recorder.begin(TraceRecorder::CALL_INIT_WORLD_MT))
+		{
+			recorder.writeInt(numWorkerThreads);
+			recorder.writeFloats(gravity, 3);
+			recorder.writeFloat(worldSize);
+			recorder.writeFloat(collisionTolerance);
+			recorder.writeInt(solverType);
+			recorder.writeInt(fireCollisionCallbacks);
+			recorder.writeInt(enableDeactivation);
+			recorder.writeFloat(contactRestingVelocity);
+			recorder.end();
+		}
+
+		return initWorld(gravity, worldSize, collisionTolerance, hkpWorldCinfo::SIMULATION_TYPE_MULTITHREADED, 
+			solverType, fireCollisionCallbacks, enableDeactivation, contactRestingVelocity, numWorkerThreads);
+	}
+
+	__declspec(dllexport) void set_gravity(float gravity[])
+	{
+		if(world == NULL)
+			return;
+
+		recordBodyCall(TraceRecorder::CALL_SET_GRAVITY, BodySlotMap::INVALID_HANDLE, gravity, 3);
+
+		submitCommand(CommandBuffer::CMD_SET_GRAVITY, BodySlotMap::INVALID_HANDLE, gravity);
+	}
+
+	__declspec(dllexport) void add_world_leave_callback(leaveWorldCallback callback)
+	{
+		if(recorder.begin(TraceRecorder::CALL_ADD_WORLD_LEAVE_CALLBACK))
+			recorder.end();
+
+		ensureStepFinished();
+
+		world->lock();
+
+		BroadphaseBorder* border = new BroadphaseBorder( world, callback );
+		world->setBroadPhaseBorder(border);
+		border->removeReference();
+
+		world->unlock();
+	}
+
+	// The primitive and convex shape creators return a shared shape if one was already created
+	// with the same parameters. Each call hands out its own reference to the shape.
+	__declspec(dllexport) hkpShape* create_box_shape(float dim[], float convexRadius)
+	{
+		float params[] = { dim[0], dim[1], dim[2], convexRadius };
+		hkpShape* shape = shapeRegistry.find(ShapeRegistry::SHAPE_BOX, params, 4);
+		if(shape == HK_NULL)
+		{
+			hkVector4 halfExtent(dim[0] / 2, dim[1] / 2, dim[2] / 2);
+			shape = shapeRegistry.add(ShapeRegistry::SHAPE_BOX, params, 4, new hkpBoxShape(halfExtent, convexRadius));
+		}
+
+		recordShape(TraceRecorder::CALL_CREATE_BOX_SHAPE, params, 4, shape);
+
+		return shape;
+	}
+
+	__declspec(dllexport) hkpShape* create_sphere_shape(float radius)
+	{
+		hkpShape* shape = shapeRegistry.find(ShapeRegistry::SHAPE_SPHERE, &radius, 1);
+		if(shape == HK_NULL)
+			shape = shapeRegistry.add(ShapeRegistry::SHAPE_SPHERE, &radius, 1, new hkpSphereShape(radius));
+
+		recordShape(TraceRecorder::CALL_CREATE_SPHERE_SHAPE, &radius, 1, shape);
+
+		return shape;
+	}
+
+	__declspec(dllexport) hkpShape* create_triangle_shape(float v0[], float v1[], float v2[], float convexRadius)
+	{
+		hkVector4 _v0(v0[0], v0[1], v0[2]);
+		hkVector4 _v1(v1[0], v1[1], v1[2]);
+		hkVector4 _v2(v2[0], v2[1], v2[2]);
+
+		hkpShape* shape = new hkpTriangleShape(_v0, _v1, _v2, convexRadius);
+
+		float params[] = { v0[0], v0[1], v0[2], v1[0], v1[1], v1[2], v2[0], v2[1], v2[2], convexRadius };
+		recordShape(TraceRecorder::CALL_CREATE_TRIANGLE_SHAPE, params, 10, shape);
+
+		return shape;
+	}
+
+	__declspec(dllexport) hkpShape* create_capsule_shape(float top[], float bottom[], float radius)
+	{
+		float params[] = { top[0], top[1], top[2], bottom[0], bottom[1], bottom[2], radius };
+		hkpShape* shape = shapeRegistry.find(ShapeRegistry::SHAPE_CAPSULE, params, 7);
+		if(shape == HK_NULL)
+		{
+			hkVector4 _v0(top[0], top[1], top[2]);
+			hkVector4 _v1(bottom[0], bottom[1], bottom[2]);
+			shape = shapeRegistry.add(ShapeRegistry::SHAPE_CAPSULE, params, 7, new hkpCapsuleShape(_v0, _v1, radius));
+		}
+
+		recordShape(TraceRecorder::CALL_CREATE_CAPSULE_SHAPE, params, 7, shape);
+
+		return shape;
+	}
+
+	__declspec(dllexport) hkpShape* create_cylinder_shape(float top[], float bottom[], float radius, float convexRadius)
+	{
+		float params[] = { top[0], top[1], top[2], bottom[0], bottom[1], bottom[2], radius, convexRadius };
+		hkpShape* shape = shapeRegistry.find(ShapeRegistry::SHAPE_CYLINDER, params, 8);
+		if(shape == HK_NULL)
+		{
+			hkVector4 _v0(top[0], top[1], top[2]);
+			hkVector4 _v1(bottom[0], bottom[1], bottom[2]);
+			shape = shapeRegistry.add(ShapeRegistry::SHAPE_CYLINDER, params, 8, 
+				new hkpCylinderShape(_v0, _v1, radius, convexRadius));
+		}
+
+		recordShape(TraceRecorder::CALL_CREATE_CYLINDER_SHAPE, params, 8, shape);
+
+		return shape;
+	}
+
+	__declspec(dllexport) hkpShape* create_convex_shape(int numVertices, float vertices[], int stride, 
+		float convexRadius)
+	{
+		hkArray<float> params;
+		ShapeRegistry::getConvexParams(numVertices, vertices, stride, convexRadius, params);
+		int numParams = params.getSize();
+
+		hkpShape* shape = shapeRegistry.find(ShapeRegistry::SHAPE_CONVEX, params.begin(), numParams);
+		if(shape == HK_NULL)
+			shape = shapeRegistry.add(ShapeRegistry::SHAPE_CONVEX, params.begin(), numParams, 
+				createConvexShape(numVertices, vertices, stride, convexRadius));
+
+		if(recorder.begin(TraceRecorder::CALL_CREATE_CONVEX_SHAPE))
+		{
+			recorder.writeInt(numVertices);
+			recorder.writeInt(stride);
+			recorder.writeFloat(convexRadius);
+			recorder.writeVertices(vertices, numVertices, stride);
+			recorder.writePointer(shape);
+			recorder.end();
+		}
+
+		return shape;
+	}
+
+	// Creates a static triangle mesh wrapped in a MOPP tree, so collision and raycast queries
+	// against it do not have to visit every triangle. The vertex and index data are copied
+	// into the shape, so the arrays passed in are no longer needed once this returns. If the
+	// shape cache is open, the MOPP code is taken from it instead of being built.
+	__declspec(dllexport) hkpShape* create_mesh_shape(int numVertices, float vertices[], int vertexStride, 
+		int numTriangles, int indices[], float convexRadius)
+	{
+		hkpStorageExtendedMeshShape* mesh = new hkpStorageExtendedMeshShape(convexRadius);
+		{
+			hkpExtendedMeshShape::TrianglesSubpart part;
+
+			part.m_vertexBase = vertices;
+			part.m_vertexStriding = vertexStride;
+			part.m_numVertices = numVertices;
+
+			part.m_indexBase = indices;
+			part.m_indexStriding = sizeof(int) * 3;
+			part.m_numTriangleShapes = numTriangles;
+			part.m_stridingType = hkpExtendedMeshShape::INDICES_INT32;
+
+			mesh->addTrianglesSubpart( part );
+		}
+
+		hkpMoppCode* code = HK_NULL;
+		hkUint64 key = 0;
+		if(shapeCache.isOpen())
+		{
+			key = ShapeCache::hashMesh(numVertices, vertices, vertexStride, numTriangles, indices, convexRadius);
+
+			hkpMoppCode::CodeInfo info;
+			hkpMoppCode::BuildType buildType;
+			const hkUint8* data;
+			int size;
+			if(shapeCache.findMopp(key, info, buildType, data, size))
+				code = new hkpMoppCode(info, data, size, buildType);
+		}
+
+		if(code == HK_NULL)
+		{
+			hkpMoppCompilerInput moppInput;
+			code = hkpMoppUtility::buildCode(mesh->getContainer(), moppInput);
+
+			if(shapeCache.isOpen())
+				shapeCache.addMopp(key, code);
+		}
+
+		hkpMoppBvTreeShape* moppShape = new hkpMoppBvTreeShape(mesh, code);
+		code->removeReference();
+		mesh->removeReference();
+
+		if(recorder.begin(TraceRecorder::CALL_CREATE_MESH_SHAPE))
+		{
+			recorder.writeInt(numVertices);
+			recorder.writeInt(vertexStride);
+			recorder.writeInt(numTriangles);
+			recorder.writeFloat(convexRadius);
+			recorder.writeVertices(vertices, numVertices, vertexStride);
+			recorder.writeBlob(indices, numTriangles * 3 * sizeof(int));
+			recorder.writePointer(moppShape);
+			recorder.end();
+		}
+
+		return moppShape;
+	}
+
+	// Opens the cache that create_convex_shape and create_mesh_shape consult before building a
+	// convex hull or a MOPP code. Shapes built on a miss are written to it by save_shape_cache.
+	__declspec(dllexport) bool open_shape_cache(const char* path)
+	{
+		return shapeCache.open(path);
+	}
+
+	__declspec(dllexport) bool save_shape_cache()
+	{
+		return shapeCache.save();
+	}
+
+	// Shapes created from the cache while it was open must have been released before closing it
+	__declspec(dllexport) void close_shape_cache()
+	{
+		shapeCache.close();
+	}
+
+	// Counts the shape creator calls that reused a shared shape and those that created a new one,
+	// and the shared shapes currently used by at least one body
+	__declspec(dllexport) void get_shape_stats(int& hits, int& misses, int& liveShapes)
+	{
+		hits = shapeRegistry.getHits();
+		misses = shapeRegistry.getMisses();
+		liveShapes = shapeRegistry.getLiveShapes();
+	}
+
+	// Frees the shared shapes that no body uses any more
+	__declspec(dllexport) void release_unused_shapes()
+	{
+		ensureStepFinished();
+
+		shapeRegistry.releaseUnused();
+	}
+
+	// Releases a reference to a shape returned by one of the shape creators that was not handed
+	// over to a body
+	__declspec(dllexport) void release_shape(hkpShape* shape)
+	{
+		if(shape == HK_NULL)
+			return;
+
+		if(recorder.begin(TraceRecorder::CALL_RELEASE_SHAPE))
+		{
+			recorder.writePointer(shape);
+			recorder.end();
+		}
+
+		shape->removeReference();
+	}
+
+	// Wraps boundingShape, taking over the caller's reference to it, and returns a new reference
+	// to the phantom shape. With queueEvents set, the enter and leave events are recorded for
+	// get_phantom_events instead of being passed to the callbacks.
+	__declspec(dllexport) hkpShape* create_phantom_shape(hkpShape* boundingShape,
+		phantomEnterCallback enter, phantomLeaveCallback leave, bool queueEvents)
+	{
+		if(boundingShape == HK_NULL)
+			return HK_NULL;
+
+		PhantomCallback* phantom = new PhantomCallback(enter, leave,
+			queueEvents ? &phantomEvents : HK_NULL);
+		hkpBvShape* bvShape = new hkpBvShape(boundingShape, phantom);
+		phantom->removeReference();
+		boundingShape->removeReference();
+
+		if(recorder.begin(TraceRecorder::CALL_CREATE_PHANTOM_SHAPE))
+		{
+			recorder.writePointer(boundingShape);
+			recorder.writePointer(bvShape);
+			recorder.end();
+		}
+
+		return bvShape;
+	}
+
+	__declspec(dllexport) int add_rigid_body(hkpShape* shape, float mass, hkpMotion::MotionType motionType, 
+		hkpCollidableQualityType collideQuality, float pos[], float rot[], float linearVelocity[], float linearDamping, 
+		float maxLinearVelocity, float angularVelocity[], float angularDamping, float maxAngularVelocity, float friction, 
+		float restitution, float allowedPenetrationDepth, bool neverDeactivate, float gravityFactor, 
+		int collisionFilterInfo)
+	{
+		hkpRigidBody* body = createRigidBody(shape, mass, motionType, collideQuality, pos, rot, linearVelocity, 
+			linearDamping, maxLinearVelocity, angularVelocity, angularDamping, maxAngularVelocity, friction, 
+			restitution, allowedPenetrationDepth, neverDeactivate, gravityFactor, collisionFilterInfo);
+
+		// The body gets its handle right away even if adding it to the world is deferred
+		int handle = bodies.add(body);
+		if(handle == BodySlotMap::INVALID_HANDLE)
+		{
+			body->removeReference();
+			return handle;
+		}
+
+		if(recorder.begin(TraceRecorder::CALL_ADD_RIGID_BODY))
+		{
+			float info[] = { mass, (float)motionType, (float)collideQuality, pos[0], pos[1], pos[2], 
+				rot[0], rot[1], rot[2], rot[3], linearVelocity[0], linearVelocity[1], linearVelocity[2], 
+				linearDamping, maxLinearVelocity, angularVelocity[0], angularVelocity[1], angularVelocity[2], 
+				angularDamping, maxAngularVelocity, friction, restitution, allowedPenetrationDepth, 
+				neverDeactivate ? 1.0f : 0.0f, gravityFactor };
+			recorder.writePointer(shape);
+			recorder.writeFloats(info, 25);
+			recorder.writeInt(collisionFilterInfo);
+			recorder.writeInt(handle);
+			recorder.end();
+		}
+
+		submitCommand(CommandBuffer::CMD_ADD_BODY, handle, HK_NULL);
+
+		return handle;
+	}
+
+	// Removes a body from the world and invalidates its handle. A body spawned from a pool is
+	// parked back in its pool instead.
+	__declspec(dllexport) void remove_rigid_body(int handle)
+	{
+		recordBodyCall(TraceRecorder::CALL_REMOVE_RIGID_BODY, handle, HK_NULL, 0);
+
+		submitCommand(CommandBuffer::CMD_REMOVE_BODY, handle, HK_NULL);
+	}
+
+	// Creates a pool of bodies that share a shape and their construction parameters, and returns
+	// its id. The bodies are parked outside the world until spawned, and they take over the
+	// reference to the shape like add_rigid_body does. Returns -1 if the bodies could not get
+	// handles.
+	__declspec(dllexport) int create_body_pool(hkpShape* shape, int size, float mass, 
+		hkpMotion::MotionType motionType, hkpCollidableQualityType collideQuality, float linearDamping, 
+		float maxLinearVelocity, float angularDamping, float maxAngularVelocity, float friction, 
+		float restitution, float allowedPenetrationDepth, bool neverDeactivate, float gravityFactor, 
+		int collisionFilterInfo)
+	{
+		float zero[] = { 0, 0, 0 };
+		float identity[] = { 0, 0, 0, 1 };
+
+		int pool = bodyPools.addPool();
+		bool failed = false;
+		for(int i = 0; i < size && !failed; i++)
+		{
+			// createRigidBody releases one reference to the shape per body
+			shape->addReference();
+			hkpRigidBody* body = createRigidBody(shape, mass, motionType, collideQuality, zero, identity, zero, 
+				linearDamping, maxLinearVelocity, zero, angularDamping, maxAngularVelocity, friction, 
+				restitution, allowedPenetrationDepth, neverDeactivate, gravityFactor, collisionFilterInfo);
+
+			int handle = bodies.add(body);
+			if(handle == BodySlotMap::INVALID_HANDLE)
+			{
+				body->removeReference();
+				failed = true;
+			}
+			else
+				bodyPools.addBody(pool, handle);
+		}
+		shape->removeReference();
+
+		if(failed)
+		{
+			// Like destroy_body_pool, the world must not be locked while a step is still running
+			ensureStepFinished();
+			flushCommands();
+
+			world->lock();
+			destroyBodyPool(pool);
+			world->unlock();
+
+			return -1;
+		}
+
+		if(recorder.begin(TraceRecorder::CALL_CREATE_BODY_POOL))
+		{
+			float info[] = { mass, (float)motionType, (float)collideQuality, linearDamping, maxLinearVelocity, 
+				angularDamping, maxAngularVelocity, friction, restitution, allowedPenetrationDepth, 
+				neverDeactivate ? 1.0f : 0.0f, gravityFactor };
+			recorder.writePointer(shape);
+			recorder.writeInt(size);
+			recorder.writeFloats(info, 12);
+			recorder.writeInt(collisionFilterInfo);
+			recorder.writeInt(pool);
+			recorder.end();
+		}
+
+		return pool;
+	}
+
+	// Adds a parked body of a pool to the world with the given transform and velocities, and
+	// returns its handle, or -1 if every body of the pool is in use. Removing the body with
+	// remove_rigid_body parks it again.
+	__declspec(dllexport) int spawn_pooled_body(int pool, float pos[], float rot[], float linearVelocity[], 
+		float angularVelocity[])
+	{
+		int handle = bodyPools.spawn(pool);
+		if(handle == BodySlotMap::INVALID_HANDLE)
+			return handle;
+
+		float payload[] = { pos[0], pos[1], pos[2], rot[0], rot[1], rot[2], rot[3], linearVelocity[0], 
+			linearVelocity[1], linearVelocity[2], angularVelocity[0], angularVelocity[1], angularVelocity[2] };
+
+		if(recorder.begin(TraceRecorder::CALL_SPAWN_POOLED_BODY))
+		{
+			recorder.writeInt(pool);
+			recorder.writeFloats(payload, 13);
+			recorder.writeInt(handle);
+			recorder.end();
+		}
+
+		submitCommand(CommandBuffer::CMD_SPAWN_BODY, handle, payload);
+
+		return handle;
+	}
+
+	__declspec(dllexport) int get_pool_free_count(int pool)
+	{
+		return bodyPools.getFreeCount(pool);
+	}
+
+	// Removes the spawned bodies of a pool from the world and frees all of its bodies
+	__declspec(dllexport) void destroy_body_pool(int pool)
+	{
+		if(!bodyPools.isValid(pool))
+			return;
+
+		if(recorder.begin(TraceRecorder::CALL_DESTROY_BODY_POOL))
+		{
+			recorder.writeInt(pool);
+			recorder.end();
+		}
+
+		ensureStepFinished();
+		flushCommands();
+
+		world->lock();
+		destroyBodyPool(pool);
+		world->unlock();
+	}
+
+	// Applies a batch of packed command records (see CommandBuffer) under a single world lock, or
+	// queues it until end_step if a step is running. A CMD_CREATE_BODY record refers to one of the
+	// numShapes entries of shapes by its handle word and takes over the reference to that shape
+	// like add_rigid_body does. The handles of the created bodies are written to createdHandles in
+	// record order. Returns the number of created bodies, or -1 without applying anything if the
+	// batch is malformed, refers to a shape out of range, or holds a CMD_SPAWN_BODY record, since
+	// pooled bodies can only be spawned through spawn_pooled_body.
+	__declspec(dllexport) int submit_commands(int* data, int numWords, hkpShape** shapes, int numShapes, 
+		int* createdHandles)
+	{
+		const CommandBuffer::Word* words = reinterpret_cast<const CommandBuffer::Word*>(data);
+		if(validateCommands(words, numWords) != numWords)
+			return -1;
+
+		for(int i = 0; i < numWords; i += CommandBuffer::HEADER_SIZE + CommandBuffer::getPayloadSize(words[i].i))
+		{
+			if(words[i].i == CommandBuffer::CMD_SPAWN_BODY || words[i].i == CommandBuffer::CMD_APPLY_EXPLOSION)
+				return -1;
+			if(words[i].i == CommandBuffer::CMD_CREATE_BODY && 
+				(words[i + 1].i < 0 || words[i + 1].i >= numShapes || shapes[words[i + 1].i] == HK_NULL))
+				return -1;
+		}
+
+		int numCreated = 0;
+
+		commandLock.enter();
+
+		int i = 0;
+		while(i < numWords)
+		{
+			const CommandBuffer::Word* record = &words[i];
+			i += CommandBuffer::HEADER_SIZE + CommandBuffer::getPayloadSize(record[0].i);
+
+			if(record[0].i != CommandBuffer::CMD_CREATE_BODY)
+			{
+				pendingCommands.write(record);
+				continue;
+			}
+
+			const float* info = &record[CommandBuffer::HEADER_SIZE].f;
+			float pos[] = { info[3], info[4], info[5] };
+			float rot[] = { info[6], info[7], info[8], info[9] };
+			float linearVelocity[] = { info[10], info[11], info[12] };
+			float angularVelocity[] = { info[15], info[16], info[17] };
+
+			hkpRigidBody* body = createRigidBody(shapes[record[1].i], info[0], (hkpMotion::MotionType)(int)info[1],
+				(hkpCollidableQualityType)(int)info[2], pos, rot, linearVelocity, info[13], info[14], angularVelocity,
+				info[18], info[19], info[20], info[21], info[22], info[23] != 0, info[24], 
+				record[CommandBuffer::HEADER_SIZE + 25].i);
+
+			int handle = bodies.add(body);
+			if(handle == BodySlotMap::INVALID_HANDLE)
+				body->removeReference();
+			else
+				pendingCommands.write(CommandBuffer::CMD_ADD_BODY, handle, HK_NULL);
+
+			createdHandles[numCreated++] = handle;
+		}
+
+		commandLock.leave();
+
+		// One shape per created body, in record order
+		if(recorder.begin(TraceRecorder::CALL_SUBMIT_COMMANDS))
+		{
+			recorder.writeInt(numWords);
+			recorder.writeInts(data, numWords);
+			recorder.writeInt(numCreated);
+			for(i = 0; i < numWords; i += CommandBuffer::HEADER_SIZE + CommandBuffer::getPayloadSize(words[i].i))
+				if(words[i].i == CommandBuffer::CMD_CREATE_BODY)
+					recorder.writePointer(shapes[words[i + 1].i]);
+			recorder.writeInts(createdHandles, numCreated);
+			recorder.end();
+		}
+
+		if(!stepInProgress && !stepThread.isStepping())
+			flushCommands();
+
+		return numCreated;
+	}
+
+	// Lets bodies of quality HK_COLLIDABLE_QUALITY_USER fall back to discrete collisions once a
+	// step has more than maxToisPerStep TOI events, until recoverySteps steps in a row stayed
+	// within it. Until then they collide like bullets. A budget of 0 turns the fallback off.
+	__declspec(dllexport) void set_toi_budget(int maxToisPerStep, int recoverySteps)
+	{
+		if(recorder.begin(TraceRecorder::CALL_SET_TOI_BUDGET))
+		{
+			recorder.writeInt(maxToisPerStep);
+			recorder.writeInt(recoverySteps);
+			recorder.end();
+		}
+
+		ensureStepFinished();
+
+		world->lock();
+		toiBudget.setBudget(maxToisPerStep, recoverySteps);
+		world->unlock();
+	}
+
+	// Sets the collision quality level (hkpCollisionDispatcher::CollisionQualityLevel) used
+	// between bodies of the two qualities. Body pairs that are already colliding keep their
+	// level until they separate.
+	__declspec(dllexport) void set_collision_quality(hkpCollidableQualityType quality1, 
+		hkpCollidableQualityType quality2, int level)
+	{
+		if(quality1 < 0 || quality1 >= HK_COLLIDABLE_QUALITY_MAX || 
+			quality2 < 0 || quality2 >= HK_COLLIDABLE_QUALITY_MAX || level < 0)
+			return;
+
+		if(recorder.begin(TraceRecorder::CALL_SET_COLLISION_QUALITY))
+		{
+			recorder.writeInt(quality1);
+			recorder.writeInt(quality2);
+			recorder.writeInt(level);
+			recorder.end();
+		}
+
+		ensureStepFinished();
+
+		world->lock();
+		toiBudget.setQuality(quality1, quality2, level);
+		world->unlock();
+	}
+
+	// Copies the TOI counts of the steps since the last call, oldest first, and returns how
+	// many were copied
+	__declspec(dllexport) int get_toi_counts(int counts[], int maxCounts)
+	{
+		ensureStepFinished();
+
+		return toiBudget.drain(counts, maxCounts);
+	}
+
+	// Returns true while the budgeted bodies collide discretely
+	__declspec(dllexport) bool is_toi_fallback_active()
+	{
+		return toiBudget.isFallback();
+	}
+
+	// Replaces the collision filter of the world with a group filter, under which two bodies
+	// collide depending on the layers, system groups and subsystems packed into their collision
+	// filter info (see hkpGroupFilter::calcFilterInfo). Every layer collides with every other
+	// one, unless standardLayers sets up the layers of hkpGroupFilterSetup.
+	__declspec(dllexport) void install_group_filter(bool standardLayers)
+	{
+		if(recorder.begin(TraceRecorder::CALL_INSTALL_GROUP_FILTER))
+		{
+			recorder.writeInt(standardLayers);
+			recorder.end();
+		}
+
+		ensureStepFinished();
+
+		world->lock();
+
+		groupFilter = new hkpGroupFilter();
+		if(standardLayers)
+			hkpGroupFilterSetup::setupGroupFilter(groupFilter);
+
+		world->setCollisionFilter(groupFilter);
+		groupFilter->removeReference();
+
+		world->unlock();
+	}
+
+	// Enables or disables the collisions between two layers of the group filter. Every call
+	// rechecks the body pairs of the whole world, so set_collision_layer_masks is cheaper for
+	// changing several layers.
+	__declspec(dllexport) void set_layer_collision(int layer1, int layer2, bool enabled)
+	{
+		if(groupFilter == HK_NULL || layer1 < 0 || layer1 >= 32 || layer2 < 0 || layer2 >= 32)
+			return;
+
+		if(recorder.begin(TraceRecorder::CALL_SET_LAYER_COLLISION))
+		{
+			recorder.writeInt(layer1);
+			recorder.writeInt(layer2);
+			recorder.writeInt(enabled);
+			recorder.end();
+		}
+
+		ensureStepFinished();
+
+		world->lock();
+
+		if(enabled)
+			groupFilter->enableCollisionsBetween(layer1, layer2);
+		else
+			groupFilter->disableCollisionsBetween(layer1, layer2);
+
+		world->updateCollisionFilterOnWorld(HK_UPDATE_FILTER_ON_WORLD_FULL_CHECK, 
+			HK_UPDATE_COLLECTION_FILTER_PROCESS_SHAPE_COLLECTIONS);
+
+		world->unlock();
+	}
+
+	// Sets the layer collision matrix of the group filter from a bit mask per layer of the layers
+	// it collides with. Collisions are symmetric, so where two masks disagree the mask of the
+	// higher layer wins.
+	__declspec(dllexport) void set_collision_layer_masks(int masks[], int numLayers)
+	{
+		if(groupFilter == HK_NULL)
+			return;
+
+		numLayers = hkMath::min2(numLayers, 32);
+
+		if(recorder.begin(TraceRecorder::CALL_SET_COLLISION_LAYER_MASKS))
+		{
+			recorder.writeInt(numLayers);
+			recorder.writeInts(masks, numLayers);
+			recorder.end();
+		}
+
+		ensureStepFinished();
+
+		world->lock();
+
+		for(int i = 0; i < numLayers; i++)
+		{
+			groupFilter->disableCollisionsUsingBitfield(1u << i, ~(hkUint32)masks[i]);
+			groupFilter->enableCollisionsUsingBitfield(1u << i, (hkUint32)masks[i]);
+		}
+
+		world->updateCollisionFilterOnWorld(HK_UPDATE_FILTER_ON_WORLD_FULL_CHECK, 
+			HK_UPDATE_COLLECTION_FILTER_PROCESS_SHAPE_COLLECTIONS);
+
+		world->unlock();
+	}
+
+	// Returns a system group of the group filter that no other caller got, for the bodies of a
+	// ragdoll or vehicle that should not collide with each other, or 0 without a group filter
+	__declspec(dllexport) int get_new_system_group()
+	{
+		if(groupFilter == HK_NULL)
+			return 0;
+
+		return groupFilter->getNewSystemGroup();
+	}
+
+	// Moves the point the distance bands of the simulation LOD are measured from. Meant to be
+	// called every frame with the camera or player position, so it does not wait for an
+	// asynchronous step; a step that is running may see the old point.
+	__declspec(dllexport) void set_lod_focus(float focus[])
+	{
+		if(recorder.begin(TraceRecorder::CALL_SET_LOD_FOCUS))
+		{
+			recorder.writeFloats(focus, 3);
+			recorder.end();
+		}
+
+		simulationLod.setFocus(focus[0], focus[1], focus[2]);
+	}
+
+	// Sets the distance bands of the simulation LOD, sorted by increasing distance. Before every
+	// step, the active islands whose nearest body lies beyond the distance of a band are
+	// deactivated, frozen as keyframed bodies, or only simulated every interval steps, as the
+	// mode of the farthest such band says. No bands turns the LOD off and restores every body.
+	__declspec(dllexport) void set_lod_bands(SimulationLod::Band bands[], int count)
+	{
+		count = hkMath::max2(count, 0);
+
+		if(recorder.begin(TraceRecorder::CALL_SET_LOD_BANDS))
+		{
+			recorder.writeBlob(bands, count * sizeof(SimulationLod::Band));
+			recorder.end();
+		}
+
+		ensureStepFinished();
+
+		simulationLod.setBands(bands, count);
+	}
+
+	// Counts the bodies currently deactivated, keyframed and slowed down by the simulation LOD
+	__declspec(dllexport) void get_lod_counts(int& deactivated, int& keyframed, int& reduced)
+	{
+		ensureStepFinished();
+
+		simulationLod.getCounts(deactivated, keyframed, reduced);
+	}
+
+	// Returns the handle of a body passed to one of the native callbacks
+	__declspec(dllexport) int get_body_handle(hkpRigidBody* body)
+	{
+		if(body == HK_NULL)
+			return BodySlotMap::INVALID_HANDLE;
+
+		return BodySlotMap::getHandle(body);
+	}
+
+	// Contact point events slower than minSpeed are dropped. With oncePerStep, a body pair
+	// reports at most one contact point per step, and a positive cooldown holds the pair back
+	// for that many seconds after it reported.
+	__declspec(dllexport) void add_contact_listener(int handle, contactCallback cc,
+		collisionStarted cs, collisionEnded ce, float minSpeed, float cooldown, bool oncePerStep)
+	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
+		world->lock();
+
+		ContactListener* listener = new ContactListener(body, HK_NULL,
+			createContactFilter(minSpeed, cooldown, oncePerStep));
+		listener->callback = cc;
+		listener->startCallback = cs;
+		listener->endCallback = ce;
+
+		world->unlock();
+	}
+
+	// Records the contacts of the body into the contact event queue instead of calling back
+	// into managed code during the step. The filter options are those of add_contact_listener.
+	__declspec(dllexport) void add_contact_event_listener(int handle, float minSpeed, float cooldown,
+		bool oncePerStep)
+	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
+		world->lock();
+
+		new ContactListener(body, &contactEvents, createContactFilter(minSpeed, cooldown, oncePerStep));
+
+		world->unlock();
+	}
+
+	// Starts recording the timings and counters of every step, keeping up to historySize steps
+	// until they are read. With a csvPath, every step is also written to that file. The worker
+	// threads of a multithreaded world are only timed if this is called before init_world.
+	__declspec(dllexport) void enable_profiling(int historySize, const char* csvPath)
+	{
+		ensureStepFinished();
+
+		stepProfiler.enable(historySize, csvPath);
+	}
+
+	__declspec(dllexport) void disable_profiling()
+	{
+		ensureStepFinished();
+
+		stepProfiler.disable();
+	}
+
+	// Copies up to maxStats of the steps recorded since the last call, oldest first, and
+	// returns how many were copied
+	__declspec(dllexport) int get_step_stats(StepProfiler::Stats stats[], int maxStats)
+	{
+		ensureStepFinished();
+
+		return stepProfiler.drain(stats, maxStats);
+	}
+
+	// Copies up to maxEvents of the queued contact events and returns how many were copied
+	__declspec(dllexport) int get_contact_events(ContactEventQueue::Event events[], int maxEvents)
+	{
+		ensureStepFinished();
+
+		return contactEvents.drain(events, maxEvents);
+	}
+
+	// Copies up to maxEvents of the queued phantom events and returns how many were copied
+	__declspec(dllexport) int get_phantom_events(PhantomEventQueue::Event events[], int maxEvents)
+	{
+		ensureStepFinished();
+
+		return phantomEvents.drain(events, maxEvents);
+	}
+
+	// Copies the handles of the bodies inside a phantom body and returns how many there are,
+	// which may be more than maxBodies. Returns -1 if the body is not a phantom.
+	__declspec(dllexport) int get_phantom_overlaps(int handle, int overlaps[], int maxBodies)
+	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return -1;
+
+		PhantomCallback* phantom = PhantomCallback::get(body);
+		if(phantom == HK_NULL)
+			return -1;
+
+		return phantom->getOverlaps(handle, overlaps, maxBodies);
+	}
+
+	// Returns the number of contact events dropped because a queue was full since the last call
+	__declspec(dllexport) int get_dropped_contact_events()
+	{
+		return contactEvents.takeDropped();
+	}
+
+	__declspec(dllexport) void add_force(int handle, float timeStep, float force[])
+	{
+		float payload[] = { timeStep, force[0], force[1], force[2] };
+		recordBodyCall(TraceRecorder::CALL_ADD_FORCE, handle, payload, 4);
+		submitCommand(CommandBuffer::CMD_ADD_FORCE, handle, payload);
+	}
+
+	__declspec(dllexport) void add_torque(int handle, float timeStep, float torque[])
+	{
+		float payload[] = { timeStep, torque[0], torque[1], torque[2] };
+		recordBodyCall(TraceRecorder::CALL_ADD_TORQUE, handle, payload, 4);
+		submitCommand(CommandBuffer::CMD_ADD_TORQUE, handle, payload);
+	}
+
+	// Sets the scale of the object rendered for a body. The transform buffer applies it to the
+	// transforms of the body, so they can be used as the world matrix of the object as is.
+	__declspec(dllexport) void set_body_scale(int handle, float scale[])
+	{
+		submitCommand(CommandBuffer::CMD_SET_SCALE, handle, scale);
+	}
+
+	__declspec(dllexport) void set_linear_velocity(int handle, float vel[])
+	{
+		recordBodyCall(TraceRecorder::CALL_SET_LINEAR_VELOCITY, handle, vel, 3);
+		submitCommand(CommandBuffer::CMD_SET_LINEAR_VELOCITY, handle, vel);
+	}
+
+	__declspec(dllexport) void get_linear_velocity(int handle, float* vel)
+	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
+		hkVector4 velocity = body->getLinearVelocity();
+		vel[0] = velocity(0);
+		vel[1] = velocity(1);
+		vel[2] = velocity(2);
+	}
+
+	__declspec(dllexport) void set_angular_velocity(int handle, float vel[])
+	{
+		recordBodyCall(TraceRecorder::CALL_SET_ANGULAR_VELOCITY, handle, vel, 3);
+		submitCommand(CommandBuffer::CMD_SET_ANGULAR_VELOCITY, handle, vel);
+	}
+
+	__declspec(dllexport) void get_angular_velocity(int handle, float* vel)
+	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
+		hkVector4 velocity = body->getAngularVelocity();
+		vel[0] = velocity(0);
+		vel[1] = velocity(1);
+		vel[2] = velocity(2);
+	}
+
+	__declspec(dllexport) void apply_hard_keyframe(int handle, float position[], float rotation[], float timeStep)
+	{
+		float payload[] = { position[0], position[1], position[2], 
+			rotation[0], rotation[1], rotation[2], rotation[3], timeStep };
+		recordBodyCall(TraceRecorder::CALL_APPLY_HARD_KEYFRAME, handle, payload, 8);
+		submitCommand(CommandBuffer::CMD_APPLY_HARD_KEYFRAME, handle, payload);
+	}
+
+	__declspec(dllexport) void apply_soft_keyframe(int handle, float position[], float rotation[], 
+		float angularPositionFactor[], float angularVelocityFactor[], float linearPositionFactor[],
+		float linearVelocityFactor[], float maxAngularAcceleration, float maxLinearAcceleration, float maxAllowedDistance, 
+		float timeStep)
+	{
+		float payload[] = { position[0], position[1], position[2], 
+			rotation[0], rotation[1], rotation[2], rotation[3],
+			angularPositionFactor[0], angularPositionFactor[1], angularPositionFactor[2],
+			angularVelocityFactor[0], angularVelocityFactor[1], angularVelocityFactor[2],
+			linearPositionFactor[0], linearPositionFactor[1], linearPositionFactor[2],
+			linearVelocityFactor[0], linearVelocityFactor[1], linearVelocityFactor[2],
+			maxAngularAcceleration, maxLinearAcceleration, maxAllowedDistance, timeStep };
+		recordBodyCall(TraceRecorder::CALL_APPLY_SOFT_KEYFRAME, handle, payload, 23);
+		submitCommand(CommandBuffer::CMD_APPLY_SOFT_KEYFRAME, handle, payload);
+	}
+
+	__declspec(dllexport) void get_AABB(int handle, float* min, float* max)
+	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
+		hkAabb aabb;
+		body->getCollidable()->getShape()->getAabb(body->getTransform(), 0.0f, aabb);
+
+		hkVector4 halfExtent;
+		aabb.getHalfExtents(halfExtent);
+		hkVector4 center;
+		aabb.getCenter(center);
+
+		min[0] = center(0) - halfExtent(0);
+		min[1] = center(1) - halfExtent(1);
+		min[2] = center(2) - halfExtent(2);
 
-		hkMemoryRouter* memoryRouter;
+		max[0] = center(0) + halfExtent(0);
+		max[1] = center(1) + halfExtent(1);
+		max[2] = center(2) + halfExtent(2);
+	}
 
-		memoryRouter = hkMemoryInitUtil::initFreeList(&mallocBase, frameInfo);
-		extAllocator::initDefault();
+	// Reads the state of count bodies into structure-of-arrays outputs: positions and the two
+	// velocities take 3 floats per body and rotations 4, as x, y, z, w. Any output may be null
+	// to skip it. The entries of handles that refer to no body are zeroed. Returns the number
+	// of handles that refer to a body.
+	__declspec(dllexport) int get_body_states(int count, int handles[], float positions[], float rotations[],
+		float linearVelocities[], float angularVelocities[])
+	{
+		ensureStepFinished();
 
-		if (memoryRouter == HK_NULL)
+		int found = 0;
+		for(int i = 0; i < count; i++)
 		{
-			return false;
-		}
+			hkpRigidBody* body = bodies.get(handles[i]);
+			if(body != HK_NULL)
+				found++;
 
-		if ( hkBaseSystem::init( memoryRouter, errorReportFunction ) != HK_SUCCESS)
-		{
-			return false;
-		}
+			const hkVector4& pos = (body != HK_NULL) ? body->getPosition() : hkVector4::getZero();
+			const hkVector4& rot = (body != HK_NULL) ? body->getRotation().m_vec : hkVector4::getZero();
+			const hkVector4& linear = (body != HK_NULL) ? body->getLinearVelocity() : hkVector4::getZero();
+			const hkVector4& angular = (body != HK_NULL) ? body->getAngularVelocity() : hkVector4::getZero();
 
-		hkpWorldCinfo info;
-		info.m_simulationType = simType;
-		info.m_collisionTolerance = collisionTolerance;
-		info.m_gravity = hkVector4(gravity[0], gravity[1], gravity[2]);
-		info.setBroadPhaseWorldSize(worldSize);
-		info.setupSolverInfo(solverType);
-		info.m_fireCollisionCallbacks = fireCollisionCallbacks;
-		info.m_enableDeactivation = enableDeactivation;
-		info.m_contactRestingVelocity = contactRestingVelocity;
+			for(int j = 0; j < 3; j++)
+			{
+				if(positions != HK_NULL)
+					positions[i * 3 + j] = pos(j);
+				if(linearVelocities != HK_NULL)
+					linearVelocities[i * 3 + j] = linear(j);
+				if(angularVelocities != HK_NULL)
+					angularVelocities[i * 3 + j] = angular(j);
+			}
 
-		world = new hkpWorld(info);
-		hkpAgentRegisterUtil::registerAllAgents(world->getCollisionDispatcher());
+			if(rotations != HK_NULL)
+				for(int j = 0; j < 4; j++)
+					rotations[i * 4 + j] = rot(j);
+		}
 
-		return true;
+		return found;
 	}
 
-	__declspec(dllexport) void set_gravity(float gravity[])
+	// Writes the world space AABBs of count bodies to mins and maxs, 3 floats per body. The
+	// entries of handles that refer to no body are zeroed. Returns the number of handles that
+	// refer to a body.
+	__declspec(dllexport) int get_body_aabbs(int count, int handles[], float mins[], float maxs[])
 	{
-		if(world == NULL)
-			return;
+		ensureStepFinished();
 
-		hkVector4 g(gravity[0], gravity[1], gravity[2]);
-		world->setGravity(g);
-	}
+		int found = 0;
+		for(int i = 0; i < count; i++)
+		{
+			hkpRigidBody* body = bodies.get(handles[i]);
 
-	__declspec(dllexport) void add_world_leave_callback(leaveWorldCallback callback)
-	{
-		world->lock();
+			hkAabb aabb;
+			if(body != HK_NULL)
+			{
+				body->getCollidable()->getShape()->getAabb(body->getTransform(), 0.0f, aabb);
+				found++;
+			}
+			else
+			{
+				aabb.m_min.setZero4();
+				aabb.m_max.setZero4();
+			}
 
-		BroadphaseBorder* border = new BroadphaseBorder( world, callback );
-		world->setBroadPhaseBorder(border);
-		border->removeReference();
+			for(int j = 0; j < 3; j++)
+			{
+				mins[i * 3 + j] = aabb.m_min(j);
+				maxs[i * 3 + j] = aabb.m_max(j);
+			}
+		}
 
-		world->unlock();
+		return found;
 	}
 
-	__declspec(dllexport) hkpShape* create_box_shape(float dim[], float convexRadius)
+	// Sets the linear velocities of count bodies from vels, 3 floats per body, with one lock
+	// for the whole batch
+	__declspec(dllexport) void set_linear_velocities(int count, int handles[], float vels[])
 	{
-		hkVector4 halfExtent(dim[0] / 2, dim[1] / 2, dim[2] / 2);
-		return new hkpBoxShape(halfExtent, convexRadius);
+		submitCommands(CommandBuffer::CMD_SET_LINEAR_VELOCITY, TraceRecorder::CALL_SET_LINEAR_VELOCITY, 
+			count, handles, vels, 3);
 	}
 
-	__declspec(dllexport) hkpShape* create_sphere_shape(float radius)
+	__declspec(dllexport) void set_angular_velocities(int count, int handles[], float vels[])
 	{
-		return new hkpSphereShape(radius);
+		submitCommands(CommandBuffer::CMD_SET_ANGULAR_VELOCITY, TraceRecorder::CALL_SET_ANGULAR_VELOCITY, 
+			count, handles, vels, 3);
 	}
 
-	__declspec(dllexport) hkpShape* create_triangle_shape(float v0[], float v1[], float v2[], float convexRadius)
+	// Moves count keyframed bodies to positions (3 floats per body) and rotations (4 floats per
+	// body) within timeStep, like apply_hard_keyframe does for one
+	__declspec(dllexport) void apply_hard_keyframes(int count, int handles[], float positions[], 
+		float rotations[], float timeStep)
 	{
-		hkVector4 _v0(v0[0], v0[1], v0[2]);
-		hkVector4 _v1(v1[0], v1[1], v1[2]);
-		hkVector4 _v2(v2[0], v2[1], v2[2]);
+		hkArray<float> payloads;
+		payloads.setSize(count * 8);
+		for(int i = 0; i < count; i++)
+		{
+			float* payload = payloads.begin() + i * 8;
+			for(int j = 0; j < 3; j++)
+				payload[j] = positions[i * 3 + j];
+			for(int j = 0; j < 4; j++)
+				payload[3 + j] = rotations[i * 4 + j];
+			payload[7] = timeStep;
+		}
 
-		return new hkpTriangleShape(_v0, _v1, _v2, convexRadius);
+		submitCommands(CommandBuffer::CMD_APPLY_HARD_KEYFRAME, TraceRecorder::CALL_APPLY_HARD_KEYFRAME, 
+			count, handles, payloads.begin(), 8);
 	}
 
-	__declspec(dllexport) hkpShape* create_capsule_shape(float top[], float bottom[], float radius)
+	// Casts count rays from origins[3 * i] along directions[3 * i] up to maxDistance, and writes
+	// the closest hit of each ray to hits. The rays are filtered like a body with the given
+	// collision filter info. Returns the number of rays that hit something. Inside a step, e.g.,
+	// from a collision callback, the rays are cast on the calling thread alone, since the job
+	// queue is busy with the step.
+	__declspec(dllexport) int cast_rays(int count, float origins[], float directions[], float maxDistance, 
+		int filterInfo, WorldQuery::Hit hits[])
 	{
-		hkVector4 _v0(top[0], top[1], top[2]);
-		hkVector4 _v1(bottom[0], bottom[1], bottom[2]);
-
-		return new hkpCapsuleShape(_v0, _v1, radius);
-	}
+		ensureStepFinished();
 
-	__declspec(dllexport) hkpShape* create_cylinder_shape(float top[], float bottom[], float radius, float convexRadius)
-	{
-		hkVector4 _v0(top[0], top[1], top[2]);
-		hkVector4 _v1(bottom[0], bottom[1], bottom[2]);
+		if(isInsideStep())
+			return worldQuery.castRays(world, HK_NULL, HK_NULL, count, origins, directions, maxDistance, 
+				filterInfo, hits);
 
-		return new hkpCylinderShape(_v0, _v1, radius, convexRadius);
+		return worldQuery.castRays(world, jobQueue, threadPool, count, origins, directions, maxDistance, 
+			filterInfo, hits);
 	}
 
-	__declspec(dllexport) hkpShape* create_convex_shape(int numVertices, float vertices[], int stride, 
-		float convexRadius)
+	// Sweeps a shape from origins[3 * i] along directions[3 * i] up to maxDistance, and writes the
+	// closest hit of each cast to hits. rotations holds a quaternion per cast, or is null. Returns
+	// the number of casts that hit something. A null shape misses every cast. The casts always
+	// run on the calling thread, so they are safe from collision callbacks too.
+	__declspec(dllexport) int cast_shape(hkpShape* shape, int count, float origins[], float rotations[], 
+		float directions[], float maxDistance, int filterInfo, WorldQuery::Hit hits[])
 	{
-		hkStridedVertices stridedVerts;
-		stridedVerts.m_numVertices = numVertices;
-		stridedVerts.m_striding = stride;
-		stridedVerts.m_vertices = vertices;
-
-		hkGeometry* geometry = new hkGeometry();
-		hkInplaceArrayAligned16<hkVector4,32> transformedPlanes;
+		ensureStepFinished();
 
-		hkGeometryUtility::createConvexGeometry(stridedVerts, *geometry, transformedPlanes);
-
-		stridedVerts.m_numVertices = geometry->m_vertices.getSize();
-		stridedVerts.m_striding = sizeof(hkVector4);
-		stridedVerts.m_vertices = &(geometry->m_vertices[0](0));
-
-		hkpConvexVerticesShape* shape = new hkpConvexVerticesShape(stridedVerts, transformedPlanes, convexRadius);
-
-		return shape;
+		return worldQuery.castShapes(world, shape, count, origins, rotations, directions, maxDistance, 
+			filterInfo, hits);
 	}
 
-	/*__declspec(dllexport) hkpShape* create_mesh_shape(int numVertices, float vertices[], int vertexStride, 
-		int numTriangles, int indices[], float convexRadius)
+	// Pushes the dynamic bodies within radius of center away from it with impulse, scaled by
+	// (1 - distance / radius) ^ falloff. Only bodies whose collision layer has its bit set in
+	// layerMask are pushed, and with occlusion, bodies hidden behind another body are spared.
+	// Writes up to maxAffected handles of the pushed bodies to affected and returns the number
+	// of bodies pushed. Inside a step, e.g., from a collision callback, or while queued commands
+	// are being applied, the explosion is queued instead and applied with the other commands
+	// once the step is over, and -1 is returned.
+	__declspec(dllexport) int apply_explosion(float center[], float radius, float impulse, float falloff, 
+		int layerMask, bool occlusion, int affected[], int maxAffected)
 	{
-		hkpExtendedMeshShape* mesh = new hkpExtendedMeshShape();
-		mesh->setRadius(convexRadius);
+		if(recorder.begin(TraceRecorder::CALL_APPLY_EXPLOSION))
 		{
-			hkpExtendedMeshShape::TrianglesSubpart part;
-
-			part.m_vertexBase = vertices;
-			part.m_vertexStriding = vertexStride;
-			part.m_numVertices = numVertices;
-
-			part.m_indexBase = indices;
-			part.m_indexStriding = sizeof(int) * 3;
-			part.m_numTriangleShapes = numTriangles;
-			part.m_stridingType = hkpExtendedMeshShape::INDICES_INT32;
-
-			mesh->addTrianglesSubpart( part );
+			recorder.writeFloats(center, 3);
+			recorder.writeFloat(radius);
+			recorder.writeFloat(impulse);
+			recorder.writeFloat(falloff);
+			recorder.writeInt(layerMask);
+			recorder.writeInt(occlusion);
+			recorder.end();
 		}
 
-		return mesh;
-	}*/
-
-	__declspec(dllexport) hkpShape* create_mesh_shape(int numVertices, float vertices[], int vertexStride, 
-		int numTriangles, int indices[], float convexRadius)
-	{
-		hkArray<hkpShape*> shapeArray;
+		ensureStepFinished();
 
-		for(int i = 0; i < numTriangles * 3; i += 3)
+		if(isInsideStep() || flushing)
 		{
-			hkpShape* triShape = create_triangle_shape(&vertices[indices[i] * 3], &vertices[indices[i + 1] * 3],
-				&vertices[indices[i + 2] * 3], convexRadius);
-			shapeArray.pushBack(triShape);
+			CommandBuffer::Word record[CommandBuffer::HEADER_SIZE + 8];
+			record[0].i = CommandBuffer::CMD_APPLY_EXPLOSION;
+			record[1].i = BodySlotMap::INVALID_HANDLE;
+			for(int i = 0; i < 3; i++)
+				record[CommandBuffer::HEADER_SIZE + i].f = center[i];
+			record[CommandBuffer::HEADER_SIZE + 3].f = radius;
+			record[CommandBuffer::HEADER_SIZE + 4].f = impulse;
+			record[CommandBuffer::HEADER_SIZE + 5].f = falloff;
+			record[CommandBuffer::HEADER_SIZE + 6].i = layerMask;
+			record[CommandBuffer::HEADER_SIZE + 7].i = occlusion;
+
+			commandLock.enter();
+			pendingCommands.write(record);
+			commandLock.leave();
+
+			// The flush may have ended while this thread waited for the lock
+			if(!stepInProgress && !stepThread.isStepping())
+				flushCommands();
+
+			return -1;
 		}
 
-		return new hkpListShape(&shapeArray[0], shapeArray.getSize());
+		flushCommands();
+
+		return worldQuery.explode(world, jobQueue, threadPool, center, radius, impulse, falloff, layerMask, 
+			occlusion, affected, maxAffected);
 	}
 
-	__declspec(dllexport) hkpShape* create_phantom_shape(hkpShape* boundingShape,
-		phantomEnterCallback enter, phantomLeaveCallback leave)
+	// Writes a snapshot of the bodies into the buffer if it fits and returns its size either way.
+	// With a base snapshot, only the bodies that changed since are written. Returns -1 if the
+	// base is not a valid full snapshot.
+	__declspec(dllexport) int save_world_state(char* buffer, int capacity, const char* base, int baseSize)
 	{
-		PhantomCallback* phantom = new PhantomCallback(enter, leave);
-		hkpBvShape* bvShape = new hkpBvShape(boundingShape, phantom);
-		phantom->removeReference();
+		ensureStepFinished();
 
-		return bvShape;
+		world->lock();
+		int size = WorldState::save(bodies, buffer, capacity, base, baseSize);
+		world->unlock();
+
+		return size;
 	}
 
-	__declspec(dllexport) hkpRigidBody* add_rigid_body(hkpShape* shape, float mass, hkpMotion::MotionType motionType, 
-		hkpCollidableQualityType collideQuality, float pos[], float rot[], float linearVelocity[], float linearDamping, 
-		float maxLinearVelocity, float angularVelocity[], float angularDamping, float maxAngularVelocity, float friction, 
-		float restitution, float allowedPenetrationDepth, bool neverDeactivate, float gravityFactor)
+	// Restores a snapshot taken by save_world_state. A delta snapshot needs the base it was taken
+	// against. The restored transforms are published right away, including those of bodies
+	// that are deactivated by the load.
+	__declspec(dllexport) bool load_world_state(const char* buffer, int size, const char* base, int baseSize)
 	{
-		world->lock();
-
-		hkpRigidBodyCinfo bodyInfo;
-		
-		bodyInfo.m_shape = shape;
-		bodyInfo.m_motionType = motionType;
-		bodyInfo.m_position.set(pos[0], pos[1], pos[2]);
-		bodyInfo.m_rotation.set(rot[0], rot[1], rot[2], rot[3]);
-
-		if(friction >= 0)
-			bodyInfo.m_friction = friction;
-		if(restitution >= 0)
-			bodyInfo.m_restitution = restitution;
-		if(allowedPenetrationDepth >= 0)
-			bodyInfo.m_allowedPenetrationDepth = allowedPenetrationDepth;
-		if(collideQuality >= 0)
-			bodyInfo.m_qualityType = collideQuality;
-		bodyInfo.m_gravityFactor = gravityFactor;
-
-		if(!(motionType == hkpMotion::MOTION_FIXED || motionType == hkpMotion::MOTION_KEYFRAMED))
-		{
-			hkpMassProperties massProperties;
-			hkpInertiaTensorComputer::computeShapeVolumeMassProperties(shape, mass, massProperties);
-
-			bodyInfo.m_mass = massProperties.m_mass;
-			bodyInfo.m_centerOfMass = massProperties.m_centerOfMass;
-			bodyInfo.m_inertiaTensor = massProperties.m_inertiaTensor;
-
-			if(!allZero(linearVelocity, 3))
-				bodyInfo.m_linearVelocity.set(linearVelocity[0], linearVelocity[1], linearVelocity[2]);
-			if(linearDamping >= 0)
-				bodyInfo.m_linearDamping = linearDamping;
-			if(!allZero(angularVelocity, 3))
-				bodyInfo.m_angularVelocity.set(angularVelocity[0], angularVelocity[1], angularVelocity[2]);
-			if(angularDamping >= 0)
-				bodyInfo.m_angularDamping = angularDamping;
-			if(maxLinearVelocity >= 0)
-				bodyInfo.m_maxLinearVelocity = maxLinearVelocity;
-			if(maxAngularVelocity >= 0)
-				bodyInfo.m_maxAngularVelocity = maxAngularVelocity;
-
-			bodyInfo.m_enableDeactivation = !neverDeactivate;
-		}
-
-		hkpRigidBody* body = new hkpRigidBody(bodyInfo);
-
-		world->addEntity(body);
-		body->removeReference();
+		if(recorder.begin(TraceRecorder::CALL_LOAD_WORLD_STATE))
+		{
+			recorder.writeBlob(buffer, size);
+			recorder.writeInt(base != HK_NULL);
+			recorder.writeBlob(base, (base != HK_NULL) ? baseSize : 0);
+			recorder.end();
+		}
 
-		shape->removeReference();
+		ensureStepFinished();
 
+		world->lock();
+		restoredBodies.setSize(0);
+		bool loaded = WorldState::load(bodies, buffer, size, base, baseSize, restoredBodies);
+		if(loaded)
+			transformBuffer.publish(restoredBodies);
 		world->unlock();
 
-		return body;
-	}
-
-	__declspec(dllexport) void remove_rigid_body(hkpRigidBody* body)
-	{
-		world->removeEntity(body);
+		return loaded;
 	}
 
-	__declspec(dllexport) void add_contact_listener(hkpRigidBody* body, contactCallback cc,
-		collisionStarted cs, collisionEnded ce)
+	// Calls made by callbacks during the step are recorded after the step itself, which is
+	// where they take effect
+	__declspec(dllexport) void update(float elapsedSeconds)
 	{
-		world->lock();
+		if(recorder.begin(TraceRecorder::CALL_UPDATE))
+		{
+			recorder.writeFloat(elapsedSeconds);
+			recorder.end();
+		}
 
-		ContactListener* listener = new ContactListener(body);
-		listener->callback = cc;
-		listener->startCallback = cs;
-		listener->endCallback = ce;
+		ensureStepFinished();
 
-		world->unlock();
-	}
+		stepWorld(elapsedSeconds);
 
-	__declspec(dllexport) void add_force(hkpRigidBody* body, float timeStep, float force[])
-	{
-		hkVector4 _force(force[0], force[1], force[2]);
-		body->applyForce(timeStep, _force);
-	}
+		flushCommands();
 
-	__declspec(dllexport) void add_torque(hkpRigidBody* body, float timeStep, float torque[])
-	{
-		hkVector4 _torque(torque[0], torque[1], torque[2]);
-		body->applyTorque(timeStep, _torque);
+		recordCheck();
 	}
 
-	__declspec(dllexport) void set_linear_velocity(hkpRigidBody* body, float vel[])
+	// Advances the simulation by elapsedSeconds in steps of fixedTimeStep, carrying the time
+	// that does not make up a whole step over to the next call. At most maxSteps are run and
+	// the time beyond them is dropped, so a slow frame does not snowball. With interpolate, the
+	// transform buffer gets the poses at the carried over time, interpolated between the last
+	// two steps, which renders smoothly at any frame rate one step behind the simulation.
+	// Returns the number of steps run.
+	__declspec(dllexport) int advance(float elapsedSeconds, float fixedTimeStep, int maxSteps, 
+		bool interpolate)
 	{
-		hkVector4 velocity(vel[0], vel[1], vel[2]);
-		body->setLinearVelocity(velocity);
-	}
+		if(recorder.begin(TraceRecorder::CALL_ADVANCE))
+		{
+			recorder.writeFloat(elapsedSeconds);
+			recorder.writeFloat(fixedTimeStep);
+			recorder.writeInt(maxSteps);
+			recorder.writeInt(interpolate);
+			recorder.end();
+		}
 
-	__declspec(dllexport) void get_linear_velocity(hkpRigidBody* body, float* vel)
-	{
-		hkVector4 velocity = body->getLinearVelocity();
-		vel[0] = velocity(0);
-		vel[1] = velocity(1);
-		vel[2] = velocity(2);
-	}
+		ensureStepFinished();
 
-	__declspec(dllexport) void set_angular_velocity(hkpRigidBody* body, float vel[])
-	{
-		hkVector4 velocity(vel[0], vel[1], vel[2]);
-		body->setAngularVelocity(velocity);
-	}
+		if(fixedTimeStep <= 0)
+			return 0;
 
-	__declspec(dllexport) void get_angular_velocity(hkpRigidBody* body, float* vel)
-	{
-		hkVector4 velocity = body->getAngularVelocity();
-		vel[0] = velocity(0);
-		vel[1] = velocity(1);
-		vel[2] = velocity(2);
-	}
+		stepAccumulator += elapsedSeconds;
 
-	__declspec(dllexport) void apply_hard_keyframe(hkpRigidBody* body, float position[], float rotation[], float timeStep)
-	{
-		world->lock();
+		int numSteps = (int)(stepAccumulator / fixedTimeStep);
+		maxSteps = hkMath::max2(maxSteps, 1);
+		if(numSteps > maxSteps)
+		{
+			stepAccumulator -= (numSteps - maxSteps) * fixedTimeStep;
+			numSteps = maxSteps;
+		}
 
-		hkVector4 pos(position[0], position[1], position[2]);
-		hkQuaternion rot(rotation[0], rotation[1], rotation[2], rotation[3]);
-		hkpKeyFrameUtility::applyHardKeyFrame(pos, rot, 1.0f / timeStep, body);
+		for(int i = 0; i < numSteps; i++)
+		{
+			stepWorld(fixedTimeStep);
+			stepAccumulator -= fixedTimeStep;
 
-		world->unlock();
-	}
+			flushCommands();
+		}
 
-	__declspec(dllexport) void apply_soft_keyframe(hkpRigidBody* body, float position[], float rotation[], 
-		float angularPositionFactor[], float angularVelocityFactor[], float linearPositionFactor[],
-		float linearVelocityFactor[], float maxAngularAcceleration, float maxLinearAcceleration, float maxAllowedDistance, 
-		float timeStep)
-	{
-		world->lock();
+		if(interpolate)
+		{
+			hkTime time = world->getCurrentPsiTime() - fixedTimeStep + stepAccumulator;
+			transformBuffer.publishAt(world, time);
+		}
 
-		hkpKeyFrameUtility::KeyFrameInfo keyInfo;
-		hkpKeyFrameUtility::AccelerationInfo accelInfo;
-
-		keyInfo.m_position = hkVector4(position[0], position[1], position[2]);
-		keyInfo.m_orientation = hkQuaternion(rotation[0], rotation[1], rotation[2], rotation[3]);
-		keyInfo.m_linearVelocity = hkVector4();
-		keyInfo.m_angularVelocity = hkVector4();
-
-		accelInfo.m_angularPositionFactor = hkVector4(angularPositionFactor[0], angularPositionFactor[1],
-			angularPositionFactor[2]);
-		accelInfo.m_angularVelocityFactor = hkVector4(angularVelocityFactor[0], angularVelocityFactor[1],
-			angularVelocityFactor[2]);
-		accelInfo.m_linearPositionFactor = hkVector4(linearPositionFactor[0], linearPositionFactor[1],
-			linearPositionFactor[2]);
-		accelInfo.m_linearVelocityFactor = hkVector4(linearVelocityFactor[0], linearVelocityFactor[1],
-			linearVelocityFactor[2]);
-		accelInfo.m_maxAngularAcceleration = maxAngularAcceleration;
-		accelInfo.m_maxLinearAcceleration = maxLinearAcceleration;
-		accelInfo.m_maxAllowedDistance = maxAllowedDistance;
-		
-		hkpKeyFrameUtility::applySoftKeyFrame(keyInfo, accelInfo, timeStep, 1 / timeStep, body);
+		recordCheck();
 
-		world->unlock();
+		return numSteps;
 	}
 
-	__declspec(dllexport) void get_AABB(hkpRigidBody* body, float* min, float* max)
+	// Starts stepping the world numSteps times on the step thread and returns immediately.
+	// Until end_step is called, mutations are queued and the transform buffer keeps
+	// returning the transforms of the previous step.
+	__declspec(dllexport) void begin_step(float elapsedSeconds, int numSteps)
 	{
-		hkAabb aabb;
-		body->getCollidable()->getShape()->getAabb(body->getTransform(), 0.0f, aabb);
+		if(recorder.begin(TraceRecorder::CALL_BEGIN_STEP))
+		{
+			recorder.writeFloat(elapsedSeconds);
+			recorder.writeInt(numSteps);
+			recorder.end();
+		}
 
-		hkVector4 halfExtent;
-		aabb.getHalfExtents(halfExtent);
-		hkVector4 center;
-		aabb.getCenter(center);
+		ensureStepFinished();
 
-		min[0] = center(0) - halfExtent(0);
-		min[1] = center(1) - halfExtent(1);
-		min[2] = center(2) - halfExtent(2);
+		if(!stepThread.isRunning())
+			stepThread.start(asyncStep);
 
-		max[0] = center(0) + halfExtent(0);
-		max[1] = center(1) + halfExtent(1);
-		max[2] = center(2) + halfExtent(2);
+		stepThread.beginStep(elapsedSeconds, numSteps);
 	}
 
-	__declspec(dllexport) void update(float elapsedSeconds)
+	// Waits for the step started by begin_step, publishes its transforms and applies the
+	// mutations queued in the meantime
+	__declspec(dllexport) void end_step()
 	{
-		hkCheckDeterminismUtil::workerThreadStartFrame(true);
+		if(recorder.begin(TraceRecorder::CALL_END_STEP))
+			recorder.end();
 
-		world->stepDeltaTime(elapsedSeconds);
+		finishStep();
 
-		hkCheckDeterminismUtil::workerThreadFinishFrame();
+		recordCheck();
 	}
 
-	__declspec(dllexport) void get_body_transform(hkpRigidBody* body, float* transform)
+	__declspec(dllexport) void get_body_transform(int handle, float* transform)
 	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
 		hkTransform mat;
 		body->approxCurrentTransform( mat );
 
 		mat.get4x4ColumnMajor( transform );
 	}
 
-	__declspec(dllexport) void get_body_position(hkpRigidBody* body, float* position)
+	__declspec(dllexport) void get_body_position(int handle, float* position)
 	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
 		hkVector4 pos = body->getPosition();
 		position[0] = pos(0);
 		position[1] = pos(1);
 		position[2] = pos(2);
 	}
 
-	__declspec(dllexport) void get_body_rotation(hkpRigidBody* body, float* rotation)
+	__declspec(dllexport) void get_body_rotation(int handle, float* rotation)
 	{
+		ensureStepFinished();
+
+		hkpRigidBody* body = bodies.get(handle);
+		if(body == HK_NULL)
+			return;
+
 		hkQuaternion rot = body->getRotation();
 		rotation[0] = rot(0);
 		rotation[1] = rot(1);
@@ -443,6 +2247,8 @@ extern "C"
 
 	__declspec(dllexport) void get_updated_transforms(int* bodyPtr, float* transformPtr, int &totalSize)
 	{
+		ensureStepFinished();
+
 		world->markForRead();
 
 		const hkArray<hkpSimulationIsland*>& activeIslands = world->getActiveSimulationIslands();
@@ -460,21 +2266,544 @@ extern "C"
 			for(int j = 0; j < activeEntities.getSize(); j++, count++)
 			{
 				hkpRigidBody* rigidBody = static_cast<hkpRigidBody*>(activeEntities[j]);
-				bodyPtr[count] = (int)rigidBody;
+				int handle = BodySlotMap::getHandle(rigidBody);
+				bodyPtr[count] = BodySlotMap::getIndex(handle);
 
 				hkTransform transform;
 				rigidBody->approxCurrentTransform( transform );
 				
-				transform.get4x4ColumnMajor((transformPtr + count * 16));
+				transformBuffer.store(transform, handle, transformPtr + count * 16);
 			}
 		}
 
 		world->unmarkForRead();
 	}
 
+	// Returns the front buffer of the persistent transform arena. The returned pointers stay
+	// valid until the next step is published, so the caller can read them without copying.
+	__declspec(dllexport) void get_transform_buffer(int*& bodyPtr, float*& transformPtr, 
+		int &totalSize)
+	{
+		if(!stepThread.isStepping() && transformBuffer.isDirty())
+			transformBuffer.publish(world);
+
+		TransformBuffer::Frame& frame = transformBuffer.getFront();
+		bodyPtr = frame.bodies.begin();
+		transformPtr = frame.transforms.begin();
+		totalSize = frame.count;
+	}
+
+	// Returns the slot indices of the bodies that went to sleep in the steps published by the
+	// last call to get_transform_buffer. The bodies are also in the transform buffer, at their
+	// final transforms, and the pointer stays valid just as long.
+	__declspec(dllexport) void get_sleeping_bodies(int*& bodyPtr, int& totalSize)
+	{
+		TransformBuffer::Frame& frame = transformBuffer.getFront();
+		bodyPtr = frame.sleeping.begin();
+		totalSize = frame.sleeping.getSize();
+	}
+
+	// Makes the transform buffer skip the active bodies whose translation moved by less than
+	// linearEpsilon and whose axes turned by less than angularEpsilon since they were last
+	// reported. A negative linearEpsilon reports every active body again.
+	__declspec(dllexport) void set_transform_epsilon(float linearEpsilon, float angularEpsilon)
+	{
+		ensureStepFinished();
+
+		transformBuffer.setEpsilons(linearEpsilon, angularEpsilon);
+	}
+
 	__declspec(dllexport) void dispose()
 	{
+		if(recorder.begin(TraceRecorder::CALL_DISPOSE))
+			recorder.end();
+
+		ensureStepFinished();
+		stepThread.stop();
+
+		pendingCommands.clearAndDeallocate();
+		runningCommands.clearAndDeallocate();
+		transformBuffer.clear();
+
+		world->lock();
+		for(int i = 0; i < bodyPools.getNumPools(); i++)
+			if(bodyPools.isValid(i))
+				destroyBodyPool(i);
+		world->unlock();
+		bodyPools.clear();
+
+		bodies.clear();
+		worldQuery.clear();
+		restoredBodies.clearAndDeallocate();
+		stepProfiler.detach();
+		toiBudget.detach();
+		transformBuffer.detach();
+		groupFilter = HK_NULL;
+		simulationLod.clear();
+		stepAccumulator = 0;
+
 		world->removeAll();
 		world->removeReference();
+		world = HK_NULL;
+
+		shapeRegistry.clear();
+
+		quitThreads();
+
+		contactEvents.clear();
+		contactClock.reset();
+		phantomEvents.clear();
+
+		// Nothing allocated from the heap may outlive it, since the next init_world may build a
+		// different one
+		hkBaseSystem::quit();
+		extAllocator::quit();
+		hkMemoryInitUtil::quit();
+	}
+	// Runs a trace written by start_recording again on a new world and stores how long each
+	// update, or each begin_step and end_step pair, took in milliseconds. firstMismatch is set
+	// to the first step after which the bodies were not where they were while recording, or -1.
+	// Returns the number of steps, which may be more than maxSteps, or -1 if the trace cannot
+	// be read or a world is already initialized.
+	__declspec(dllexport) int replay_trace(const char* path, float stepTimes[], int maxSteps, int& firstMismatch)
+	{
+		firstMismatch = -1;
+		if(world != HK_NULL)
+			return -1;
+
+		TraceReader reader;
+		if(!reader.open(path))
+			return -1;
+
+		TraceMap map;
+		hkStopwatch stopwatch;
+		int numSteps = 0;
+
+		hkArray<hkpShape*> shapes;
+		hkArray<int> words;
+		hkArray<int> createdHandles;
+		hkArray<char> state;
+		hkArray<char> baseState;
+
+		for(int call = reader.nextRecord(); call != 0; call = reader.nextRecord())
+		{
+			// A trace started after the world was disposed may begin with calls that need one
+			if(TraceRecorder::needsWorld(call) && world == HK_NULL)
+				continue;
+
+			switch(call)
+			{
+			case TraceRecorder::CALL_SET_MEMORY_OPTIONS:
+			{
+				int solverBuffer = reader.readInt();
+				int threadStack = reader.readInt();
+				int allocator = reader.readInt();
+				if(reader.isValid())
+					set_memory_options(solverBuffer, threadStack, (AllocatorType)allocator);
+				break;
+			}
+			case TraceRecorder::CALL_INIT_WORLD:
+			case TraceRecorder::CALL_INIT_WORLD_MT:
+			{
+				int numWorkerThreads = (call == TraceRecorder::CALL_INIT_WORLD_MT) ? reader.readInt() : -1;
+				float gravity[3];
+				reader.readFloats(gravity, 3);
+				float worldSize = reader.readFloat();
+				float collisionTolerance = reader.readFloat();
+				int simType = (call == TraceRecorder::CALL_INIT_WORLD) ? reader.readInt() : 
+					hkpWorldCinfo::SIMULATION_TYPE_MULTITHREADED;
+				int solverType = reader.readInt();
+				bool fireCollisionCallbacks = reader.readInt() != 0;
+				bool enableDeactivation = reader.readInt() != 0;
+				float contactRestingVelocity = reader.readFloat();
+				if(reader.isValid())
+					initWorld(gravity, worldSize, collisionTolerance, (hkpWorldCinfo::SimulationType)simType,
+						(hkpWorldCinfo::SolverType)solverType, fireCollisionCallbacks, enableDeactivation,
+						contactRestingVelocity, numWorkerThreads);
+				break;
+			}
+			case TraceRecorder::CALL_CREATE_BOX_SHAPE:
+			case TraceRecorder::CALL_CREATE_SPHERE_SHAPE:
+			case TraceRecorder::CALL_CREATE_TRIANGLE_SHAPE:
+			case TraceRecorder::CALL_CREATE_CAPSULE_SHAPE:
+			case TraceRecorder::CALL_CREATE_CYLINDER_SHAPE:
+			{
+				float p[10];
+				int count = (call == TraceRecorder::CALL_CREATE_BOX_SHAPE) ? 4 : 
+					(call == TraceRecorder::CALL_CREATE_SPHERE_SHAPE) ? 1 : 
+					(call == TraceRecorder::CALL_CREATE_TRIANGLE_SHAPE) ? 10 : 
+					(call == TraceRecorder::CALL_CREATE_CAPSULE_SHAPE) ? 7 : 8;
+				reader.readFloats(p, count);
+				hkUint64 recorded = reader.readUint64();
+				if(!reader.isValid())
+					break;
+
+				hkpShape* shape;
+				if(call == TraceRecorder::CALL_CREATE_BOX_SHAPE)
+					shape = create_box_shape(p, p[3]);
+				else if(call == TraceRecorder::CALL_CREATE_SPHERE_SHAPE)
+					shape = create_sphere_shape(p[0]);
+				else if(call == TraceRecorder::CALL_CREATE_TRIANGLE_SHAPE)
+					shape = create_triangle_shape(p, p + 3, p + 6, p[9]);
+				else if(call == TraceRecorder::CALL_CREATE_CAPSULE_SHAPE)
+					shape = create_capsule_shape(p, p + 3, p[6]);
+				else
+					shape = create_cylinder_shape(p, p + 3, p[6], p[7]);
+
+				map.addShape(recorded, shape);
+				break;
+			}
+			case TraceRecorder::CALL_CREATE_CONVEX_SHAPE:
+			{
+				int numVertices = reader.readInt();
+				int stride = reader.readInt();
+				float convexRadius = reader.readFloat();
+				int size = reader.readInt();
+				const char* vertices = reader.readBytes(size);
+				hkUint64 recorded = reader.readUint64();
+				if(reader.isValid())
+					map.addShape(recorded, create_convex_shape(numVertices, 
+						reinterpret_cast<float*>(const_cast<char*>(vertices)), stride, convexRadius));
+				break;
+			}
+			case TraceRecorder::CALL_CREATE_MESH_SHAPE:
+			{
+				int numVertices = reader.readInt();
+				int stride = reader.readInt();
+				int numTriangles = reader.readInt();
+				float convexRadius = reader.readFloat();
+				int size = reader.readInt();
+				const char* vertices = reader.readBytes(size);
+				size = reader.readInt();
+				const char* indices = reader.readBytes(size);
+				hkUint64 recorded = reader.readUint64();
+				if(reader.isValid())
+					map.addShape(recorded, create_mesh_shape(numVertices, 
+						reinterpret_cast<float*>(const_cast<char*>(vertices)), stride, numTriangles, 
+						reinterpret_cast<int*>(const_cast<char*>(indices)), convexRadius));
+				break;
+			}
+			case TraceRecorder::CALL_CREATE_PHANTOM_SHAPE:
+			{
+				// The callbacks are left out, since the calls they made were recorded
+				hkpShape* boundingShape = map.getShape(reader.readUint64());
+				hkUint64 recorded = reader.readUint64();
+				if(reader.isValid() && boundingShape != HK_NULL)
+					map.addShape(recorded, create_phantom_shape(boundingShape, HK_NULL, HK_NULL, false));
+				break;
+			}
+			case TraceRecorder::CALL_RELEASE_SHAPE:
+			{
+				hkpShape* shape = map.getShape(reader.readUint64());
+				if(reader.isValid() && shape != HK_NULL)
+					release_shape(shape);
+				break;
+			}
+			case TraceRecorder::CALL_SET_GRAVITY:
+			{
+				reader.readInt();
+				float gravity[3];
+				reader.readFloats(gravity, 3);
+				if(reader.isValid())
+					set_gravity(gravity);
+				break;
+			}
+			case TraceRecorder::CALL_ADD_WORLD_LEAVE_CALLBACK:
+				add_world_leave_callback(ignoreWorldLeave);
+				break;
+			case TraceRecorder::CALL_ADD_RIGID_BODY:
+			{
+				hkpShape* shape = map.getShape(reader.readUint64());
+				float p[25];
+				reader.readFloats(p, 25);
+				int collisionFilterInfo = reader.readInt();
+				int recorded = reader.readInt();
+				if(!reader.isValid() || shape == HK_NULL)
+					break;
+
+				int handle = add_rigid_body(shape, p[0], (hkpMotion::MotionType)(int)p[1], 
+					(hkpCollidableQualityType)(int)p[2], p + 3, p + 6, p + 10, p[13], p[14], p + 15, p[18], 
+					p[19], p[20], p[21], p[22], p[23] != 0, p[24], collisionFilterInfo);
+				map.addHandle(recorded, handle);
+				break;
+			}
+			case TraceRecorder::CALL_REMOVE_RIGID_BODY:
+			{
+				int handle = map.getHandle(reader.readInt());
+				if(reader.isValid())
+					remove_rigid_body(handle);
+				break;
+			}
+			case TraceRecorder::CALL_CREATE_BODY_POOL:
+			{
+				hkpShape* shape = map.getShape(reader.readUint64());
+				int size = reader.readInt();
+				float p[12];
+				reader.readFloats(p, 12);
+				int collisionFilterInfo = reader.readInt();
+				int recorded = reader.readInt();
+				if(!reader.isValid() || shape == HK_NULL)
+					break;
+
+				// The pool takes over the reference handed out for the recorded pool
+				int pool = create_body_pool(shape, size, p[0], (hkpMotion::MotionType)(int)p[1], 
+					(hkpCollidableQualityType)(int)p[2], p[3], p[4], p[5], p[6], p[7], p[8], p[9], p[10] != 0, 
+					p[11], collisionFilterInfo);
+				map.addPool(recorded, pool);
+				break;
+			}
+			case TraceRecorder::CALL_SPAWN_POOLED_BODY:
+			{
+				int pool = map.getPool(reader.readInt());
+				float p[13];
+				reader.readFloats(p, 13);
+				int recorded = reader.readInt();
+				if(reader.isValid() && pool >= 0)
+					map.addHandle(recorded, spawn_pooled_body(pool, p, p + 3, p + 7, p + 10));
+				break;
+			}
+			case TraceRecorder::CALL_DESTROY_BODY_POOL:
+			{
+				int pool = map.getPool(reader.readInt());
+				if(reader.isValid() && pool >= 0)
+					destroy_body_pool(pool);
+				break;
+			}
+			case TraceRecorder::CALL_SUBMIT_COMMANDS:
+			{
+				int numWords = reader.readInt();
+				const char* data = reader.readBytes(numWords * sizeof(int));
+				int numCreated = reader.readInt();
+				if(!reader.isValid() || numCreated < 0)
+					break;
+
+				shapes.setSize(numCreated);
+				for(int i = 0; i < numCreated; i++)
+					shapes[i] = map.getShape(reader.readUint64());
+
+				const char* recordedHandles = reader.readBytes(numCreated * sizeof(int));
+				if(!reader.isValid() || shapes.indexOf(HK_NULL) >= 0)
+					break;
+
+				words.setSize(numWords);
+				memcpy(words.begin(), data, numWords * sizeof(int));
+				remapCommands(reinterpret_cast<CommandBuffer::Word*>(words.begin()), numWords, map);
+
+				createdHandles.setSize(numCreated);
+				if(submit_commands(words.begin(), numWords, shapes.begin(), numCreated, createdHandles.begin()) != numCreated)
+					break;
+
+				for(int i = 0; i < numCreated; i++)
+				{
+					int recorded;
+					memcpy(&recorded, recordedHandles + i * sizeof(int), sizeof(int));
+					map.addHandle(recorded, createdHandles[i]);
+				}
+				break;
+			}
+			case TraceRecorder::CALL_ADD_FORCE:
+			case TraceRecorder::CALL_ADD_TORQUE:
+			case TraceRecorder::CALL_SET_LINEAR_VELOCITY:
+			case TraceRecorder::CALL_SET_ANGULAR_VELOCITY:
+			case TraceRecorder::CALL_APPLY_HARD_KEYFRAME:
+			case TraceRecorder::CALL_APPLY_SOFT_KEYFRAME:
+			{
+				static const int opcodes[] = { CommandBuffer::CMD_ADD_FORCE, CommandBuffer::CMD_ADD_TORQUE, 
+					CommandBuffer::CMD_SET_LINEAR_VELOCITY, CommandBuffer::CMD_SET_ANGULAR_VELOCITY, 
+					CommandBuffer::CMD_APPLY_HARD_KEYFRAME, CommandBuffer::CMD_APPLY_SOFT_KEYFRAME };
+
+				// These calls only pack their arguments into a command, so the command is
+				// submitted directly
+				int opcode = opcodes[call - TraceRecorder::CALL_ADD_FORCE];
+				int handle = map.getHandle(reader.readInt());
+				float payload[23];
+				reader.readFloats(payload, CommandBuffer::getPayloadSize(opcode));
+				if(reader.isValid())
+					submitCommand(opcode, handle, payload);
+				break;
+			}
+			case TraceRecorder::CALL_LOAD_WORLD_STATE:
+			{
+				int size = reader.readInt();
+				const char* buffer = reader.readBytes(size);
+				bool hasBase = reader.readInt() != 0;
+				int baseSize = reader.readInt();
+				const char* base = reader.readBytes(baseSize);
+				if(reader.isValid())
+					load_world_state(remapSnapshot(buffer, size, map, state), size, 
+						hasBase ? remapSnapshot(base, baseSize, map, baseState) : HK_NULL, baseSize);
+				break;
+			}
+			case TraceRecorder::CALL_UPDATE:
+			{
+				float elapsedSeconds = reader.readFloat();
+				if(!reader.isValid())
+					break;
+
+				stopwatch.reset();
+				stopwatch.start();
+				update(elapsedSeconds);
+				stopwatch.stop();
+
+				if(numSteps < maxSteps)
+					stepTimes[numSteps] = stopwatch.getElapsedSeconds() * 1000.0f;
+				numSteps++;
+				break;
+			}
+			case TraceRecorder::CALL_ADVANCE:
+			{
+				float elapsedSeconds = reader.readFloat();
+				float fixedTimeStep = reader.readFloat();
+				int count = reader.readInt();
+				bool interpolate = reader.readInt() != 0;
+				if(!reader.isValid())
+					break;
+
+				stopwatch.reset();
+				stopwatch.start();
+				advance(elapsedSeconds, fixedTimeStep, count, interpolate);
+				stopwatch.stop();
+
+				if(numSteps < maxSteps)
+					stepTimes[numSteps] = stopwatch.getElapsedSeconds() * 1000.0f;
+				numSteps++;
+				break;
+			}
+			case TraceRecorder::CALL_BEGIN_STEP:
+			{
+				float elapsedSeconds = reader.readFloat();
+				int count = reader.readInt();
+				if(!reader.isValid())
+					break;
+
+				stopwatch.reset();
+				stopwatch.start();
+				begin_step(elapsedSeconds, count);
+				break;
+			}
+			case TraceRecorder::CALL_END_STEP:
+			{
+				end_step();
+				stopwatch.stop();
+
+				if(numSteps < maxSteps)
+					stepTimes[numSteps] = stopwatch.getElapsedSeconds() * 1000.0f;
+				numSteps++;
+				break;
+			}
+			case TraceRecorder::CALL_DISPOSE:
+				// The replay buffers live on the heap that dispose shuts down, and nothing they
+				// refer to survives it
+				map.clear();
+				shapes.clearAndDeallocate();
+				words.clearAndDeallocate();
+				createdHandles.clearAndDeallocate();
+				state.clearAndDeallocate();
+				baseState.clearAndDeallocate();
+				dispose();
+				break;
+			case TraceRecorder::CALL_SET_TOI_OPTIONS:
+			{
+				int eventQueueSize = reader.readInt();
+				float p[4];
+				reader.readFloats(p, 4);
+				if(reader.isValid())
+					set_toi_options(eventQueueSize, p[0], p[1], p[2], p[3]);
+				break;
+			}
+			case TraceRecorder::CALL_SET_TOI_BUDGET:
+			{
+				int maxToisPerStep = reader.readInt();
+				int recoverySteps = reader.readInt();
+				if(reader.isValid())
+					set_toi_budget(maxToisPerStep, recoverySteps);
+				break;
+			}
+			case TraceRecorder::CALL_SET_COLLISION_QUALITY:
+			{
+				int quality1 = reader.readInt();
+				int quality2 = reader.readInt();
+				int level = reader.readInt();
+				if(reader.isValid())
+					set_collision_quality((hkpCollidableQualityType)quality1, (hkpCollidableQualityType)quality2, level);
+				break;
+			}
+			case TraceRecorder::CALL_INSTALL_GROUP_FILTER:
+			{
+				bool standardLayers = reader.readInt() != 0;
+				if(reader.isValid())
+					install_group_filter(standardLayers);
+				break;
+			}
+			case TraceRecorder::CALL_SET_LAYER_COLLISION:
+			{
+				int layer1 = reader.readInt();
+				int layer2 = reader.readInt();
+				bool enabled = reader.readInt() != 0;
+				if(reader.isValid())
+					set_layer_collision(layer1, layer2, enabled);
+				break;
+			}
+			case TraceRecorder::CALL_SET_COLLISION_LAYER_MASKS:
+			{
+				int numLayers = reader.readInt();
+				const char* masks = reader.readBytes(numLayers * sizeof(int));
+				if(reader.isValid())
+					set_collision_layer_masks(reinterpret_cast<int*>(const_cast<char*>(masks)), numLayers);
+				break;
+			}
+			case TraceRecorder::CALL_SET_LOD_FOCUS:
+			{
+				float focus[3];
+				reader.readFloats(focus, 3);
+				if(reader.isValid())
+					set_lod_focus(focus);
+				break;
+			}
+			case TraceRecorder::CALL_SET_LOD_BANDS:
+			{
+				int size = reader.readInt();
+				const char* bands = reader.readBytes(size);
+				if(reader.isValid())
+					set_lod_bands(reinterpret_cast<SimulationLod::Band*>(const_cast<char*>(bands)), 
+						size / sizeof(SimulationLod::Band));
+				break;
+			}
+			case TraceRecorder::CALL_APPLY_EXPLOSION:
+			{
+				float p[6];
+				reader.readFloats(p, 6);
+				int layerMask = reader.readInt();
+				bool occlusion = reader.readInt() != 0;
+				if(reader.isValid())
+					apply_explosion(p, p[3], p[4], p[5], layerMask, occlusion, HK_NULL, 0);
+				break;
+			}
+			case TraceRecorder::CALL_CHECK:
+			{
+				int count = reader.readInt();
+				hkUint64 h = reader.readUint64();
+				if(!reader.isValid() || firstMismatch >= 0)
+					break;
+
+				int replayedCount;
+				if(hashTransforms(replayedCount) != h || replayedCount != count)
+					firstMismatch = hkMath::max2(numSteps - 1, 0);
+				break;
+			}
+			}
+		}
+
+		map.clear();
+		shapes.clearAndDeallocate();
+		words.clearAndDeallocate();
+		createdHandles.clearAndDeallocate();
+		state.clearAndDeallocate();
+		baseState.clearAndDeallocate();
+
+		if(world != HK_NULL)
+			dispose();
+
+		return numSteps;
 	}
 }
\ No newline at end of file
@@ -1,42 +1,128 @@
 #include <stdlib.h>
 
 #include <Physics/Collide/Shape/Misc/PhantomCallback/hkpPhantomCallbackShape.h>
+#include <Physics/Collide/Shape/Misc/Bv/hkpBvShape.h>
 
 #include <Physics/Dynamics/Entity/hkpRigidBody.h>
 
+#include "BodySlotMap.cpp"
+#include "PhantomEventQueue.cpp"
+
 typedef void (*phantomEnterCallback)(hkpRigidBody* body);
 typedef void (*phantomLeaveCallback)(hkpRigidBody* body);
 
+// Reports the bodies entering and leaving a phantom either through the callbacks or, when a
+// queue is given, by recording them into the queue to be drained after the step. The handles
+// of the bodies currently inside are kept for overlap queries, paired with the handle of the
+// phantom body they are inside, since several bodies may be built from the same phantom shape.
 class PhantomCallback : public hkpPhantomCallbackShape
 {
 public:
 
 	phantomEnterCallback enterEvent;
 	phantomLeaveCallback leaveEvent;
+	PhantomEventQueue* queue;
 
-	PhantomCallback(phantomEnterCallback enter, phantomLeaveCallback leave)
+	PhantomCallback(phantomEnterCallback enter, phantomLeaveCallback leave,
+		PhantomEventQueue* _queue = HK_NULL) : overlapLock(1000)
 	{
 		enterEvent = enter;
 		leaveEvent = leave;
+		queue = _queue;
+	}
+
+	// Returns the phantom of a body created with a phantom shape, or null
+	static PhantomCallback* get(const hkpRigidBody* body)
+	{
+		const hkpShape* shape = body->getCollidable()->getShape();
+		if(shape == HK_NULL || shape->getType() != HK_SHAPE_BV)
+			return HK_NULL;
+
+		const hkpShape* child = static_cast<const hkpBvShape*>(shape)->getChildShape();
+		if(child->getType() != HK_SHAPE_PHANTOM_CALLBACK)
+			return HK_NULL;
+
+		return static_cast<PhantomCallback*>(const_cast<hkpShape*>(child));
 	}
 
 	virtual void phantomEnterEvent( const hkpCollidable* collidableA, const hkpCollidable* collidableB, 
 		const hkpCollisionInput& env )
 	{
-		if(enterEvent != NULL)
-		{
-			hkpRigidBody* owner = hkpGetRigidBody(collidableB);
+		hkpRigidBody* owner = hkpGetRigidBody(collidableB);
+		if(owner == HK_NULL)
+			return;
+
+		Overlap overlap;
+		overlap.phantom = BodySlotMap::getHandle(hkpGetRigidBody(collidableA));
+		overlap.body = BodySlotMap::getHandle(owner);
+
+		overlapLock.enter();
+		overlaps.pushBack(overlap);
+		overlapLock.leave();
+
+		if(queue != HK_NULL)
+			queue->push(overlap.phantom, overlap.body, PhantomEventQueue::PHANTOM_ENTER);
+		else if(enterEvent != NULL)
 			enterEvent(owner);
-		}
 	}
 
 	// hkpPhantom interface implementation
 	virtual void phantomLeaveEvent( const hkpCollidable* collidableA, const hkpCollidable* collidableB )
 	{
-		if(leaveEvent != NULL)
+		hkpRigidBody* owner = hkpGetRigidBody(collidableB);
+		if(owner == HK_NULL)
+			return;
+
+		int phantom = BodySlotMap::getHandle(hkpGetRigidBody(collidableA));
+		int body = BodySlotMap::getHandle(owner);
+
+		overlapLock.enter();
+		for(int i = 0; i < overlaps.getSize(); i++)
 		{
-			hkpRigidBody* owner = hkpGetRigidBody(collidableB);
+			if(overlaps[i].phantom == phantom && overlaps[i].body == body)
+			{
+				overlaps.removeAt(i);
+				break;
+			}
+		}
+		overlapLock.leave();
+
+		if(queue != HK_NULL)
+			queue->push(phantom, body, PhantomEventQueue::PHANTOM_LEAVE);
+		else if(leaveEvent != NULL)
 			leaveEvent(owner);
+	}
+
+	// Copies up to maxBodies handles of the bodies inside the given phantom body and returns
+	// how many bodies are inside, which may be more than were copied
+	int getOverlaps(int phantom, int* out, int maxBodies)
+	{
+		overlapLock.enter();
+
+		int count = 0;
+		for(int i = 0; i < overlaps.getSize(); i++)
+		{
+			if(overlaps[i].phantom != phantom)
+				continue;
+
+			if(count < maxBodies)
+				out[count] = overlaps[i].body;
+			count++;
 		}
+
+		overlapLock.leave();
+
+		return count;
 	}
+
+private:
+
+	struct Overlap
+	{
+		int phantom;
+		int body;
+	};
+
+	hkCriticalSection overlapLock;
+	hkArray<Overlap> overlaps;
 };
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/Thread/CriticalSection/hkCriticalSection.h>
+
+// Collects the enter and leave events of phantoms raised during collision detection so that
+// they can be handed to the managed side in one call after the step. Overlap changes are rare
+// compared to contact points, so a single locked array is enough.
+class PhantomEventQueue
+{
+public:
+
+	enum Kind
+	{
+		PHANTOM_ENTER = 0,
+		PHANTOM_LEAVE = 1
+	};
+
+	struct Event
+	{
+		int phantom;
+		int body;
+		int kind;
+	};
+
+	PhantomEventQueue() : lock(1000)
+	{
+		readIndex = 0;
+	}
+
+	void push(int phantom, int body, int kind)
+	{
+		Event evt;
+		evt.phantom = phantom;
+		evt.body = body;
+		evt.kind = kind;
+
+		lock.enter();
+		events.pushBack(evt);
+		lock.leave();
+	}
+
+	// Copies up to maxEvents queued events, oldest first, and returns how many were copied.
+	// Whatever does not fit stays queued for the next call.
+	int drain(Event* out, int maxEvents)
+	{
+		lock.enter();
+
+		int count = hkMath::min2(events.getSize() - readIndex, maxEvents);
+		for(int i = 0; i < count; i++)
+			out[i] = events[readIndex + i];
+
+		readIndex += count;
+		if(readIndex == events.getSize())
+		{
+			events.setSize(0);
+			readIndex = 0;
+		}
+
+		lock.leave();
+
+		return count;
+	}
+
+	void clear()
+	{
+		lock.enter();
+		events.clearAndDeallocate();
+		readIndex = 0;
+		lock.leave();
+	}
+
+private:
+
+	hkCriticalSection lock;
+	hkArray<Event> events;
+	int readIndex;
+};
\ No newline at end of file
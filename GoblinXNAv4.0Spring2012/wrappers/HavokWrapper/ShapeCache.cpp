@@ -0,0 +1,515 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/Algorithm/Sort/hkSort.h>
+#include <Physics/Internal/Collide/Mopp/Code/hkpMoppCode.h>
+
+// Binary file of built convex hulls and MOPP codes keyed by a hash of the vertices and indices
+// they were built from. The file is memory-mapped read-only, so a hit is a binary search over
+// the entry table and MOPP codes are used in place. Shapes built on a miss are collected and
+// written out by save. If the file is still mapped at that point, the new file is written next
+// to it and replaces it the next time the cache is opened. Collected shapes are kept after a
+// save, so a later save in the same session writes them again along with the newer ones. The
+// cache outlives the worlds and their Havok memory systems, so the collected shapes are kept
+// in memory from malloc.
+class ShapeCache
+{
+public:
+
+	enum EntryType
+	{
+		ENTRY_CONVEX = 1,	// numVertices, numPlanes, 2 unused ints, hull vertices, plane equations
+		ENTRY_MOPP = 2		// code offset[4], build type, code size, 2 unused ints, code
+	};
+
+	// FNV-1a offset basis
+	static const hkUint64 HASH_SEED = 14695981039346656037ULL;
+
+	enum
+	{
+		MAGIC = 0x4353484b,	// "KHSC"
+		VERSION = 1,
+		ALIGNMENT = 16
+	};
+
+	struct Entry
+	{
+		hkUint64 key;
+		int type;
+		int offset;
+		int size;
+		int reserved;
+	};
+
+	struct FileHeader
+	{
+		int magic;
+		int version;
+		int numEntries;
+		int dataOffset;
+	};
+
+	ShapeCache()
+	{
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+		view = HK_NULL;
+		opened = false;
+		path[0] = '\0';
+		pendingEntries = HK_NULL;
+		numPending = 0;
+		pendingCapacity = 0;
+		pendingData = HK_NULL;
+		pendingDataSize = 0;
+		pendingDataCapacity = 0;
+		numSaved = 0;
+	}
+
+	~ShapeCache()
+	{
+		close();
+	}
+
+	// 64-bit FNV-1a
+	static hkUint64 hash(hkUint64 h, const void* data, int size)
+	{
+		const hkUint8* bytes = static_cast<const hkUint8*>(data);
+		for(int i = 0; i < size; i++)
+		{
+			h ^= bytes[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	static hkUint64 hashVertices(hkUint64 h, int numVertices, const float* vertices, int stride)
+	{
+		h = hash(h, &numVertices, sizeof(int));
+
+		const hkUint8* vertex = reinterpret_cast<const hkUint8*>(vertices);
+		for(int i = 0; i < numVertices; i++, vertex += stride)
+			h = hash(h, vertex, sizeof(float) * 3);
+
+		return h;
+	}
+
+	static hkUint64 hashConvex(int numVertices, const float* vertices, int stride)
+	{
+		int type = ENTRY_CONVEX;
+		hkUint64 h = hash(HASH_SEED, &type, sizeof(int));
+		return hashVertices(h, numVertices, vertices, stride);
+	}
+
+	// The convex radius is part of the key because the MOPP tree is built around the
+	// triangles expanded by it
+	static hkUint64 hashMesh(int numVertices, const float* vertices, int stride, int numTriangles,
+		const int* indices, float convexRadius)
+	{
+		int type = ENTRY_MOPP;
+		hkUint64 h = hash(HASH_SEED, &type, sizeof(int));
+		h = hash(h, &convexRadius, sizeof(float));
+		h = hashVertices(h, numVertices, vertices, stride);
+		h = hash(h, &numTriangles, sizeof(int));
+		return hash(h, indices, numTriangles * 3 * sizeof(int));
+	}
+
+	// Maps the cache file at the given path. A missing or unreadable file leaves the cache open
+	// but empty, so every shape is built and recorded for the next save.
+	bool open(const char* cachePath)
+	{
+		close();
+
+		if(cachePath == HK_NULL || strlen(cachePath) + 5 > MAX_PATH)
+			return false;
+
+		strcpy(path, cachePath);
+		opened = true;
+
+		// A file saved while the previous one was mapped replaces it now that nothing uses it
+		char newPath[MAX_PATH];
+		getNewPath(newPath);
+		if(GetFileAttributesA(newPath) != INVALID_FILE_ATTRIBUTES)
+			MoveFileExA(newPath, path, MOVEFILE_REPLACE_EXISTING);
+
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file == INVALID_HANDLE_VALUE)
+			return true;
+
+		DWORD size = GetFileSize(file, NULL);
+		if(size != INVALID_FILE_SIZE && size >= sizeof(FileHeader))
+		{
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if(mapping != NULL)
+				view = static_cast<const hkUint8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		}
+
+		if(view == HK_NULL || !validate(size))
+			unmap();
+
+		return true;
+	}
+
+	// Unmaps the file and drops the shapes recorded since it was opened. Shapes built from
+	// cached MOPP codes use the mapped memory, so they must have been released before this.
+	void close()
+	{
+		unmap();
+		free(pendingEntries);
+		free(pendingData);
+		pendingEntries = HK_NULL;
+		numPending = 0;
+		pendingCapacity = 0;
+		pendingData = HK_NULL;
+		pendingDataSize = 0;
+		pendingDataCapacity = 0;
+		numSaved = 0;
+		opened = false;
+		path[0] = '\0';
+	}
+
+	bool isOpen() const
+	{
+		return opened;
+	}
+
+	bool findConvex(hkUint64 key, int& numVertices, const hkVector4*& vertices, int& numPlanes,
+		const hkVector4*& planes) const
+	{
+		int size;
+		const hkUint8* data = find(key, ENTRY_CONVEX, size);
+		if(data == HK_NULL || size < ALIGNMENT)
+			return false;
+
+		// The counts come from the file, so they must fit in the entry
+		const int* header = reinterpret_cast<const int*>(data);
+		if(header[0] < 0 || header[1] < 0 ||
+			ALIGNMENT + ((hkUint64)header[0] + header[1]) * sizeof(hkVector4) > (hkUint64)size)
+			return false;
+
+		numVertices = header[0];
+		numPlanes = header[1];
+		vertices = reinterpret_cast<const hkVector4*>(data + ALIGNMENT);
+		planes = vertices + numVertices;
+
+		return true;
+	}
+
+	bool findMopp(hkUint64 key, hkpMoppCode::CodeInfo& info, hkpMoppCode::BuildType& buildType,
+		const hkUint8*& code, int& codeSize) const
+	{
+		int size;
+		const hkUint8* data = find(key, ENTRY_MOPP, size);
+		if(data == HK_NULL || size < ALIGNMENT * 2)
+			return false;
+
+		const float* offset = reinterpret_cast<const float*>(data);
+		const int* header = reinterpret_cast<const int*>(data + ALIGNMENT);
+		if(header[1] < 0 || header[1] > size - ALIGNMENT * 2)
+			return false;
+
+		info.m_offset.set(offset[0], offset[1], offset[2], offset[3]);
+		buildType = (hkpMoppCode::BuildType)header[0];
+		codeSize = header[1];
+		code = data + ALIGNMENT * 2;
+
+		return true;
+	}
+
+	void addConvex(hkUint64 key, const hkArray<hkVector4>& vertices, const hkArray<hkVector4>& planes)
+	{
+		int size = ALIGNMENT + (vertices.getSize() + planes.getSize()) * sizeof(hkVector4);
+		hkUint8* data = addEntry(key, ENTRY_CONVEX, size);
+		if(data == HK_NULL)
+			return;
+
+		int* header = reinterpret_cast<int*>(data);
+		header[0] = vertices.getSize();
+		header[1] = planes.getSize();
+
+		hkVector4* dest = reinterpret_cast<hkVector4*>(data + ALIGNMENT);
+		for(int i = 0; i < vertices.getSize(); i++)
+			*dest++ = vertices[i];
+		for(int i = 0; i < planes.getSize(); i++)
+			*dest++ = planes[i];
+	}
+
+	void addMopp(hkUint64 key, const hkpMoppCode* code)
+	{
+		int codeSize = code->getCodeSize();
+		hkUint8* data = addEntry(key, ENTRY_MOPP, ALIGNMENT * 2 + codeSize);
+		if(data == HK_NULL)
+			return;
+
+		float* offset = reinterpret_cast<float*>(data);
+		int* header = reinterpret_cast<int*>(data + ALIGNMENT);
+		for(int i = 0; i < 4; i++)
+			offset[i] = code->m_info.m_offset(i);
+		header[0] = code->m_buildType;
+		header[1] = codeSize;
+		memcpy(data + ALIGNMENT * 2, code->m_data.begin(), codeSize);
+	}
+
+	// Writes the mapped entries together with all the ones recorded since they were mapped,
+	// including those an earlier save already wrote. Does nothing if no shape was built since
+	// the last save.
+	bool save()
+	{
+		if(!opened)
+			return false;
+		if(numPending == numSaved)
+			return true;
+
+		const FileHeader* mappedHeader = reinterpret_cast<const FileHeader*>(view);
+		const Entry* mappedEntries = reinterpret_cast<const Entry*>(view + sizeof(FileHeader));
+		int numMapped = (view != HK_NULL) ? mappedHeader->numEntries : 0;
+		int numEntries = numMapped + numPending;
+
+		// Saving may happen between worlds, when there is no Havok heap
+		Entry* entries = static_cast<Entry*>(malloc(numEntries * sizeof(Entry)));
+		const hkUint8** sources = static_cast<const hkUint8**>(malloc(numEntries * sizeof(const hkUint8*)));
+		bool written = writeFile(mappedHeader, mappedEntries, numMapped, entries, sources);
+		free(entries);
+		free(sources);
+
+		if(!written)
+			return false;
+
+		// The mapped view still holds the old file, so the recorded entries stay for later saves
+		numSaved = numPending;
+
+		return true;
+	}
+
+private:
+
+	static int align(int size)
+	{
+		return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
+
+	static bool entryLess(const Entry& a, const Entry& b)
+	{
+		return a.key < b.key;
+	}
+
+	void getNewPath(char* newPath) const
+	{
+		strcpy(newPath, path);
+		strcat(newPath, ".new");
+	}
+
+	// Writes the mapped and the recorded entries to a new file, using entries and sources, which
+	// have room for all of them, to sort them
+	bool writeFile(const FileHeader* mappedHeader, const Entry* mappedEntries, int numMapped, 
+		Entry* entries, const hkUint8** sources) const
+	{
+		if(entries == HK_NULL || sources == HK_NULL)
+			return false;
+
+		int numEntries = 0;
+		for(int i = 0; i < numMapped; i++, numEntries++)
+		{
+			entries[numEntries] = mappedEntries[i];
+			sources[numEntries] = view + mappedHeader->dataOffset + mappedEntries[i].offset;
+		}
+		for(int i = 0; i < numPending; i++, numEntries++)
+		{
+			entries[numEntries] = pendingEntries[i];
+			sources[numEntries] = pendingData + pendingEntries[i].offset;
+		}
+
+		// Sort by key for the binary search on load, carrying each entry's source along
+		for(int i = 0; i < numEntries; i++)
+			entries[i].reserved = i;
+		hkAlgorithm::quickSort(entries, numEntries, entryLess);
+
+		int offset = 0;
+		for(int i = 0; i < numEntries; i++)
+		{
+			entries[i].offset = offset;
+			offset += align(entries[i].size);
+		}
+
+		FileHeader header;
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.numEntries = numEntries;
+		header.dataOffset = align(sizeof(FileHeader) + numEntries * sizeof(Entry));
+
+		char targetPath[MAX_PATH];
+		if(view != HK_NULL)
+			getNewPath(targetPath);
+		else
+			strcpy(targetPath, path);
+
+		FILE* out = fopen(targetPath, "wb");
+		if(out == NULL)
+			return false;
+
+		static const hkUint8 padding[ALIGNMENT] = { 0 };
+		bool written = fwrite(&header, sizeof(FileHeader), 1, out) == 1;
+		for(int i = 0; written && i < numEntries; i++)
+		{
+			Entry entry = entries[i];
+			entry.reserved = 0;
+			written = fwrite(&entry, sizeof(Entry), 1, out) == 1;
+		}
+		int position = sizeof(FileHeader) + numEntries * sizeof(Entry);
+		if(written && header.dataOffset > position)
+			written = fwrite(padding, header.dataOffset - position, 1, out) == 1;
+		for(int i = 0; written && i < numEntries; i++)
+		{
+			int size = entries[i].size;
+			written = fwrite(sources[entries[i].reserved], size, 1, out) == 1;
+			if(written && align(size) > size)
+				written = fwrite(padding, align(size) - size, 1, out) == 1;
+		}
+
+		if(fclose(out) != 0)
+			written = false;
+		if(!written)
+		{
+			remove(targetPath);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Checks that the header, the entry table and the data of every entry of the mapped file
+	// are in bounds and aligned. The sums are done in 64 bits, so a corrupt file cannot wrap
+	// them around.
+	bool validate(DWORD size) const
+	{
+		const FileHeader* header = reinterpret_cast<const FileHeader*>(view);
+		if(header->magic != MAGIC || header->version != VERSION || header->numEntries < 0 ||
+			header->dataOffset < 0 || header->dataOffset % ALIGNMENT != 0)
+			return false;
+
+		hkUint64 tableEnd = sizeof(FileHeader) + (hkUint64)header->numEntries * sizeof(Entry);
+		if(tableEnd > (hkUint64)header->dataOffset || (hkUint64)header->dataOffset > size)
+			return false;
+
+		const Entry* entries = reinterpret_cast<const Entry*>(view + sizeof(FileHeader));
+		for(int i = 0; i < header->numEntries; i++)
+		{
+			if(entries[i].offset < 0 || entries[i].size < 0 || entries[i].offset % ALIGNMENT != 0 ||
+				(hkUint64)header->dataOffset + entries[i].offset + entries[i].size > size)
+				return false;
+		}
+
+		return true;
+	}
+
+	// Returns the data of the entry with the key, and its size, if it has the given type
+	const hkUint8* find(hkUint64 key, int type, int& size) const
+	{
+		if(view == HK_NULL)
+			return HK_NULL;
+
+		const FileHeader* header = reinterpret_cast<const FileHeader*>(view);
+		const Entry* entries = reinterpret_cast<const Entry*>(view + sizeof(FileHeader));
+
+		int low = 0;
+		int high = header->numEntries - 1;
+		while(low <= high)
+		{
+			int mid = (low + high) / 2;
+			if(entries[mid].key < key)
+				low = mid + 1;
+			else if(entries[mid].key > key)
+				high = mid - 1;
+			else if(entries[mid].type != type)
+				return HK_NULL;
+			else
+			{
+				size = entries[mid].size;
+				return view + header->dataOffset + entries[mid].offset;
+			}
+		}
+
+		return HK_NULL;
+	}
+
+	// Reserves space for a new entry, or returns null if the key was already recorded
+	hkUint8* addEntry(hkUint64 key, int type, int size)
+	{
+		if(!opened)
+			return HK_NULL;
+
+		for(int i = 0; i < numPending; i++)
+			if(pendingEntries[i].key == key)
+				return HK_NULL;
+
+		if(numPending == pendingCapacity)
+		{
+			int capacity = hkMath::max2(pendingCapacity * 2, 16);
+			Entry* grown = static_cast<Entry*>(realloc(pendingEntries, capacity * sizeof(Entry)));
+			if(grown == HK_NULL)
+				return HK_NULL;
+
+			pendingEntries = grown;
+			pendingCapacity = capacity;
+		}
+
+		int dataSize = pendingDataSize + align(size);
+		if(dataSize > pendingDataCapacity)
+		{
+			int capacity = hkMath::max2(pendingDataCapacity * 2, dataSize);
+			hkUint8* grown = static_cast<hkUint8*>(realloc(pendingData, capacity));
+			if(grown == HK_NULL)
+				return HK_NULL;
+
+			pendingData = grown;
+			pendingDataCapacity = capacity;
+		}
+
+		Entry& entry = pendingEntries[numPending++];
+		entry.key = key;
+		entry.type = type;
+		entry.offset = pendingDataSize;
+		entry.size = size;
+		entry.reserved = 0;
+
+		pendingDataSize = dataSize;
+		return pendingData + entry.offset;
+	}
+
+	void unmap()
+	{
+		if(view != HK_NULL)
+			UnmapViewOfFile(view);
+		if(mapping != NULL)
+			CloseHandle(mapping);
+		if(file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+
+		view = HK_NULL;
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+	}
+
+	HANDLE file;
+	HANDLE mapping;
+	const hkUint8* view;
+
+	bool opened;
+	char path[MAX_PATH];
+
+	// Every entry recorded since the file was opened. The first numSaved of them were written
+	// by an earlier save.
+	Entry* pendingEntries;
+	int numPending;
+	int pendingCapacity;
+	hkUint8* pendingData;
+	int pendingDataSize;
+	int pendingDataCapacity;
+	int numSaved;
+};
\ No newline at end of file
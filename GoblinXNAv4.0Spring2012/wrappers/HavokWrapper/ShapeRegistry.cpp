@@ -0,0 +1,212 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <Common/Base/hkBase.h>
+#include <Physics/Collide/Shape/hkpShape.h>
+
+#include "ShapeCache.cpp"
+
+// Shares shapes between bodies created with the same shape type and parameters. Shapes are
+// kept in an open-addressed table keyed by a hash of their parameters, and the registry holds
+// a reference to each of them. The type and parameters are kept with each shape and compared
+// on lookup, so two parameter sets with the same hash get shapes of their own. Shapes that no
+// body uses any more are released when the table fills up or when releaseUnused is called.
+class ShapeRegistry
+{
+public:
+
+	enum ShapeType
+	{
+		SHAPE_BOX = 1,
+		SHAPE_SPHERE,
+		SHAPE_CAPSULE,
+		SHAPE_CYLINDER,
+		SHAPE_CONVEX
+	};
+
+	enum
+	{
+		MIN_CAPACITY = 64
+	};
+
+	ShapeRegistry()
+	{
+		count = 0;
+		hits = 0;
+		misses = 0;
+	}
+
+	static hkUint64 getKey(int type, const float* params, int numParams)
+	{
+		hkUint64 h = ShapeCache::hash(ShapeCache::HASH_SEED, &type, sizeof(int));
+		return ShapeCache::hash(h, params, numParams * sizeof(float));
+	}
+
+	// Gathers the vertices followed by the convex radius as the parameters of a convex shape
+	static void getConvexParams(int numVertices, const float* vertices, int stride, float convexRadius,
+		hkArray<float>& params)
+	{
+		params.setSize(numVertices * 3 + 1);
+		const char* vertex = reinterpret_cast<const char*>(vertices);
+		for(int i = 0; i < numVertices; i++, vertex += stride)
+			memcpy(&params[i * 3], vertex, 3 * sizeof(float));
+		params[numVertices * 3] = convexRadius;
+	}
+
+	// Returns a new reference to the shape registered with the type and parameters, or null if
+	// there is none
+	hkpShape* find(int type, const float* params, int numParams)
+	{
+		int slot = findSlot(getKey(type, params, numParams), type, params, numParams);
+		if(slot < 0 || entries[slot].shape == HK_NULL)
+		{
+			misses++;
+			return HK_NULL;
+		}
+
+		hits++;
+		entries[slot].shape->addReference();
+		return entries[slot].shape;
+	}
+
+	// Registers a newly created shape with its type and parameters and returns it. The caller
+	// keeps the reference it has.
+	hkpShape* add(int type, const float* params, int numParams, hkpShape* shape)
+	{
+		if((count + 1) * 2 > entries.getSize())
+		{
+			releaseUnused();
+			if((count + 1) * 2 > entries.getSize())
+				rehash(hkMath::max2(entries.getSize() * 2, (int)MIN_CAPACITY), false);
+		}
+
+		insert(getKey(type, params, numParams), type, params, numParams, shape);
+		shape->addReference();
+
+		return shape;
+	}
+
+	// Drops the registry's reference to every shape that no body uses any more
+	void releaseUnused()
+	{
+		rehash(entries.getSize(), true);
+	}
+
+	void clear()
+	{
+		for(int i = 0; i < entries.getSize(); i++)
+			if(entries[i].shape != HK_NULL)
+				entries[i].shape->removeReference();
+
+		entries.clearAndDeallocate();
+		params.clearAndDeallocate();
+		count = 0;
+	}
+
+	int getHits() const
+	{
+		return hits;
+	}
+
+	int getMisses() const
+	{
+		return misses;
+	}
+
+	// Number of registered shapes referenced by something other than the registry
+	int getLiveShapes() const
+	{
+		int live = 0;
+		for(int i = 0; i < entries.getSize(); i++)
+			if(entries[i].shape != HK_NULL && entries[i].shape->getReferenceCount() > 1)
+				live++;
+
+		return live;
+	}
+
+private:
+
+	// The parameters of an entry are numParams floats of params from firstParam on
+	struct Entry
+	{
+		hkUint64 key;
+		hkpShape* shape;
+		int type;
+		int firstParam;
+		int numParams;
+	};
+
+	bool matches(const Entry& entry, hkUint64 key, int type, const float* _params, int numParams) const
+	{
+		return entry.key == key && entry.type == type && entry.numParams == numParams &&
+			memcmp(params.begin() + entry.firstParam, _params, numParams * sizeof(float)) == 0;
+	}
+
+	// Returns the slot holding the shape or the empty slot where it would go, or -1 if the
+	// table has not been allocated yet
+	int findSlot(hkUint64 key, int type, const float* _params, int numParams) const
+	{
+		if(entries.getSize() == 0)
+			return -1;
+
+		int mask = entries.getSize() - 1;
+		int slot = (int)(key ^ (key >> 32)) & mask;
+		while(entries[slot].shape != HK_NULL && !matches(entries[slot], key, type, _params, numParams))
+			slot = (slot + 1) & mask;
+
+		return slot;
+	}
+
+	void insert(hkUint64 key, int type, const float* _params, int numParams, hkpShape* shape)
+	{
+		int slot = findSlot(key, type, _params, numParams);
+		Entry& entry = entries[slot];
+		entry.key = key;
+		entry.shape = shape;
+		entry.type = type;
+		entry.firstParam = params.getSize();
+		entry.numParams = numParams;
+
+		float* dest = params.expandBy(numParams);
+		memcpy(dest, _params, numParams * sizeof(float));
+		count++;
+	}
+
+	// Also compacts the parameters, dropping those of the released shapes
+	void rehash(int capacity, bool dropUnused)
+	{
+		hkArray<Entry> old;
+		old.swap(entries);
+		hkArray<float> oldParams;
+		oldParams.swap(params);
+
+		Entry empty;
+		empty.key = 0;
+		empty.shape = HK_NULL;
+		empty.type = 0;
+		empty.firstParam = 0;
+		empty.numParams = 0;
+		entries.setSize(capacity, empty);
+		count = 0;
+
+		for(int i = 0; i < old.getSize(); i++)
+		{
+			hkpShape* shape = old[i].shape;
+			if(shape == HK_NULL)
+				continue;
+
+			if(dropUnused && shape->getReferenceCount() == 1)
+				shape->removeReference();
+			else
+				insert(old[i].key, old[i].type, oldParams.begin() + old[i].firstParam, old[i].numParams, shape);
+		}
+	}
+
+	hkArray<Entry> entries;
+	hkArray<float> params;
+	int count;
+	int hits;
+	int misses;
+};
\ No newline at end of file
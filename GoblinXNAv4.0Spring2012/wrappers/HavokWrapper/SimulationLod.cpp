@@ -0,0 +1,347 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Common/Base/hkBase.h>
+
+#include <Physics/Dynamics/World/hkpWorld.h>
+#include <Physics/Dynamics/World/hkpSimulationIsland.h>
+#include <Physics/Dynamics/Entity/hkpRigidBody.h>
+
+#include "BodySlotMap.cpp"
+
+// Coarsens the simulation of the bodies far from a focus point, usually the camera or the
+// player. Distance bands decide what happens to a body: beyond the distance of a band, its
+// island is deactivated, its dynamic bodies are frozen as keyframed bodies, or the island only
+// runs every few steps and sleeps in between. An island is judged by its body nearest to the
+// focus, so a far body touching a near one keeps being simulated. Bodies go back to normal when
+// they move into another band, and sleeping islands keep their velocities while asleep.
+class SimulationLod
+{
+public:
+
+	enum Mode
+	{
+		MODE_DEACTIVATE,
+		MODE_KEYFRAME,
+		MODE_REDUCED
+	};
+
+	struct Band
+	{
+		float distance;
+		int mode;
+		int interval;
+	};
+
+	enum
+	{
+		MAX_BANDS = 8
+	};
+
+	SimulationLod()
+	{
+		focus.setZero4();
+		numBands = 0;
+	}
+
+	void setFocus(float x, float y, float z)
+	{
+		focus.set(x, y, z);
+	}
+
+	// Sets the bands, sorted by increasing distance. Bodies that already changed keep their
+	// state until the next update moves them into their new band. The caller must make sure
+	// no step is running.
+	void setBands(const Band* _bands, int count)
+	{
+		numBands = 0;
+		for(int i = 0; i < count && numBands < MAX_BANDS; i++)
+		{
+			if(numBands > 0 && _bands[i].distance <= bands[numBands - 1].distance)
+				continue;
+
+			bands[numBands] = _bands[i];
+			if(bands[numBands].interval < 1)
+				bands[numBands].interval = 1;
+			numBands++;
+		}
+	}
+
+	// Returns true while there are bands or bodies still changed by earlier ones
+	bool isActive() const
+	{
+		return numBands > 0 || changed.getSize() > 0;
+	}
+
+	// Restores the bodies changed by the bands and applies the bands to the active islands.
+	// Called on the stepping thread right before the world is stepped, with the world locked.
+	void update(hkpWorld* world, const BodySlotMap& bodies, int step)
+	{
+		restore(bodies, step);
+
+		if(numBands == 0)
+			return;
+
+		// Islands change as bodies are deactivated or keyframed, so pick them all first
+		const hkArray<hkpSimulationIsland*>& islands = world->getActiveSimulationIslands();
+		for(int i = 0; i < islands.getSize(); i++)
+		{
+			const hkArray<hkpEntity*>& entities = islands[i]->getEntities();
+			int band = getIslandBand(entities);
+			if(band < 0)
+				continue;
+
+			int phase = BodySlotMap::getIndex(BodySlotMap::getHandle(entities[0]));
+			if(bands[band].mode == MODE_REDUCED && (step + phase) % bands[band].interval == 0)
+				continue;
+
+			for(int j = 0; j < entities.getSize(); j++)
+			{
+				Pick pick = { static_cast<hkpRigidBody*>(entities[j]), band, phase, j == 0 };
+				picked.pushBack(pick);
+			}
+		}
+
+		for(int i = 0; i < picked.getSize(); i++)
+			change(picked[i]);
+
+		// Only once every body of an island has its velocities saved
+		for(int i = 0; i < picked.getSize(); i++)
+			if(picked[i].first && bands[picked[i].band].mode != MODE_KEYFRAME)
+				picked[i].body->deactivate();
+
+		picked.clear();
+	}
+
+	// Gives a body that is about to leave the world back its motion type and velocities. The
+	// caller must hold the world lock.
+	void release(hkpRigidBody* body)
+	{
+		if(body == HK_NULL)
+			return;
+
+		int handle = BodySlotMap::getHandle(body);
+		int slot = BodySlotMap::getIndex(handle);
+		if(handle < 0 || slot >= entries.getSize() || entries[slot].handle != handle)
+			return;
+
+		Entry& entry = entries[slot];
+		if(entry.mode == MODE_KEYFRAME)
+			body->setMotionType(entry.motionType);
+		if(entry.mode != MODE_DEACTIVATE)
+		{
+			body->setLinearVelocity(entry.linearVelocity);
+			body->setAngularVelocity(entry.angularVelocity);
+		}
+
+		drop(slot);
+	}
+
+	// Counts the bodies currently changed by each mode
+	void getCounts(int& deactivated, int& keyframed, int& reduced) const
+	{
+		deactivated = 0;
+		keyframed = 0;
+		reduced = 0;
+
+		for(int i = 0; i < changed.getSize(); i++)
+		{
+			int mode = entries[changed[i]].mode;
+			if(mode == MODE_DEACTIVATE)
+				deactivated++;
+			else if(mode == MODE_KEYFRAME)
+				keyframed++;
+			else
+				reduced++;
+		}
+	}
+
+	// Forgets the bands and the changed bodies without touching them, for when the world goes
+	void clear()
+	{
+		numBands = 0;
+		entries.clearAndDeallocate();
+		changed.clearAndDeallocate();
+		picked.clearAndDeallocate();
+	}
+
+private:
+
+	struct Entry
+	{
+		hkVector4 linearVelocity;
+		hkVector4 angularVelocity;
+		int handle;
+		int index;
+		int band;
+		int mode;
+		int phase;
+		hkpMotion::MotionType motionType;
+	};
+
+	struct Pick
+	{
+		hkpRigidBody* body;
+		int band;
+		int phase;
+		bool first;
+	};
+
+	// Returns the farthest band the squared distance lies beyond, or -1 for none
+	int getBand(hkReal distanceSquared) const
+	{
+		int band = -1;
+		for(int i = 0; i < numBands && distanceSquared >= bands[i].distance * bands[i].distance; i++)
+			band = i;
+
+		return band;
+	}
+
+	int getBodyBand(const hkpRigidBody* body) const
+	{
+		hkVector4 d;
+		d.setSub4(body->getPosition(), focus);
+		return getBand(d.lengthSquared3());
+	}
+
+	// Returns the band of the body nearest to the focus, or -1 if the island has to keep
+	// running because it is near or has a body that must not deactivate
+	int getIslandBand(const hkArray<hkpEntity*>& entities) const
+	{
+		hkReal nearest = HK_REAL_MAX;
+		bool canSleep = true;
+		for(int i = 0; i < entities.getSize(); i++)
+		{
+			const hkpRigidBody* body = static_cast<const hkpRigidBody*>(entities[i]);
+			hkVector4 d;
+			d.setSub4(body->getPosition(), focus);
+			nearest = hkMath::min2(nearest, d.lengthSquared3());
+			canSleep = canSleep && body->isDeactivationEnabled();
+		}
+
+		int band = getBand(nearest);
+		if(band >= 0 && bands[band].mode != MODE_KEYFRAME && !canSleep)
+			return -1;
+
+		return band;
+	}
+
+	void change(const Pick& pick)
+	{
+		hkpRigidBody* body = pick.body;
+		int handle = BodySlotMap::getHandle(body);
+		if(handle < 0)
+			return;
+
+		int mode = bands[pick.band].mode;
+		hkpMotion::MotionType motionType = body->getMotionType();
+		if(mode == MODE_KEYFRAME && (motionType == hkpMotion::MOTION_KEYFRAMED || motionType == hkpMotion::MOTION_FIXED))
+			return;
+
+		int slot = BodySlotMap::getIndex(handle);
+		if(slot >= entries.getSize())
+		{
+			int oldSize = entries.getSize();
+			entries.setSize(slot + 1);
+			for(int i = oldSize; i <= slot; i++)
+				entries[i].handle = BodySlotMap::INVALID_HANDLE;
+		}
+
+		Entry& entry = entries[slot];
+		if(entry.handle == BodySlotMap::INVALID_HANDLE)
+		{
+			entry.index = changed.getSize();
+			changed.pushBack(slot);
+		}
+
+		entry.handle = handle;
+		entry.band = pick.band;
+		entry.mode = mode;
+		entry.phase = pick.phase;
+		entry.motionType = motionType;
+		entry.linearVelocity = body->getLinearVelocity();
+		entry.angularVelocity = body->getAngularVelocity();
+
+		if(mode == MODE_KEYFRAME)
+		{
+			body->setMotionType(hkpMotion::MOTION_KEYFRAMED);
+			body->setLinearVelocity(hkVector4::getZero());
+			body->setAngularVelocity(hkVector4::getZero());
+		}
+	}
+
+	// Brings back the changed bodies that moved into another band, were woken by something
+	// else, or whose island is due for a reduced step
+	void restore(const BodySlotMap& bodies, int step)
+	{
+		for(int i = changed.getSize() - 1; i >= 0; i--)
+		{
+			int slot = changed[i];
+			Entry& entry = entries[slot];
+			hkpRigidBody* body = bodies.get(entry.handle);
+			if(body == HK_NULL || body->getWorld() == HK_NULL)
+			{
+				drop(slot);
+				continue;
+			}
+
+			int band = getBodyBand(body);
+			bool moved = (band != entry.band || bands[band].mode != entry.mode);
+
+			if(entry.mode == MODE_KEYFRAME)
+			{
+				if(!moved)
+					continue;
+
+				body->setMotionType(entry.motionType);
+			}
+			else if(entry.mode == MODE_DEACTIVATE)
+			{
+				// An island woken by something else is picked again below if it is still far
+				if(moved && !body->isActive())
+					body->activate();
+				else if(!body->isActive())
+					continue;
+
+				drop(slot);
+				continue;
+			}
+			else
+			{
+				bool due = ((step + entry.phase) % bands[entry.band].interval == 0);
+				if(!moved && !due && !body->isActive())
+					continue;
+
+				body->activate();
+			}
+
+			body->setLinearVelocity(entry.linearVelocity);
+			body->setAngularVelocity(entry.angularVelocity);
+			drop(slot);
+		}
+	}
+
+	void drop(int slot)
+	{
+		int index = entries[slot].index;
+		int last = changed[changed.getSize() - 1];
+		changed[index] = last;
+		entries[last].index = index;
+		changed.popBack();
+
+		entries[slot].handle = BodySlotMap::INVALID_HANDLE;
+	}
+
+	hkVector4 focus;
+	Band bands[MAX_BANDS];
+	int numBands;
+
+	// Indexed by body slot
+	hkArray<Entry> entries;
+
+	// The slots of the changed bodies
+	hkArray<int> changed;
+
+	hkArray<Pick> picked;
+};
\ No newline at end of file
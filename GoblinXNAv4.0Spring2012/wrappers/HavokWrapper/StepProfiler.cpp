@@ -0,0 +1,351 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/Monitor/hkMonitorStream.h>
+#include <Common/Base/Monitor/MonitorStreamAnalyzer/hkMonitorStreamAnalyzer.h>
+#include <Common/Base/System/Stopwatch/hkStopwatch.h>
+#include <Common/Base/Thread/Thread/hkThread.h>
+#include <Common/Base/Thread/Job/ThreadPool/hkJobThreadPool.h>
+
+#include <Physics/Dynamics/World/hkpWorld.h>
+#include <Physics/Dynamics/World/hkpSimulationIsland.h>
+#include <Physics/Dynamics/Entity/hkpRigidBody.h>
+#include <Physics/Dynamics/Collide/ContactListener/hkpContactListener.h>
+#include <Physics/Dynamics/Constraint/hkpConstraintInstance.h>
+#include <Physics/Dynamics/Constraint/Contact/hkpSimpleContactConstraintData.h>
+
+// Records where the time of every world step goes, using the Havok monitor stream of the
+// stepping thread and of the worker threads. The timers are sorted into a few categories by
+// name; a timer gets its own time minus that of its children, so nested timers are not counted
+// twice. Times of the worker threads are summed, so in a multithreaded world the categories
+// can add up to more than the total. Steps are kept in a ring buffer until read, and can also
+// be written to a CSV file as they are recorded. Profiling may be enabled before init_world
+// brings up the Havok memory system, so the ring buffer comes from malloc.
+class StepProfiler : public hkpContactListener
+{
+public:
+
+	struct Stats
+	{
+		float total;
+		float broadphase;
+		float narrowphase;
+		float solver;
+		float integrate;
+		float toi;
+		float callbacks;
+		float other;
+		int activeIslands;
+		int activeBodies;
+		int contactPoints;
+		int toiEvents;
+	};
+
+	enum
+	{
+		MONITOR_BUFFER_SIZE = 2 * 1024 * 1024,
+		DEFAULT_HISTORY_SIZE = 256
+	};
+
+	StepProfiler()
+	{
+		enabled = false;
+		world = HK_NULL;
+		csvFile = HK_NULL;
+		monitorThreadId = 0;
+		history = HK_NULL;
+		historySize = 0;
+		next = 0;
+		count = 0;
+		toiEvents = 0;
+	}
+
+	~StepProfiler()
+	{
+		disable();
+	}
+
+	void enable(int _historySize, const char* csvPath)
+	{
+		disable();
+
+		historySize = (_historySize > 0) ? _historySize : DEFAULT_HISTORY_SIZE;
+		history = static_cast<Stats*>(malloc(historySize * sizeof(Stats)));
+		if(history == HK_NULL)
+		{
+			historySize = 0;
+			return;
+		}
+		next = 0;
+		count = 0;
+
+		if(csvPath != HK_NULL)
+		{
+			csvFile = fopen(csvPath, "w");
+			if(csvFile != HK_NULL)
+				fprintf(csvFile, "total,broadphase,narrowphase,solver,integrate,toi,callbacks,other,"
+					"activeIslands,activeBodies,contactPoints,toiEvents\n");
+		}
+
+		enabled = true;
+	}
+
+	void disable()
+	{
+		detach();
+
+		if(csvFile != HK_NULL)
+		{
+			fclose(csvFile);
+			csvFile = HK_NULL;
+		}
+
+		free(history);
+		history = HK_NULL;
+		historySize = 0;
+		next = 0;
+		count = 0;
+		monitorThreadId = 0;
+		enabled = false;
+	}
+
+	bool isEnabled() const
+	{
+		return enabled;
+	}
+
+	// Stops counting the TOI events of the world, which must happen before it is destroyed
+	void detach()
+	{
+		if(world != HK_NULL)
+		{
+			world->lock();
+			world->removeContactListener(this);
+			world->unlock();
+			world = HK_NULL;
+		}
+	}
+
+	// Called on the stepping thread right before the world is stepped
+	void beginStep(hkpWorld* _world, hkJobThreadPool* threadPool)
+	{
+		if(world != _world)
+		{
+			detach();
+			world = _world;
+			world->lock();
+			world->addContactListener(this);
+			world->unlock();
+		}
+
+		// The monitor stream belongs to the thread, and the step may move to the step thread
+		hkUint64 threadId = hkThread::getMyThreadId();
+		if(monitorThreadId != threadId)
+		{
+			hkMonitorStream::getInstance().resize(MONITOR_BUFFER_SIZE);
+			monitorThreadId = threadId;
+		}
+
+		hkMonitorStream::getInstance().reset();
+		if(threadPool != HK_NULL)
+			threadPool->clearTimerData();
+
+		toiEvents = 0;
+		stopwatch.reset();
+		stopwatch.start();
+	}
+
+	// Called on the stepping thread right after the world was stepped
+	void endStep(hkJobThreadPool* threadPool)
+	{
+		stopwatch.stop();
+
+		Stats& stats = history[next];
+		memset(&stats, 0, sizeof(Stats));
+		stats.total = stopwatch.getElapsedSeconds() * 1000.0f;
+
+		hkMonitorStream& stream = hkMonitorStream::getInstance();
+		addTimers(stats, stream.getStart(), stream.getEnd());
+
+		if(threadPool != HK_NULL)
+		{
+			hkArray<hkTimerData> timerData;
+			threadPool->appendTimerData(timerData, hkContainerHeapAllocator::s_alloc);
+			for(int i = 0; i < timerData.getSize(); i++)
+				addTimers(stats, timerData[i].m_streamBegin, timerData[i].m_streamEnd);
+		}
+
+		addCounters(stats);
+		stats.toiEvents = toiEvents;
+
+		if(csvFile != HK_NULL)
+			fprintf(csvFile, "%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%d,%d,%d,%d\n",
+				stats.total, stats.broadphase, stats.narrowphase, stats.solver, stats.integrate,
+				stats.toi, stats.callbacks, stats.other, stats.activeIslands, stats.activeBodies,
+				stats.contactPoints, stats.toiEvents);
+
+		next = (next + 1) % historySize;
+		if(count < historySize)
+			count++;
+
+		if(csvFile != HK_NULL && next == 0)
+			fflush(csvFile);
+	}
+
+	// Copies up to maxStats of the steps recorded since the last call, oldest first, and
+	// returns how many were copied. Steps that did not fit are discarded.
+	int drain(Stats* out, int maxStats)
+	{
+		int copied = hkMath::min2(count, maxStats);
+		int first = next - copied;
+		if(first < 0)
+			first += historySize;
+
+		for(int i = 0; i < copied; i++)
+			out[i] = history[(first + i) % historySize];
+
+		count = 0;
+
+		return copied;
+	}
+
+	void contactPointCallback( const hkpContactPointEvent& evt )
+	{
+		if(evt.m_type == hkpContactPointEvent::TYPE_TOI)
+			InterlockedIncrement(&toiEvents);
+	}
+
+private:
+
+	static void addTimers(Stats& stats, const char* start, const char* end)
+	{
+		if(start == HK_NULL || start == end)
+			return;
+
+		hkMonitorStreamFrameInfo frameInfo;
+		frameInfo.m_heading = "";
+		frameInfo.m_indexOfTimer0 = 0;
+		frameInfo.m_indexOfTimer1 = -1;
+		frameInfo.m_absoluteTimeCounter = hkMonitorStreamFrameInfo::ABSOLUTE_TIME_TIMER_0;
+		frameInfo.m_timerFactor0 = 1000.0f / float(hkStopwatch::getTicksPerSecond());
+		frameInfo.m_timerFactor1 = 1;
+
+		hkMonitorStreamAnalyzer::Node* root =
+			hkMonitorStreamAnalyzer::makeStatisticsTreeForSingleFrame(start, end, frameInfo, "/", false);
+		if(root == HK_NULL)
+			return;
+
+		addNode(stats, root, HK_NULL);
+		delete root;
+	}
+
+	// Adds the time spent in a timer itself to the category of the timer or, if its name does
+	// not match any, to that of the closest enclosing timer
+	static void addNode(Stats& stats, const hkMonitorStreamAnalyzer::Node* node, float* category)
+	{
+		float* own = getCategory(stats, node->m_name);
+		if(own != HK_NULL)
+			category = own;
+
+		float selfTime = 0;
+		if(node->m_type == hkMonitorStreamAnalyzer::Node::NODE_TYPE_TIMER)
+		{
+			selfTime = node->m_value[0];
+			for(int i = 0; i < node->m_children.getSize(); i++)
+				if(node->m_children[i]->m_type == hkMonitorStreamAnalyzer::Node::NODE_TYPE_TIMER)
+					selfTime -= node->m_children[i]->m_value[0];
+		}
+
+		if(selfTime > 0)
+			*(category != HK_NULL ? category : &stats.other) += selfTime;
+
+		for(int i = 0; i < node->m_children.getSize(); i++)
+			addNode(stats, node->m_children[i], category);
+	}
+
+	static float* getCategory(Stats& stats, const char* name)
+	{
+		if(name == HK_NULL)
+			return HK_NULL;
+
+		if(contains(name, "broad"))
+			return &stats.broadphase;
+		if(contains(name, "narrow") || contains(name, "agent") || contains(name, "collide"))
+			return &stats.narrowphase;
+		if(contains(name, "solv") || contains(name, "constraint"))
+			return &stats.solver;
+		if(contains(name, "integrat"))
+			return &stats.integrate;
+		if(contains(name, "toi"))
+			return &stats.toi;
+		if(contains(name, "callback") || contains(name, "listener") || strstr(name, "CB") != HK_NULL)
+			return &stats.callbacks;
+
+		return HK_NULL;
+	}
+
+	// Case insensitive search for a lower case word
+	static bool contains(const char* name, const char* word)
+	{
+		int length = (int)strlen(word);
+		for(; *name != 0; name++)
+		{
+			int i = 0;
+			while(i < length && name[i] != 0 && (name[i] | 0x20) == word[i])
+				i++;
+
+			if(i == length)
+				return true;
+		}
+
+		return false;
+	}
+
+	// Counts the active islands and bodies, and the contact points of the contact constraints
+	// mastered by the active bodies, so that every constraint is counted once
+	void addCounters(Stats& stats)
+	{
+		world->markForRead();
+
+		const hkArray<hkpSimulationIsland*>& activeIslands = world->getActiveSimulationIslands();
+		stats.activeIslands = activeIslands.getSize();
+
+		for(int i = 0; i < activeIslands.getSize(); i++)
+		{
+			const hkArray<hkpEntity*>& entities = activeIslands[i]->getEntities();
+			stats.activeBodies += entities.getSize();
+
+			for(int j = 0; j < entities.getSize(); j++)
+			{
+				const hkSmallArray<hkConstraintInternal>& masters = entities[j]->getConstraintMasters();
+				for(int k = 0; k < masters.getSize(); k++)
+				{
+					const hkpConstraintData* data = masters[k].m_constraint->getData();
+					if(data->getType() == hkpConstraintData::CONSTRAINT_TYPE_CONTACT)
+						stats.contactPoints +=
+							static_cast<const hkpSimpleContactConstraintData*>(data)->getNumContactPoints();
+				}
+			}
+		}
+
+		world->unmarkForRead();
+	}
+
+	bool enabled;
+	hkpWorld* world;
+	FILE* csvFile;
+	hkUint64 monitorThreadId;
+	hkStopwatch stopwatch;
+
+	Stats* history;
+	int historySize;
+	int next;
+	int count;
+
+	volatile LONG toiEvents;
+};
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/System/hkBaseSystem.h>
+#include <Common/Base/Memory/System/hkMemorySystem.h>
+#include <Common/Base/Thread/Thread/hkThread.h>
+#include <Common/Base/Thread/Semaphore/hkSemaphore.h>
+
+typedef void (*stepFunction)(float elapsedSeconds, int numSteps);
+
+// Runs world steps on a background thread so that they overlap with whatever the caller does
+// between beginStep and endStep. The thread is started on the first step and parked on a
+// semaphore between steps.
+class StepThread
+{
+public:
+
+	StepThread()
+	{
+		step = NULL;
+		ownerThreadId = 0;
+		running = false;
+		stepping = false;
+		quit = false;
+	}
+
+	void start(stepFunction function)
+	{
+		if(running)
+			return;
+
+		step = function;
+		quit = false;
+		running = true;
+		thread.startThread(threadMain, this, "PhysicsStepThread");
+	}
+
+	void stop()
+	{
+		if(!running)
+			return;
+
+		endStep();
+
+		quit = true;
+		startSemaphore.release();
+		thread.joinThread();
+
+		running = false;
+	}
+
+	void beginStep(float _elapsedSeconds, int _numSteps)
+	{
+		ownerThreadId = hkThread::getMyThreadId();
+		elapsedSeconds = _elapsedSeconds;
+		numSteps = _numSteps;
+		stepping = true;
+
+		startSemaphore.release();
+	}
+
+	// Blocks until the step started by beginStep has finished
+	void endStep()
+	{
+		if(!stepping)
+			return;
+
+		doneSemaphore.acquire();
+		stepping = false;
+	}
+
+	bool isRunning() const
+	{
+		return running;
+	}
+
+	bool isStepping() const
+	{
+		return stepping;
+	}
+
+	// Whether the caller is the thread that started the current step
+	bool isOwnerThread() const
+	{
+		return ownerThreadId == hkThread::getMyThreadId();
+	}
+
+private:
+
+	static void* HK_CALL threadMain(void* arg)
+	{
+		StepThread* self = static_cast<StepThread*>(arg);
+		hkMemoryRouter memoryRouter;
+		hkMemorySystem::getInstance().threadInit(memoryRouter, "PhysicsStepThread");
+		hkBaseSystem::initThread(&memoryRouter);
+
+		while(true)
+		{
+			self->startSemaphore.acquire();
+			if(self->quit)
+				break;
+
+			self->step(self->elapsedSeconds, self->numSteps);
+
+			self->doneSemaphore.release();
+		}
+
+		hkBaseSystem::clearThreadResources();
+		hkMemorySystem::getInstance().threadQuit(memoryRouter);
+
+		return HK_NULL;
+	}
+
+	hkThread thread;
+	hkSemaphore startSemaphore;
+	hkSemaphore doneSemaphore;
+
+	stepFunction step;
+	float elapsedSeconds;
+	int numSteps;
+
+	hkUint64 ownerThreadId;
+	volatile bool quit;
+	bool running;
+	volatile bool stepping;
+};
\ No newline at end of file
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdlib.h>
+#include <windows.h>
+
+#include <Common/Base/hkBase.h>
+
+#include <Physics/Collide/Dispatch/hkpCollisionDispatcher.h>
+#include <Physics/Dynamics/World/hkpWorld.h>
+#include <Physics/Dynamics/Collide/ContactListener/hkpContactListener.h>
+
+// Counts the TOI events of every world step and keeps them within a budget. Bodies of quality
+// HK_COLLIDABLE_QUALITY_USER collide like bullets until a step goes over the budget. From then
+// on they fall back to discrete collisions until the steps have stayed within the budget for a
+// while. The fallback rewrites their row of the collision quality table. Collision agents keep
+// the quality they were created with, so it reaches a fast body as soon as it gets new
+// neighbours, which for bullets is within a step or two.
+class ToiBudget : public hkpContactListener
+{
+public:
+
+	enum
+	{
+		BUDGET_QUALITY = HK_COLLIDABLE_QUALITY_USER,
+		HISTORY_SIZE = 256,
+		DEFAULT_RECOVERY_STEPS = 30
+	};
+
+	ToiBudget()
+	{
+		world = HK_NULL;
+		maxToisPerStep = 0;
+		recoverySteps = DEFAULT_RECOVERY_STEPS;
+		fallback = false;
+		stepsWithinBudget = 0;
+		toiEvents = 0;
+		next = 0;
+		count = 0;
+	}
+
+	// Starts counting the TOI events of the world and lets the budgeted bodies collide like
+	// bullets. The caller must hold the world lock.
+	void attach(hkpWorld* _world)
+	{
+		world = _world;
+		world->addContactListener(this);
+
+		hkpCollisionDispatcher* dispatcher = world->getCollisionDispatcher();
+		int bullet = HK_COLLIDABLE_QUALITY_BULLET;
+		for(int i = 0; i < HK_COLLIDABLE_QUALITY_MAX; i++)
+			continuous[i] = dispatcher->m_collisionQualityTable[bullet][i];
+		continuous[BUDGET_QUALITY] = dispatcher->m_collisionQualityTable[bullet][bullet];
+
+		fallback = false;
+		stepsWithinBudget = 0;
+		toiEvents = 0;
+		next = 0;
+		count = 0;
+		applyRow();
+	}
+
+	// Must happen before the world is destroyed
+	void detach()
+	{
+		if(world != HK_NULL)
+		{
+			world->lock();
+			world->removeContactListener(this);
+			world->unlock();
+			world = HK_NULL;
+		}
+	}
+
+	// A budget of 0 turns the fallback off. The caller must hold the world lock.
+	void setBudget(int _maxToisPerStep, int _recoverySteps)
+	{
+		maxToisPerStep = hkMath::max2(_maxToisPerStep, 0);
+		recoverySteps = hkMath::max2(_recoverySteps, 0);
+
+		if(fallback && maxToisPerStep == 0)
+		{
+			fallback = false;
+			applyRow();
+		}
+	}
+
+	// Sets the collision quality level of a pair of body qualities. For pairs with the budgeted
+	// quality, this is the level used while within the budget. Only collision agents created
+	// afterwards are affected. The caller must hold the world lock.
+	void setQuality(int quality1, int quality2, int level)
+	{
+		hkpCollisionDispatcher* dispatcher = world->getCollisionDispatcher();
+		if(quality1 == BUDGET_QUALITY || quality2 == BUDGET_QUALITY)
+		{
+			int other = (quality1 == BUDGET_QUALITY) ? quality2 : quality1;
+			continuous[other] = (hkUint8)level;
+			applyRow();
+		}
+		else
+		{
+			dispatcher->m_collisionQualityTable[quality1][quality2] = (hkUint8)level;
+			dispatcher->m_collisionQualityTable[quality2][quality1] = (hkUint8)level;
+		}
+	}
+
+	bool isFallback() const
+	{
+		return fallback;
+	}
+
+	// Called on the stepping thread right after the world was stepped
+	void endStep()
+	{
+		int tois = InterlockedExchange(&toiEvents, 0);
+
+		history[next] = tois;
+		next = (next + 1) % HISTORY_SIZE;
+		if(count < HISTORY_SIZE)
+			count++;
+
+		if(maxToisPerStep == 0)
+			return;
+
+		bool changed = false;
+		if(tois > maxToisPerStep)
+		{
+			stepsWithinBudget = 0;
+			changed = !fallback;
+			fallback = true;
+		}
+		else if(fallback && ++stepsWithinBudget >= recoverySteps)
+		{
+			changed = true;
+			fallback = false;
+		}
+
+		if(changed)
+		{
+			world->lock();
+			applyRow();
+			world->unlock();
+		}
+	}
+
+	// Copies up to maxCounts of the TOI counts of the steps since the last call, oldest first,
+	// and returns how many were copied. Steps that did not fit are discarded.
+	int drain(int* out, int maxCounts)
+	{
+		int copied = hkMath::min2(count, maxCounts);
+		int first = next - copied;
+		if(first < 0)
+			first += HISTORY_SIZE;
+
+		for(int i = 0; i < copied; i++)
+			out[i] = history[(first + i) % HISTORY_SIZE];
+
+		count = 0;
+
+		return copied;
+	}
+
+	void contactPointCallback( const hkpContactPointEvent& evt )
+	{
+		if(evt.m_type == hkpContactPointEvent::TYPE_TOI)
+			InterlockedIncrement(&toiEvents);
+	}
+
+private:
+
+	// Writes the row and column of the budgeted quality, discrete during the fallback
+	void applyRow()
+	{
+		hkpCollisionDispatcher* dispatcher = world->getCollisionDispatcher();
+		for(int i = 0; i < HK_COLLIDABLE_QUALITY_MAX; i++)
+		{
+			hkUint8 level = fallback ? (hkUint8)hkpCollisionDispatcher::COLLISION_QUALITY_PSI : continuous[i];
+			dispatcher->m_collisionQualityTable[BUDGET_QUALITY][i] = level;
+			dispatcher->m_collisionQualityTable[i][BUDGET_QUALITY] = level;
+		}
+	}
+
+	hkpWorld* world;
+	int maxToisPerStep;
+	int recoverySteps;
+	bool fallback;
+	int stepsWithinBudget;
+
+	// The levels of the budgeted quality while within the budget
+	hkUint8 continuous[HK_COLLIDABLE_QUALITY_MAX];
+
+	volatile LONG toiEvents;
+	int history[HISTORY_SIZE];
+	int next;
+	int count;
+};
\ No newline at end of file
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/Thread/CriticalSection/hkCriticalSection.h>
+#include <Common/Base/Container/PointerMap/hkPointerMap.h>
+
+#include <Physics/Collide/Shape/hkpShape.h>
+
+#include "BodySlotMap.cpp"
+
+// Writes the wrapper calls that change the simulation into a binary trace, so that a session
+// can be replayed headless. The trace starts with a header, followed by one record per call:
+// the call id, the size of the arguments in bytes and the arguments themselves. Shapes are
+// recorded by the address they had while recording, which the replay maps to the shapes it
+// creates itself. Calls may be recorded from the stepping threads, hence the lock. Recording
+// starts before init_world brings up the Havok memory system, so the record is kept in memory
+// from malloc.
+class TraceRecorder
+{
+public:
+
+	enum
+	{
+		MAGIC = 0x434b5248, // "HRKC"
+		VERSION = 2
+	};
+
+	enum Call
+	{
+		CALL_SET_MEMORY_OPTIONS = 1,
+		CALL_INIT_WORLD,
+		CALL_INIT_WORLD_MT,
+		CALL_CREATE_BOX_SHAPE,
+		CALL_CREATE_SPHERE_SHAPE,
+		CALL_CREATE_TRIANGLE_SHAPE,
+		CALL_CREATE_CAPSULE_SHAPE,
+		CALL_CREATE_CYLINDER_SHAPE,
+		CALL_CREATE_CONVEX_SHAPE,
+		CALL_CREATE_MESH_SHAPE,
+		CALL_CREATE_PHANTOM_SHAPE,
+		CALL_RELEASE_SHAPE,
+
+		// The calls from here on need a world
+		CALL_SET_GRAVITY,
+		CALL_ADD_WORLD_LEAVE_CALLBACK,
+		CALL_ADD_RIGID_BODY,
+		CALL_REMOVE_RIGID_BODY,
+		CALL_CREATE_BODY_POOL,
+		CALL_SPAWN_POOLED_BODY,
+		CALL_DESTROY_BODY_POOL,
+		CALL_SUBMIT_COMMANDS,
+		CALL_ADD_FORCE,
+		CALL_ADD_TORQUE,
+		CALL_SET_LINEAR_VELOCITY,
+		CALL_SET_ANGULAR_VELOCITY,
+		CALL_APPLY_HARD_KEYFRAME,
+		CALL_APPLY_SOFT_KEYFRAME,
+		CALL_LOAD_WORLD_STATE,
+		CALL_UPDATE,
+		CALL_BEGIN_STEP,
+		CALL_END_STEP,
+		CALL_DISPOSE,
+
+		// Not a call: the number of bodies and a hash of their transforms after a step
+		CALL_CHECK,
+
+		CALL_SET_TOI_OPTIONS,
+		CALL_SET_TOI_BUDGET,
+		CALL_SET_COLLISION_QUALITY,
+		CALL_INSTALL_GROUP_FILTER,
+		CALL_SET_LAYER_COLLISION,
+		CALL_SET_COLLISION_LAYER_MASKS,
+		CALL_SET_LOD_FOCUS,
+		CALL_SET_LOD_BANDS,
+		CALL_ADVANCE,
+		CALL_APPLY_EXPLOSION
+	};
+
+	static bool needsWorld(int call)
+	{
+		return call >= CALL_SET_GRAVITY && call != CALL_SET_TOI_OPTIONS;
+	}
+
+	TraceRecorder() : lock(1000)
+	{
+		file = HK_NULL;
+		record = HK_NULL;
+		recordSize = 0;
+		recordCapacity = 0;
+	}
+
+	~TraceRecorder()
+	{
+		stop();
+		free(record);
+	}
+
+	bool start(const char* path)
+	{
+		stop();
+
+		file = fopen(path, "wb");
+		if(file == HK_NULL)
+			return false;
+
+		int header[] = { MAGIC, VERSION };
+		fwrite(header, sizeof(header), 1, file);
+
+		return true;
+	}
+
+	void stop()
+	{
+		lock.enter();
+		if(file != HK_NULL)
+		{
+			fclose(file);
+			file = HK_NULL;
+		}
+		lock.leave();
+	}
+
+	bool isRecording() const
+	{
+		return file != HK_NULL;
+	}
+
+	// Starts a record and returns true if recording, in which case the arguments are written
+	// next and end must be called
+	bool begin(Call call)
+	{
+		if(file == HK_NULL)
+			return false;
+
+		lock.enter();
+		if(file == HK_NULL)
+		{
+			lock.leave();
+			return false;
+		}
+
+		recordSize = 0;
+		writeInt(call);
+		writeInt(0);
+
+		return true;
+	}
+
+	void writeInt(int value)
+	{
+		writeBytes(&value, sizeof(int));
+	}
+
+	void writeFloat(float value)
+	{
+		writeBytes(&value, sizeof(float));
+	}
+
+	void writeInts(const int* values, int count)
+	{
+		writeBytes(values, count * sizeof(int));
+	}
+
+	void writeFloats(const float* values, int count)
+	{
+		writeBytes(values, count * sizeof(float));
+	}
+
+	void writePointer(const void* pointer)
+	{
+		hkUint64 value = (hkUint64)(hkUlong)pointer;
+		writeBytes(&value, sizeof(hkUint64));
+	}
+
+	void writeUint64(hkUint64 value)
+	{
+		writeBytes(&value, sizeof(hkUint64));
+	}
+
+	// Writes the size followed by the bytes, for arguments whose size varies
+	void writeBlob(const void* data, int size)
+	{
+		writeInt(size);
+		writeBytes(data, size);
+	}
+
+	// Writes the vertices as a blob, up to the last float of the last vertex
+	void writeVertices(const float* vertices, int numVertices, int stride)
+	{
+		int size = (numVertices > 0) ? (numVertices - 1) * stride + 3 * sizeof(float) : 0;
+		writeBlob(vertices, size);
+	}
+
+	void end()
+	{
+		int size = recordSize - 2 * sizeof(int);
+		memcpy(record + sizeof(int), &size, sizeof(int));
+		fwrite(record, recordSize, 1, file);
+
+		lock.leave();
+	}
+
+private:
+
+	void writeBytes(const void* data, int size)
+	{
+		if(size <= 0)
+			return;
+
+		if(recordSize + size > recordCapacity)
+		{
+			int capacity = hkMath::max2(recordCapacity * 2, recordSize + size);
+			char* grown = static_cast<char*>(realloc(record, capacity));
+			if(grown == HK_NULL)
+				return;
+
+			record = grown;
+			recordCapacity = capacity;
+		}
+
+		memcpy(record + recordSize, data, size);
+		recordSize += size;
+	}
+
+	hkCriticalSection lock;
+	FILE* file;
+	char* record;
+	int recordSize;
+	int recordCapacity;
+};
+
+// Walks the records of a trace written by TraceRecorder. The replay opens the trace before it
+// creates a world, so the trace is read into memory from malloc rather than the Havok heap.
+class TraceReader
+{
+public:
+
+	TraceReader()
+	{
+		data = HK_NULL;
+		dataSize = 0;
+		next = 0;
+		end = 0;
+		cursor = 0;
+	}
+
+	~TraceReader()
+	{
+		free(data);
+	}
+
+	bool open(const char* path)
+	{
+		free(data);
+		data = HK_NULL;
+		dataSize = 0;
+		next = 0;
+		end = 0;
+		cursor = 0;
+
+		FILE* file = fopen(path, "rb");
+		if(file == HK_NULL)
+			return false;
+
+		fseek(file, 0, SEEK_END);
+		int size = (int)ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		data = (size > 0) ? static_cast<char*>(malloc(size)) : HK_NULL;
+		bool read = (data != HK_NULL && fread(data, size, 1, file) == 1);
+		fclose(file);
+
+		if(!read)
+		{
+			free(data);
+			data = HK_NULL;
+			return false;
+		}
+		dataSize = size;
+
+		int header[2];
+		if(size < (int)sizeof(header))
+			return false;
+
+		memcpy(header, data, sizeof(header));
+		if(header[0] != TraceRecorder::MAGIC || header[1] != TraceRecorder::VERSION)
+			return false;
+
+		next = sizeof(header);
+
+		return true;
+	}
+
+	// Moves to the next record and returns its call id, or 0 at the end of the trace or at a
+	// truncated record
+	int nextRecord()
+	{
+		if(next + 2 * (int)sizeof(int) > dataSize)
+			return 0;
+
+		int header[2];
+		memcpy(header, data + next, sizeof(header));
+
+		cursor = next + sizeof(header);
+		end = cursor + header[1];
+		if(header[1] < 0 || end > dataSize)
+			return 0;
+
+		next = end;
+
+		return header[0];
+	}
+
+	// Returns false if a read went past the end of the current record
+	bool isValid() const
+	{
+		return cursor <= end;
+	}
+
+	int readInt()
+	{
+		int value = 0;
+		copyBytes(&value, sizeof(int));
+		return value;
+	}
+
+	float readFloat()
+	{
+		float value = 0;
+		copyBytes(&value, sizeof(float));
+		return value;
+	}
+
+	hkUint64 readUint64()
+	{
+		hkUint64 value = 0;
+		copyBytes(&value, sizeof(hkUint64));
+		return value;
+	}
+
+	// Copies count values into out, which the replay passes on to the wrapper calls
+	void readFloats(float* out, int count)
+	{
+		copyBytes(out, count * sizeof(float));
+	}
+
+	// Returns a pointer to the next size bytes of the record. The trace is read into memory
+	// whole, so the pointer stays valid until the next open.
+	const char* readBytes(int size)
+	{
+		if(size < 0)
+		{
+			cursor = end + 1;
+			return HK_NULL;
+		}
+
+		const char* p = data + cursor;
+		cursor += size;
+		return (cursor <= end) ? p : HK_NULL;
+	}
+
+private:
+
+	void copyBytes(void* out, int size)
+	{
+		const char* p = readBytes(size);
+		if(p != HK_NULL)
+			memcpy(out, p, size);
+	}
+
+	char* data;
+	int dataSize;
+	int next;
+	int end;
+	int cursor;
+};
+
+// Maps the shapes, body handles and pool ids of a trace to the ones created by its replay
+class TraceMap
+{
+public:
+
+	void addShape(hkUint64 recorded, hkpShape* shape)
+	{
+		shapes.insert((hkUlong)recorded, shape);
+	}
+
+	hkpShape* getShape(hkUint64 recorded) const
+	{
+		return shapes.getWithDefault((hkUlong)recorded, HK_NULL);
+	}
+
+	// Handles are kept by slot, so a recorded handle whose slot was reused maps to nothing
+	void addHandle(int recorded, int replayed)
+	{
+		if(recorded < 0)
+			return;
+
+		int index = BodySlotMap::getIndex(recorded);
+		if(index >= recordedHandles.getSize())
+		{
+			recordedHandles.setSize(index + 1, BodySlotMap::INVALID_HANDLE);
+			replayedHandles.setSize(index + 1, BodySlotMap::INVALID_HANDLE);
+		}
+
+		recordedHandles[index] = recorded;
+		replayedHandles[index] = replayed;
+	}
+
+	int getHandle(int recorded) const
+	{
+		if(recorded < 0)
+			return BodySlotMap::INVALID_HANDLE;
+
+		int index = BodySlotMap::getIndex(recorded);
+		if(index >= recordedHandles.getSize() || recordedHandles[index] != recorded)
+			return BodySlotMap::INVALID_HANDLE;
+
+		return replayedHandles[index];
+	}
+
+	void addPool(int recorded, int replayed)
+	{
+		if(recorded < 0)
+			return;
+
+		if(recorded >= pools.getSize())
+			pools.setSize(recorded + 1, -1);
+
+		pools[recorded] = replayed;
+	}
+
+	int getPool(int recorded) const
+	{
+		return (recorded >= 0 && recorded < pools.getSize()) ? pools[recorded] : -1;
+	}
+
+	// Forgets everything, e.g., before the world whose heap the map lives on is disposed
+	void clear()
+	{
+		shapes.clearAndDeallocate();
+		recordedHandles.clearAndDeallocate();
+		replayedHandles.clearAndDeallocate();
+		pools.clearAndDeallocate();
+	}
+
+private:
+
+	hkPointerMap<hkUlong, hkpShape*> shapes;
+	hkArray<int> recordedHandles;
+	hkArray<int> replayedHandles;
+	hkArray<int> pools;
+};
\ No newline at end of file
@@ -0,0 +1,395 @@
+#include <stdlib.h>
+
+#include <Common/Base/Thread/CriticalSection/hkCriticalSection.h>
+
+#include <Physics/Dynamics/World/hkpWorld.h>
+#include <Physics/Dynamics/Entity/hkpRigidBody.h>
+#include <Physics/Dynamics/World/hkpSimulationIsland.h>
+#include <Physics/Dynamics/World/Listener/hkpIslandActivationListener.h>
+
+#include "BodySlotMap.cpp"
+
+// Native-owned, double-buffered storage for the transforms of the bodies in active islands,
+// keyed by the slot index of each body. The arrays only grow, so once warmed up no allocation
+// happens during a frame, and the managed side reads the front buffer in place. A body can be
+// given the scale of its rendered object, in which case its transforms come out as the final
+// world matrices of that object.
+//
+// Each frame also lists the bodies whose islands went to sleep since the previous frame, along
+// with their final transforms. With change epsilons set, a frame only holds the bodies that
+// moved or turned by more than the epsilons since they were last reported.
+class TransformBuffer : public hkpIslandActivationListener
+{
+public:
+
+	struct Frame
+	{
+		hkArray<int> bodies;
+		hkArray<float> transforms;
+		int count;
+
+		// Slot indices of the bodies that went to sleep, which are also in bodies
+		hkArray<int> sleeping;
+	};
+
+	TransformBuffer() : lock(1000)
+	{
+		front = 0;
+		dirty = false;
+		filled = false;
+		frames[0].count = 0;
+		frames[1].count = 0;
+		world = HK_NULL;
+		slots = HK_NULL;
+		linearEpsilon = -1;
+		angularEpsilon = -1;
+	}
+
+	// Starts listening for islands that go to sleep. The caller must hold the world lock.
+	void attach(hkpWorld* _world, const BodySlotMap* _slots)
+	{
+		world = _world;
+		slots = _slots;
+		world->addIslandActivationListener(this);
+	}
+
+	// Must happen before the world is destroyed
+	void detach()
+	{
+		if(world != HK_NULL)
+		{
+			world->lock();
+			world->removeIslandActivationListener(this);
+			world->unlock();
+			world = HK_NULL;
+		}
+
+		lock.enter();
+		sleepers.clearAndDeallocate();
+		lock.leave();
+	}
+
+	// Only reports a body once its translation moved by more than linear, or one of its axes
+	// turned by more than angular, which is roughly in radians. A negative linear epsilon
+	// reports every active body in every frame.
+	void setEpsilons(float linear, float angular)
+	{
+		linearEpsilon = linear;
+		angularEpsilon = hkMath::max2(angular, 0.0f);
+		reported.clear();
+	}
+
+	void reserve(int numBodies)
+	{
+		for(int i = 0; i < 2; i++)
+		{
+			frames[i].bodies.reserve(numBodies);
+			frames[i].transforms.reserve(numBodies * 16);
+		}
+	}
+
+	void invalidate()
+	{
+		dirty = true;
+	}
+
+	bool isDirty() const
+	{
+		return dirty;
+	}
+
+	void publish(hkpWorld* world)
+	{
+		fill(world);
+		swap();
+	}
+
+	// Publishes the transforms of all bodies in active islands as they were at the given time
+	// within the last step, interpolated between the start and the end of the step
+	void publishAt(hkpWorld* world, hkTime time)
+	{
+		fill(world, true, time);
+		swap();
+	}
+
+	// Fills the back buffer with the transforms of all bodies in active islands, or with their
+	// transforms at the given time if interpolating. The front buffer is left untouched until
+	// swap is called.
+	void fill(hkpWorld* world, bool interpolate = false, hkTime time = 0)
+	{
+		Frame& back = frames[1 - front];
+
+		world->markForRead();
+
+		const hkArray<hkpSimulationIsland*>& activeIslands = world->getActiveSimulationIslands();
+		int count = 0;
+		for(int i = 0; i < activeIslands.getSize(); i++)
+		{
+			const hkArray<hkpEntity*>& activeEntities = activeIslands[i]->getEntities();
+			int size = activeEntities.getSize();
+
+			if(back.bodies.getSize() < count + size)
+			{
+				back.bodies.setSize(count + size);
+				back.transforms.setSize((count + size) * 16);
+			}
+
+			for(int j = 0; j < size; j++)
+			{
+				hkpRigidBody* rigidBody = static_cast<hkpRigidBody*>(activeEntities[j]);
+				int handle = BodySlotMap::getHandle(rigidBody);
+
+				hkTransform transform;
+				if(interpolate)
+					rigidBody->approxTransformAt(time, transform);
+				else
+					rigidBody->approxCurrentTransform( transform );
+
+				if(!report(handle, transform, false))
+					continue;
+
+				back.bodies[count] = BodySlotMap::getIndex(handle);
+				store(transform, handle, back.transforms.begin() + count * 16);
+				count++;
+			}
+		}
+
+		// The bodies that went to sleep are reported at their final transforms, even if those
+		// are within the epsilons of the last reported ones
+		back.sleeping.clear();
+
+		lock.enter();
+		for(int i = 0; i < sleepers.getSize(); i++)
+		{
+			hkpRigidBody* rigidBody = sleepers[i].body;
+			int handle = sleepers[i].handle;
+			if(slots->get(handle) != rigidBody || rigidBody->getWorld() == HK_NULL || rigidBody->isActive())
+				continue;
+
+			if(back.bodies.getSize() < count + 1)
+			{
+				back.bodies.setSize(count + 1);
+				back.transforms.setSize((count + 1) * 16);
+			}
+
+			report(handle, rigidBody->getTransform(), true);
+
+			int index = BodySlotMap::getIndex(handle);
+			back.bodies[count] = index;
+			store(rigidBody->getTransform(), handle, back.transforms.begin() + count * 16);
+			back.sleeping.pushBack(index);
+			count++;
+		}
+		sleepers.clear();
+		lock.leave();
+
+		back.count = count;
+
+		world->unmarkForRead();
+
+		dirty = false;
+		filled = true;
+	}
+
+	// Publishes the transforms of the given bodies only, whether they are active or not
+	void publish(const hkArray<hkpRigidBody*>& rigidBodies)
+	{
+		Frame& back = frames[1 - front];
+
+		int count = rigidBodies.getSize();
+		if(back.bodies.getSize() < count)
+		{
+			back.bodies.setSize(count);
+			back.transforms.setSize(count * 16);
+		}
+
+		for(int i = 0; i < count; i++)
+		{
+			int handle = BodySlotMap::getHandle(rigidBodies[i]);
+			back.bodies[i] = BodySlotMap::getIndex(handle);
+			report(handle, rigidBodies[i]->getTransform(), true);
+			store(rigidBodies[i]->getTransform(), handle, back.transforms.begin() + i * 16);
+		}
+		back.count = count;
+		back.sleeping.clear();
+
+		filled = true;
+		swap();
+	}
+
+	// Sets the scale applied to the transforms of a body. It is dropped when the slot of the
+	// body is reused.
+	void setScale(int handle, float x, float y, float z)
+	{
+		int index = BodySlotMap::getIndex(handle);
+		if(index >= scales.getSize())
+		{
+			scales.setSize(index + 1);
+			scaleHandles.setSize(index + 1, BodySlotMap::INVALID_HANDLE);
+		}
+
+		scales[index].set(x, y, z);
+		scaleHandles[index] = handle;
+	}
+
+	// Writes a transform as 16 floats in column major order, which is the layout of an XNA
+	// matrix. If the body has a scale, the axes of the rotation are scaled by it, the same as
+	// multiplying a scale matrix with the transform on the managed side.
+	void store(const hkTransform& transform, int handle, float* out) const
+	{
+		int index = BodySlotMap::getIndex(handle);
+		if(handle < 0 || index >= scaleHandles.getSize() || scaleHandles[index] != handle)
+		{
+			transform.get4x4ColumnMajor(out);
+			return;
+		}
+
+		const hkVector4& scale = scales[index];
+		const hkRotation& rotation = transform.getRotation();
+
+		hkVector4 axis;
+		axis.setMul4(scale(0), rotation.getColumn(0));
+		axis.store4(out);
+		axis.setMul4(scale(1), rotation.getColumn(1));
+		axis.store4(out + 4);
+		axis.setMul4(scale(2), rotation.getColumn(2));
+		axis.store4(out + 8);
+		transform.getTranslation().store4(out + 12);
+
+		out[3] = 0;
+		out[7] = 0;
+		out[11] = 0;
+		out[15] = 1;
+	}
+
+	// Called by the world, possibly on a worker thread, when an island goes to sleep
+	virtual void islandDeactivatedCallback( hkpSimulationIsland* island )
+	{
+		const hkArray<hkpEntity*>& entities = island->getEntities();
+
+		lock.enter();
+		for(int i = 0; i < entities.getSize(); i++)
+		{
+			Sleeper sleeper = { static_cast<hkpRigidBody*>(entities[i]), BodySlotMap::getHandle(entities[i]) };
+			sleepers.pushBack(sleeper);
+		}
+		lock.leave();
+	}
+
+	virtual void islandActivatedCallback( hkpSimulationIsland* island )
+	{
+	}
+
+	void swap()
+	{
+		if(!filled)
+			return;
+
+		front = 1 - front;
+		filled = false;
+	}
+
+	Frame& getFront()
+	{
+		return frames[front];
+	}
+
+	void clear()
+	{
+		for(int i = 0; i < 2; i++)
+		{
+			frames[i].bodies.clearAndDeallocate();
+			frames[i].transforms.clearAndDeallocate();
+			frames[i].sleeping.clearAndDeallocate();
+			frames[i].count = 0;
+		}
+		scales.clearAndDeallocate();
+		scaleHandles.clearAndDeallocate();
+		reported.clearAndDeallocate();
+		dirty = false;
+		filled = false;
+	}
+
+private:
+
+	struct Sleeper
+	{
+		hkpRigidBody* body;
+		int handle;
+	};
+
+	// The last transform reported for a body, without its scale
+	struct Reported
+	{
+		hkVector4 translation;
+		hkVector4 axis0;
+		hkVector4 axis1;
+		int handle;
+	};
+
+	// Returns true if the transform of a body is to be reported, that is, if it is forced, the
+	// epsilons are off, or it differs from the last reported one by more than the epsilons.
+	// Remembers the transform if so.
+	bool report(int handle, const hkTransform& transform, bool force)
+	{
+		if(linearEpsilon < 0 || handle < 0)
+			return true;
+
+		int index = BodySlotMap::getIndex(handle);
+		if(index >= reported.getSize())
+		{
+			int oldSize = reported.getSize();
+			reported.setSize(index + 1);
+			for(int i = oldSize; i <= index; i++)
+				reported[i].handle = BodySlotMap::INVALID_HANDLE;
+		}
+
+		Reported& last = reported[index];
+		const hkRotation& rotation = transform.getRotation();
+		if(!force && last.handle == handle)
+		{
+			hkVector4 d;
+			d.setSub4(transform.getTranslation(), last.translation);
+			bool changed = d.lengthSquared3() > linearEpsilon * linearEpsilon;
+
+			d.setSub4(rotation.getColumn(0), last.axis0);
+			changed = changed || d.lengthSquared3() > angularEpsilon * angularEpsilon;
+
+			d.setSub4(rotation.getColumn(1), last.axis1);
+			changed = changed || d.lengthSquared3() > angularEpsilon * angularEpsilon;
+
+			if(!changed)
+				return false;
+		}
+
+		last.translation = transform.getTranslation();
+		last.axis0 = rotation.getColumn(0);
+		last.axis1 = rotation.getColumn(1);
+		last.handle = handle;
+
+		return true;
+	}
+
+	Frame frames[2];
+	int front;
+
+	// Indexed by body slot, with the handle each scale was set for
+	hkArray<hkVector4> scales;
+	hkArray<int> scaleHandles;
+
+	hkpWorld* world;
+	const BodySlotMap* slots;
+
+	// Bodies whose islands went to sleep since the last fill
+	hkCriticalSection lock;
+	hkArray<Sleeper> sleepers;
+
+	float linearEpsilon;
+	float angularEpsilon;
+
+	// Indexed by body slot
+	hkArray<Reported> reported;
+
+	bool dirty;
+	bool filled;
+};
\ No newline at end of file
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <Common/Base/hkBase.h>
+#include <Common/Base/Thread/Job/ThreadPool/hkJobThreadPool.h>
+#include <Common/Base/Thread/JobQueue/hkJobQueue.h>
+#include <Common/Base/Thread/Semaphore/hkSemaphoreBusyWait.h>
+
+#include <Physics/Collide/Query/CastUtil/hkpWorldRayCastInput.h>
+#include <Physics/Collide/Query/CastUtil/hkpWorldRayCastOutput.h>
+#include <Physics/Collide/Query/CastUtil/hkpLinearCastInput.h>
+#include <Physics/Collide/Query/Collector/RayCollector/hkpClosestRayHitCollector.h>
+#include <Physics/Collide/Query/Collector/PointCollector/hkpClosestCdPointCollector.h>
+#include <Physics/Collide/Query/Multithreaded/RayCastQuery/hkpRayCastQueryJobs.h>
+#include <Physics/Collide/BroadPhase/hkpBroadPhase.h>
+#include <Physics/Collide/BroadPhase/hkpBroadPhaseHandlePair.h>
+#include <Physics/Dynamics/World/hkpWorld.h>
+#include <Physics/Dynamics/Entity/hkpRigidBody.h>
+
+#include "BodySlotMap.cpp"
+
+// Casts batches of rays and shapes against the world and packs the closest hit of each cast
+// into a flat array. Large ray batches are split into ray cast jobs that the worker threads of
+// a multithreaded world process together with the calling thread. The explode query gathers
+// the bodies around an explosion with a broadphase AABB query and pushes them away from its
+// center. The command and result arrays only grow, so repeated batches of similar size do not
+// allocate.
+class WorldQuery
+{
+public:
+
+	// Closest hit of a single cast. body is INVALID_HANDLE if nothing was hit.
+	struct Hit
+	{
+		int body;
+		float position[3];
+		float normal[3];
+		float distance;
+	};
+
+	enum
+	{
+		// Rays below this count are cast on the calling thread only
+		MIN_RAYS_PER_TASK = 16
+	};
+
+	WorldQuery()
+	{
+		semaphore = HK_NULL;
+	}
+
+	~WorldQuery()
+	{
+		delete semaphore;
+	}
+
+	// Casts count rays from origins along directions, which do not need to be normalized, up to
+	// maxDistance. The rays only hit bodies that the collision filter lets collide with a body of
+	// the given filter info. The caller must not hold the world lock. Returns the number of rays
+	// that hit.
+	int castRays(hkpWorld* world, hkJobQueue* jobQueue, hkJobThreadPool* threadPool, int count,
+		const float* origins, const float* directions, float maxDistance, hkUint32 filterInfo, Hit* hits)
+	{
+		rayInputs.setSize(count);
+		for(int i = 0; i < count; i++)
+		{
+			const float* origin = &origins[i * 3];
+			hkVector4 direction(directions[i * 3], directions[i * 3 + 1], directions[i * 3 + 2]);
+			if(direction.lengthSquared3() > 0)
+				direction.normalize3();
+
+			rayInputs[i].m_from.set(origin[0], origin[1], origin[2]);
+			rayInputs[i].m_to.setAddMul4(rayInputs[i].m_from, direction, maxDistance);
+			rayInputs[i].m_filterInfo = filterInfo;
+		}
+
+		rayOutputs.setSize(count);
+
+		world->lockReadOnly();
+
+		if(jobQueue != HK_NULL && threadPool != HK_NULL && count >= MIN_RAYS_PER_TASK * 2)
+			castRaysMultithreaded(world, jobQueue, threadPool, count);
+		else
+		{
+			for(int i = 0; i < count; i++)
+			{
+				hkpClosestRayHitCollector collector;
+				world->castRay(rayInputs[i], collector);
+
+				if(collector.hasHit())
+					rayOutputs[i] = collector.getHit();
+				else
+					rayOutputs[i].reset();
+			}
+		}
+
+		world->unlockReadOnly();
+
+		int numHits = 0;
+		for(int i = 0; i < count; i++)
+		{
+			const hkpWorldRayCastOutput& output = rayOutputs[i];
+			if(!output.hasHit())
+			{
+				setMiss(hits[i]);
+				continue;
+			}
+
+			hkVector4 position;
+			position.setInterpolate4(rayInputs[i].m_from, rayInputs[i].m_to, output.m_hitFraction);
+			setHit(hits[i], output.m_rootCollidable, position, output.m_normal, output.m_hitFraction * maxDistance);
+			numHits++;
+		}
+
+		return numHits;
+	}
+
+	// Sweeps a shape from origins along directions, which do not need to be normalized, up to
+	// maxDistance. rotations holds a quaternion per cast, or is null to cast the shape
+	// unrotated. The shape is filtered like a body with the given filter info. The caller must
+	// not hold the world lock. Returns the number of casts that hit, which is 0 for a null shape.
+	int castShapes(hkpWorld* world, const hkpShape* shape, int count, const float* origins,
+		const float* rotations, const float* directions, float maxDistance, hkUint32 filterInfo, Hit* hits)
+	{
+		if(shape == HK_NULL)
+		{
+			for(int i = 0; i < count; i++)
+				setMiss(hits[i]);
+			return 0;
+		}
+
+		int numHits = 0;
+
+		world->lockReadOnly();
+
+		for(int i = 0; i < count; i++)
+		{
+			const float* origin = &origins[i * 3];
+			hkVector4 direction(directions[i * 3], directions[i * 3 + 1], directions[i * 3 + 2]);
+			if(direction.lengthSquared3() > 0)
+				direction.normalize3();
+
+			hkTransform transform;
+			transform.setIdentity();
+			if(rotations != HK_NULL)
+			{
+				const float* rot = &rotations[i * 4];
+				transform.setRotation(hkQuaternion(rot[0], rot[1], rot[2], rot[3]));
+			}
+			transform.setTranslation(hkVector4(origin[0], origin[1], origin[2]));
+
+			hkpCollidable collidable(shape, &transform);
+			collidable.setCollisionFilterInfo(filterInfo);
+
+			hkpLinearCastInput input;
+			input.m_to.setAddMul4(transform.getTranslation(), direction, maxDistance);
+
+			hkpClosestCdPointCollector collector;
+			world->linearCast(&collidable, input, collector);
+
+			if(!collector.hasHit())
+			{
+				setMiss(hits[i]);
+				continue;
+			}
+
+			// The distance of a linear cast contact is the fraction of the path travelled
+			const hkContactPoint& contact = collector.getHitContact();
+			setHit(hits[i], collector.getHit().m_rootCollidableB, contact.getPosition(), contact.getNormal(),
+				contact.getDistance() * maxDistance);
+			numHits++;
+		}
+
+		world->unlockReadOnly();
+
+		return numHits;
+	}
+
+	// Pushes the dynamic bodies within radius of center away from it. A body at distance d gets
+	// an impulse of impulse * (1 - d / radius) ^ falloff, where d is measured to the closest
+	// point of its AABB. The candidates come from a single broadphase AABB query, so the cost
+	// grows with the bodies nearby rather than with the world. Only bodies whose collision
+	// layer has its bit set in layerMask are pushed. With occlusion, a ray is cast from the
+	// center to each body, and bodies hidden behind another body are spared. The caller must
+	// not hold the world lock. Writes up to maxAffected handles of the pushed bodies to
+	// affected and returns the number of bodies pushed.
+	int explode(hkpWorld* world, hkJobQueue* jobQueue, hkJobThreadPool* threadPool, const float* center,
+		float radius, float impulse, float falloff, hkUint32 layerMask, bool occlusion, int* affected, 
+		int maxAffected)
+	{
+		if(radius <= 0)
+			return 0;
+
+		hkVector4 origin(center[0], center[1], center[2]);
+		hkVector4 extent;
+		extent.setAll3(radius);
+		hkVector4 queryMin, queryMax;
+		queryMin.setSub4(origin, extent);
+		queryMax.setAdd4(origin, extent);
+
+		world->lockReadOnly();
+
+		pairs.clear();
+		world->getBroadPhase()->querySingleAabb(queryMin, queryMax, pairs);
+
+		targets.clear();
+		hkReal maxDistance = 0;
+		for(int i = 0; i < pairs.getSize(); i++)
+		{
+			const hkpTypedBroadPhaseHandle* handle = static_cast<const hkpTypedBroadPhaseHandle*>(pairs[i].m_b);
+			const hkpCollidable* collidable = static_cast<const hkpCollidable*>(handle->getOwner());
+			hkpRigidBody* body = hkpGetRigidBody(collidable);
+			if(body == HK_NULL || body->getMotionType() == hkpMotion::MOTION_FIXED || 
+				body->getMotionType() == hkpMotion::MOTION_KEYFRAMED)
+				continue;
+
+			int layer = collidable->getCollisionFilterInfo() & 31;
+			if((layerMask & (1 << layer)) == 0)
+				continue;
+
+			hkAabb aabb;
+			collidable->getShape()->getAabb(body->getTransform(), 0.0f, aabb);
+			hkVector4 closest;
+			closest.setMin4(origin, aabb.m_max);
+			closest.setMax4(closest, aabb.m_min);
+
+			hkVector4 d;
+			d.setSub4(closest, origin);
+			hkReal distance = d.length3();
+			if(distance > radius)
+				continue;
+
+			Target target;
+			target.body = body;
+			target.direction.setSub4(body->getCenterOfMassInWorld(), origin);
+			target.distance = distance;
+			target.occluded = false;
+			targets.pushBack(target);
+
+			maxDistance = hkMath::max2(maxDistance, target.direction.length3());
+		}
+
+		world->unlockReadOnly();
+
+		if(occlusion && targets.getSize() > 0)
+			findOccluded(world, jobQueue, threadPool, origin, maxDistance);
+
+		int count = 0;
+
+		world->lock();
+
+		for(int i = 0; i < targets.getSize(); i++)
+		{
+			Target& target = targets[i];
+			if(target.occluded)
+				continue;
+
+			hkReal scale = (falloff > 0) ? hkMath::pow(1 - target.distance / radius, falloff) : 1;
+			if(target.direction.lengthSquared3() > 0)
+				target.direction.normalize3();
+			else
+				target.direction.set(0, 1, 0);
+
+			hkVector4 push;
+			push.setMul4(impulse * scale, target.direction);
+			target.body->activate();
+			target.body->applyLinearImpulse(push);
+
+			if(count < maxAffected)
+				affected[count] = BodySlotMap::getHandle(target.body);
+			count++;
+		}
+
+		world->unlock();
+
+		return count;
+	}
+
+	void clear()
+	{
+		rayInputs.clearAndDeallocate();
+		rayOutputs.clearAndDeallocate();
+		rayCommands.clearAndDeallocate();
+		pairs.clearAndDeallocate();
+		targets.clearAndDeallocate();
+		occlusionRays.clearAndDeallocate();
+		occlusionHits.clearAndDeallocate();
+
+		delete semaphore;
+		semaphore = HK_NULL;
+	}
+
+private:
+
+	// A body in reach of an explosion. direction points from the center to its center of mass.
+	struct Target
+	{
+		hkVector4 direction;
+		hkpRigidBody* body;
+		hkReal distance;
+		bool occluded;
+	};
+
+	// Casts a ray from the origin to the center of mass of each target, in parallel if there
+	// are many, and marks the targets whose ray first hits another body. A ray that starts
+	// inside its target hits nothing and leaves it exposed.
+	void findOccluded(hkpWorld* world, hkJobQueue* jobQueue, hkJobThreadPool* threadPool, 
+		const hkVector4& origin, hkReal maxDistance)
+	{
+		int count = targets.getSize();
+		occlusionRays.setSize(count * 6);
+		occlusionHits.setSize(count);
+
+		float* origins = occlusionRays.begin();
+		float* directions = occlusionRays.begin() + count * 3;
+		for(int i = 0; i < count; i++)
+		{
+			for(int j = 0; j < 3; j++)
+			{
+				origins[i * 3 + j] = origin(j);
+				directions[i * 3 + j] = targets[i].direction(j);
+			}
+		}
+
+		castRays(world, jobQueue, threadPool, count, origins, directions, maxDistance, 0, occlusionHits.begin());
+
+		for(int i = 0; i < count; i++)
+		{
+			const Hit& hit = occlusionHits[i];
+			int handle = BodySlotMap::getHandle(targets[i].body);
+			targets[i].occluded = (hit.body != BodySlotMap::INVALID_HANDLE && hit.body != handle &&
+				hit.distance < targets[i].direction.length3());
+		}
+	}
+
+	// Splits the rays into one task per thread and waits for all of them. The caller must hold
+	// the world lock for reading.
+	void castRaysMultithreaded(hkpWorld* world, hkJobQueue* jobQueue, hkJobThreadPool* threadPool, int count)
+	{
+		if(semaphore == HK_NULL)
+			semaphore = new hkSemaphoreBusyWait(0, 1000);
+
+		rayCommands.setSize(count);
+		for(int i = 0; i < count; i++)
+		{
+			hkpWorldRayCastCommand& command = rayCommands[i];
+			command.m_rayInput = rayInputs[i];
+			command.m_results = &rayOutputs[i];
+			command.m_resultsCapacity = 1;
+			command.m_numResultsOut = 0;
+		}
+
+		int numThreads = threadPool->getNumThreads() + 1;
+		int commandsPerTask = hkMath::max2((count + numThreads - 1) / numThreads, (int)MIN_RAYS_PER_TASK);
+
+		hkpCollisionQueryJobHeader* jobHeader = hkAllocateChunk<hkpCollisionQueryJobHeader>(1, HK_MEMORY_CLASS_COLLIDE);
+
+		hkpWorldRayCastJob job(world->getCollisionInput(), jobHeader, rayCommands.begin(), count,
+			world->m_broadPhase, semaphore, commandsPerTask);
+		job.setRunsOnSpuOrPpu();
+		jobQueue->addJob(job, hkJobQueue::JOB_HIGH_PRIORITY);
+
+		threadPool->processAllJobs(jobQueue);
+		jobQueue->processAllJobs();
+		threadPool->waitForCompletion();
+		semaphore->acquire();
+
+		hkDeallocateChunk(jobHeader, 1, HK_MEMORY_CLASS_COLLIDE);
+
+		for(int i = 0; i < count; i++)
+			if(rayCommands[i].m_numResultsOut == 0)
+				rayOutputs[i].reset();
+	}
+
+	static void setMiss(Hit& hit)
+	{
+		hit.body = BodySlotMap::INVALID_HANDLE;
+		for(int j = 0; j < 3; j++)
+		{
+			hit.position[j] = 0;
+			hit.normal[j] = 0;
+		}
+		hit.distance = 0;
+	}
+
+	static void setHit(Hit& hit, const hkpCollidable* collidable, const hkVector4& position,
+		const hkVector4& normal, float distance)
+	{
+		hkpRigidBody* body = hkpGetRigidBody(collidable);
+		hit.body = (body != HK_NULL) ? BodySlotMap::getHandle(body) : BodySlotMap::INVALID_HANDLE;
+		for(int j = 0; j < 3; j++)
+		{
+			hit.position[j] = position(j);
+			hit.normal[j] = normal(j);
+		}
+		hit.distance = distance;
+	}
+
+	hkArray<hkpWorldRayCastInput> rayInputs;
+	hkArray<hkpWorldRayCastOutput> rayOutputs;
+	hkArray<hkpWorldRayCastCommand> rayCommands;
+
+	hkArray<hkpBroadPhaseHandlePair> pairs;
+	hkArray<Target> targets;
+	hkArray<float> occlusionRays;
+	hkArray<Hit> occlusionHits;
+	hkSemaphoreBusyWait* semaphore;
+};
\ No newline at end of file
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <Physics/Dynamics/World/hkpWorld.h>
+#include <Physics/Dynamics/Entity/hkpRigidBody.h>
+
+#include "BodySlotMap.cpp"
+
+// Captures and restores the transforms, velocities and activation state of the bodies in the
+// world as a flat binary snapshot: a header followed by one fixed-size record per body, in
+// slot order. Fixed bodies and bodies outside the world are left out. A delta snapshot only
+// holds the records that differ from a full base snapshot, and is loaded on top of it.
+class WorldState
+{
+public:
+
+	enum
+	{
+		MAGIC = 0x53574b48, // "HKWS"
+		VERSION = 1,
+		FLAG_DELTA = 1,
+		RECORD_ACTIVE = 1
+	};
+
+	struct Header
+	{
+		int magic;
+		int version;
+		int flags;
+		int numRecords;
+	};
+
+	struct Record
+	{
+		int handle;
+		int flags;
+		float position[3];
+		float rotation[4];
+		float linearVelocity[3];
+		float angularVelocity[3];
+	};
+
+	// Writes a snapshot into the buffer if it fits and returns its size either way, so the
+	// caller can retry with a larger buffer. With a base, only the records that differ from it
+	// are written. Returns -1 if the base is not a valid full snapshot. The caller must hold
+	// the world lock.
+	static int save(const BodySlotMap& bodies, char* buffer, int capacity, const char* base, int baseSize)
+	{
+		const Record* baseRecords = HK_NULL;
+		int numBaseRecords = 0;
+		if(base != HK_NULL)
+		{
+			const Header* baseHeader = validate(base, baseSize);
+			if(baseHeader == HK_NULL || (baseHeader->flags & FLAG_DELTA) != 0)
+				return -1;
+
+			baseRecords = reinterpret_cast<const Record*>(base + sizeof(Header));
+			numBaseRecords = baseHeader->numRecords;
+		}
+
+		int numRecords = 0;
+		int next = 0;
+		bool fits = (capacity >= (int)sizeof(Header));
+		Record* records = reinterpret_cast<Record*>(buffer + sizeof(Header));
+
+		for(int i = 0; i < bodies.getCapacity(); i++)
+		{
+			hkpRigidBody* body = bodies.getAt(i);
+			if(body == HK_NULL || body->getWorld() == HK_NULL || body->isFixed())
+				continue;
+
+			Record record;
+			capture(body, record);
+
+			// Both snapshots are in slot order, so the matching base record is found by
+			// walking the base along with the slots
+			if(baseRecords != HK_NULL)
+			{
+				while(next < numBaseRecords && BodySlotMap::getIndex(baseRecords[next].handle) < i)
+					next++;
+
+				if(next < numBaseRecords && memcmp(&baseRecords[next], &record, sizeof(Record)) == 0)
+					continue;
+			}
+
+			int size = sizeof(Header) + (numRecords + 1) * sizeof(Record);
+			fits = fits && (size <= capacity);
+			if(fits)
+				records[numRecords] = record;
+
+			numRecords++;
+		}
+
+		if(fits)
+		{
+			Header* header = reinterpret_cast<Header*>(buffer);
+			header->magic = MAGIC;
+			header->version = VERSION;
+			header->flags = (base != HK_NULL) ? FLAG_DELTA : 0;
+			header->numRecords = numRecords;
+		}
+
+		return sizeof(Header) + numRecords * sizeof(Record);
+	}
+
+	// Restores a snapshot, applying the base first if it is a delta, and adds every body it
+	// touched to restored; bodies in both the base and the delta are added twice. Records of
+	// bodies that were removed since are skipped. Returns false if the snapshot or the base it
+	// needs is invalid. The caller must hold the world lock.
+	static bool load(const BodySlotMap& bodies, const char* buffer, int size, const char* base,
+		int baseSize, hkArray<hkpRigidBody*>& restored)
+	{
+		const Header* header = validate(buffer, size);
+		if(header == HK_NULL)
+			return false;
+
+		if((header->flags & FLAG_DELTA) != 0)
+		{
+			const Header* baseHeader = validate(base, baseSize);
+			if(baseHeader == HK_NULL || (baseHeader->flags & FLAG_DELTA) != 0)
+				return false;
+
+			apply(bodies, baseHeader, restored);
+		}
+
+		apply(bodies, header, restored);
+
+		return true;
+	}
+
+private:
+
+	static const Header* validate(const char* buffer, int size)
+	{
+		if(buffer == HK_NULL || size < (int)sizeof(Header))
+			return HK_NULL;
+
+		const Header* header = reinterpret_cast<const Header*>(buffer);
+		if(header->magic != MAGIC || header->version != VERSION || header->numRecords < 0 ||
+			header->numRecords > (size - (int)sizeof(Header)) / (int)sizeof(Record))
+			return HK_NULL;
+
+		return header;
+	}
+
+	static void capture(const hkpRigidBody* body, Record& record)
+	{
+		record.handle = BodySlotMap::getHandle(body);
+		record.flags = body->isActive() ? RECORD_ACTIVE : 0;
+
+		const hkVector4& position = body->getPosition();
+		const hkVector4& rotation = body->getRotation().m_vec;
+		const hkVector4& linearVelocity = body->getLinearVelocity();
+		const hkVector4& angularVelocity = body->getAngularVelocity();
+		for(int i = 0; i < 3; i++)
+		{
+			record.position[i] = position(i);
+			record.linearVelocity[i] = linearVelocity(i);
+			record.angularVelocity[i] = angularVelocity(i);
+		}
+
+		for(int i = 0; i < 4; i++)
+			record.rotation[i] = rotation(i);
+	}
+
+	static void apply(const BodySlotMap& bodies, const Header* header, hkArray<hkpRigidBody*>& restored)
+	{
+		const Record* records = reinterpret_cast<const Record*>(header + 1);
+		for(int i = 0; i < header->numRecords; i++)
+		{
+			const Record& record = records[i];
+			hkpRigidBody* body = bodies.get(record.handle);
+			if(body == HK_NULL || body->getWorld() == HK_NULL)
+				continue;
+
+			const float* p = record.position;
+			const float* r = record.rotation;
+			body->setPositionAndRotation(hkVector4(p[0], p[1], p[2]), hkQuaternion(r[0], r[1], r[2], r[3]));
+			body->setLinearVelocity(hkVector4(record.linearVelocity[0], record.linearVelocity[1],
+				record.linearVelocity[2]));
+			body->setAngularVelocity(hkVector4(record.angularVelocity[0], record.angularVelocity[1],
+				record.angularVelocity[2]));
+
+			if((record.flags & RECORD_ACTIVE) != 0)
+				body->activate();
+			else
+				body->requestDeactivation();
+
+			restored.pushBack(body);
+		}
+	}
+};
\ No newline at end of file